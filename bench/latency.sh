@@ -0,0 +1,72 @@
+#!/bin/sh
+# times the commands that should feel instant, and fails if any of
+# them averages over its budget. budgets are in microseconds and can
+# be overridden from the environment, e.g. for slow CI machines
+#
+#   bench/latency.sh <hewg binary> [runs]
+
+set -e
+
+if [ -z "$1" ]; then
+  echo "usage: $0 <hewg binary> [runs]" >&2
+  exit 1
+fi
+
+hewg=$(realpath "$1")
+runs=${2:-50}
+
+version_budget=${HEWG_VERSION_BUDGET:-5000}
+noop_build_budget=${HEWG_NOOP_BUILD_BUDGET:-25000}
+clean_budget=${HEWG_CLEAN_BUDGET:-10000}
+
+project=$(mktemp -d)
+trap 'rm -rf "$project"' EXIT
+cd "$project"
+"$hewg" init executable latency_bench > /dev/null
+
+# average wall time of running "$hewg $@" in microseconds
+time_command() {
+  total=0
+  i=0
+  while [ "$i" -lt "$runs" ]; do
+    start=$(date +%s%N)
+    "$hewg" "$@" > /dev/null
+    end=$(date +%s%N)
+    total=$((total + (end - start) / 1000))
+    i=$((i + 1))
+  done
+  echo $((total / runs))
+}
+
+failed=0
+
+# prints the result, and marks the run failed if it's over budget
+check() {
+  name=$1
+  took=$2
+  budget=$3
+
+  if [ "$took" -gt "$budget" ]; then
+    echo "  $name: ${took}us, over its ${budget}us budget"
+    failed=1
+  else
+    echo "  $name: ${took}us (budget ${budget}us)"
+  fi
+}
+
+echo "average of $runs runs"
+
+check "hewg --version" "$(time_command --version)" "$version_budget"
+
+# nothing's been built, so there's nothing to clean, and nothing
+# worth counting down for. a countdown sleeps through every run
+if "$hewg" clean | grep -q '[0-9]\.\.\.$'; then
+  echo "  hewg clean: counts down with nothing built" >&2
+  exit 1
+fi
+check "hewg clean" "$(time_command clean)" "$clean_budget"
+
+"$hewg" build > /dev/null
+check "hewg build (no-op)" "$(time_command build)" "$noop_build_budget"
+
+exit $failed
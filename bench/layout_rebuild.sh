@@ -0,0 +1,66 @@
+#!/bin/sh
+# rebuild scenario for --layout-profile with bolt: builds a fresh
+# project with a layout profile, edits a source and rebuilds, and
+# fails unless the optimized binary in target/ changed with it. a
+# final rebuild without changes has to leave the binary alone
+#
+#   bench/layout_rebuild.sh <hewg binary> [perf.data or .fdata profile]
+#
+# needs llvm-bolt, and perf when no profile is given
+
+set -e
+
+if [ -z "$1" ]; then
+  echo "usage: $0 <hewg binary> [profile]" >&2
+  exit 1
+fi
+
+hewg=$(realpath "$1")
+profile=${2:+$(realpath "$2")}
+
+project=$(mktemp -d)
+trap 'rm -rf "$project"' EXIT
+cd "$project"
+
+"$hewg" init executable layout_rebuild > /dev/null
+binary=target/default/layout_rebuild
+
+if [ -z "$profile" ]; then
+  "$hewg" build > /dev/null
+  profile=$project/perf.data
+  perf record -q -e cycles:u -j any,u -o "$profile" "$binary" > /dev/null
+fi
+
+# fails if the build said the optimized binary was up to date
+build_with_layout() {
+  output=$("$hewg" build --layout-profile "$profile")
+  if echo "$output" | grep -q "<$binary> is up to date"; then
+    echo "$1: bolt was skipped"
+    exit 1
+  fi
+}
+
+build_with_layout "first build"
+before=$(sha256sum "$binary" | cut -d' ' -f1)
+
+sed -i 's/hello, world!/hello, layout!/' src/main.cc
+build_with_layout "rebuild after editing src/main.cc"
+after=$(sha256sum "$binary" | cut -d' ' -f1)
+
+if [ "$before" = "$after" ]; then
+  echo "rebuild after editing src/main.cc: $binary didn't change"
+  exit 1
+fi
+
+if [ "$("$binary")" != "hello, layout!" ]; then
+  echo "rebuild after editing src/main.cc: $binary runs the old code"
+  exit 1
+fi
+
+"$hewg" build --layout-profile "$profile" > /dev/null
+if [ "$(sha256sum "$binary" | cut -d' ' -f1)" != "$after" ]; then
+  echo "rebuild without changes: $binary changed"
+  exit 1
+fi
+
+echo "ok"
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <map>
+#include <print>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "confs.hh"
+#include "resolve.hh"
+
+/*
+  resolves a synthetic registry of packages, entirely in memory,
+  so only the resolver itself is measured
+
+  every package has a handful of versions, and depends on a few
+  packages after it. some dependencies pin an exact version,
+  which is what forces the resolver to go back on its choices
+
+  usage: resolve_bench [packages] [versions] [iterations]
+*/
+
+class SyntheticRegistry : public PackageSource
+{
+  std::map<std::string, std::vector<version_triplet>, std::less<>> m_versions;
+  std::map<std::pair<std::string, version_triplet>, std::vector<Dependency>>
+    m_dependencies;
+
+public:
+  SyntheticRegistry(int const packages, int const versions)
+  {
+    std::mt19937 rng(1234);
+
+    auto const name_of = [](int const i) { return std::format("pkg{}", i); };
+
+    for (int i = 0; i < packages; i++) {
+      auto& list = m_versions[name_of(i)];
+
+      for (int v = 0; v < versions; v++) {
+        version_triplet const version{ 1, v, 0 };
+        list.push_back(version);
+
+        auto& deps = m_dependencies[{ name_of(i), version }];
+
+        for (int d = 0; d < 3 and i + 1 < packages; d++) {
+          auto const target =
+            std::uniform_int_distribution<int>(i + 1, packages - 1)(rng);
+          auto const minor =
+            std::uniform_int_distribution<int>(0, versions - 1)(rng);
+          bool const exact = std::uniform_int_distribution<int>(0, 9)(rng) == 0;
+
+          deps.push_back(Dependency{
+            name_of(target), version_triplet{ 1, minor, 0 }, exact });
+        }
+      }
+    }
+  }
+
+  std::span<version_triplet const> versions(std::string_view name) override
+  {
+    auto const found = m_versions.find(name);
+    if (found == m_versions.end())
+      return {};
+    return found->second;
+  }
+
+  std::span<Dependency const> dependencies(std::string_view name,
+                                           version_triplet version) override
+  {
+    return m_dependencies.at({ std::string(name), version });
+  }
+};
+
+int
+main(int argc, char** argv)
+{
+  int const packages = argc > 1 ? std::atoi(argv[1]) : 500;
+  int const versions = argc > 2 ? std::atoi(argv[2]) : 10;
+  int const iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  SyntheticRegistry registry(packages, versions);
+
+  // the first few packages reach most of the rest
+  std::vector<Dependency> root;
+  for (int i = 0; i < std::min(packages, 20); i++)
+    root.push_back(
+      Dependency{ std::format("pkg{}", i), version_triplet{ 1, 0, 0 }, false });
+
+  using namespace std::chrono;
+  std::size_t resolved = 0;
+  std::size_t failed = 0;
+
+  auto const start = steady_clock::now();
+
+  for (int i = 0; i < iterations; i++) {
+    try {
+      resolved = resolve_dependencies(registry, root).size();
+    } catch (std::runtime_error const&) {
+      failed++;
+    }
+  }
+
+  auto const elapsed =
+    duration<double, std::milli>(steady_clock::now() - start);
+
+  std::println("{} packages, {} versions each: {} resolved, {} failed, "
+               "{:.3f}ms per resolve",
+               packages,
+               versions,
+               resolved,
+               failed,
+               elapsed.count() / iterations);
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# times no-op builds of a fresh project, with the config snapshots
+# in .hcache/config kept, and with them removed before every run
+#
+#   bench/startup.sh <hewg binary> [runs]
+
+set -e
+
+if [ -z "$1" ]; then
+  echo "usage: $0 <hewg binary> [runs]" >&2
+  exit 1
+fi
+
+hewg=$(realpath "$1")
+runs=${2:-50}
+project=$(mktemp -d)
+trap 'rm -rf "$project"' EXIT
+
+cd "$project"
+"$hewg" init executable startup_bench > /dev/null
+"$hewg" build > /dev/null
+
+# average wall time of a no-op build in microseconds,
+# running $1 before each one
+time_builds() {
+  total=0
+  i=0
+  while [ "$i" -lt "$runs" ]; do
+    eval "$1"
+    start=$(date +%s%N)
+    "$hewg" build > /dev/null
+    end=$(date +%s%N)
+    total=$((total + (end - start) / 1000))
+    i=$((i + 1))
+  done
+  echo $((total / runs))
+}
+
+warm=$(time_builds :)
+cold=$(time_builds 'rm -rf .hcache/config')
+
+echo "no-op build, $runs runs"
+echo "  with snapshots:    ${warm}us"
+echo "  without snapshots: ${cold}us"
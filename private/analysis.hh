@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "confs.hh"
+#include "pgo.hh"
 
 enum class FileType
 {
@@ -34,6 +35,8 @@ get_cxx_source_filepaths(ConfigurationFile const&);
 std::vector<std::filesystem::path>
 get_c_source_filepaths(ConfigurationFile const&);
 
+std::string
+static_library_name(std::string_view project_name, bool const PIE);
 std::string
 static_library_name_for_project(ConfigurationFile const& config,
                                 bool const PIE);
@@ -43,8 +46,20 @@ dynamic_library_name_for_project(ConfigurationFile const& config);
 std::filesystem::path
 get_target_folder_for_build_profile(std::string_view const profile);
 
+// where get_cache_folder() puts a build, without creating it
+std::filesystem::path
+cache_folder_path(std::string_view build_profile,
+                  bool release,
+                  bool pic,
+                  std::optional<PGOMode> pgo = std::nullopt);
+
+// pgo builds get a folder of their own,
+// so they never mix objects with regular builds
 std::filesystem::path
-get_cache_folder(std::string_view build_profile, bool release, bool pic);
+get_cache_folder(std::string_view build_profile,
+                 bool release,
+                 bool pic,
+                 std::optional<PGOMode> pgo = std::nullopt);
 
 // converts a source-path source file
 // to it's cache-path object file
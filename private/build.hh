@@ -9,3 +9,11 @@ build(ThreadPool& threads,
       ConfigurationFile const& config,
       BuildOptions const& options,
       std::string_view build_profile);
+
+// for callers which already have the tool file loaded
+void
+build(ThreadPool& threads,
+      ConfigurationFile const& config,
+      ToolFile const& tools,
+      BuildOptions const& options,
+      std::string_view build_profile);
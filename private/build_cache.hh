@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+  persistent information about what the outputs
+  of a cache folder looked like on the last build
+*/
+
+#include <filesystem>
+#include <jayson.hh>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ObjectDigest
+{
+  std::string object;
+  std::string digest;
+
+  bool operator==(ObjectDigest const&) const = default;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"object", &ObjectDigest::object>,
+               jayson::obj_field<"digest", &ObjectDigest::digest>>;
+};
+
+// what a link/archive step looked like
+// the last time it successfully ran
+struct LinkRecord
+{
+  std::string output;
+
+  // digest of the tool & every argument
+  std::string command;
+
+  // digest of every input objects digest
+  std::string inputs;
+
+  // last write time of the output right after the step ran,
+  // so outputs that get touched or replaced are noticed
+  std::string output_time;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"output", &LinkRecord::output>,
+               jayson::obj_field<"command", &LinkRecord::command>,
+               jayson::obj_field<"inputs", &LinkRecord::inputs>,
+               jayson::obj_field<"output_time", &LinkRecord::output_time>>;
+};
+
+// the members of a full archive, and their
+// digests the last time it was written
+struct ArchiveRecord
+{
+  std::string output;
+  std::vector<ObjectDigest> members;
+  std::string output_time;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"output", &ArchiveRecord::output>,
+               jayson::obj_field<"members", &ArchiveRecord::members>,
+               jayson::obj_field<"output_time", &ArchiveRecord::output_time>>;
+};
+
+// the flags a language's objects were last compiled with
+struct FlagsRecord
+{
+  std::string language;
+  std::string digest;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"language", &FlagsRecord::language>,
+               jayson::obj_field<"digest", &FlagsRecord::digest>>;
+};
+
+struct BuildCacheFile
+{
+  std::vector<ObjectDigest> objects;
+  std::vector<LinkRecord> links;
+  std::vector<FlagsRecord> flags;
+  std::vector<ArchiveRecord> archives;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"objects", &BuildCacheFile::objects>,
+               jayson::obj_field<"links", &BuildCacheFile::links>,
+               jayson::obj_field<"flags", &BuildCacheFile::flags>,
+               jayson::obj_field<"archives", &BuildCacheFile::archives>>;
+};
+
+class BuildCache
+{
+  std::filesystem::path m_folder;
+  std::filesystem::path m_path;
+  BuildCacheFile m_file;
+
+  // object path -> index into m_file.objects
+  std::unordered_map<std::string, std::size_t> m_objects;
+
+  mutable std::mutex m_mutex;
+
+  std::string digest_of_inputs(
+    std::span<std::filesystem::path const> inputs);
+
+  // returns true if the digest differs from the stored one
+  bool store_digest(std::string const& key, std::string const& digest);
+
+  LinkRecord* find_link(std::filesystem::path const& output);
+
+public:
+  BuildCache(const BuildCache&) = delete;
+  BuildCache& operator=(const BuildCache&) = delete;
+
+  explicit BuildCache(std::filesystem::path const& cache_folder);
+
+  std::filesystem::path const& cache_folder() const { return m_folder; }
+
+  // hashes a freshly compiled object file and compares it
+  // against the digest stored from the last build.
+  // returns true if the contents actually changed.
+  // safe to call from the compile threads
+  bool restat_object(std::filesystem::path const& object);
+
+  // hashes inputs hewg doesn't compile itself, like package archives,
+  // layout profiles and the outputs of earlier link steps. those can
+  // be rewritten in place between any two builds, so they're hashed
+  // again before every check instead of once
+  void restat_files(std::span<std::filesystem::path const> files);
+
+  // true if the output exists, hasn't been touched since
+  // it was last produced, and neither the command
+  // nor the contents of any input has changed since
+  bool link_up_to_date(std::filesystem::path const& output,
+                       std::span<std::string const> command,
+                       std::span<std::filesystem::path const> inputs);
+
+  // drops the record of output, call before the step
+  // producing it runs so a failed step is never up to date
+  void forget_link(std::filesystem::path const& output);
+
+  // call after the step producing output succeeded
+  void record_link(std::filesystem::path const& output,
+                   std::span<std::string const> command,
+                   std::span<std::filesystem::path const> inputs);
+
+  // true if the objects of a language were last compiled
+  // with different flags, or never compiled at all
+  bool flags_changed(std::string const& language,
+                     std::span<std::string const> flags) const;
+
+  void record_flags(std::string const& language,
+                    std::span<std::string const> flags);
+
+  // the members a full archive was last written with,
+  // nullopt if it was never written or was touched since
+  std::optional<std::vector<ObjectDigest>> archive_members(
+    std::filesystem::path const& output);
+
+  // call after writing a full archive
+  void record_archive(std::filesystem::path const& output,
+                      std::vector<ObjectDigest> members);
+
+  // write this once the link steps are done,
+  // so their records are persisted too
+  void write() const;
+};
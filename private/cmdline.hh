@@ -7,20 +7,32 @@
 struct CleanOptions : terse::TerminalSubcommand
 {
   constexpr static auto name = "clean";
-  constexpr static auto usage = "";
+  constexpr static auto usage = "<profile>";
 
   constexpr static auto short_description =
-    "removes all build artifacts from the hewg cache";
+    "removes build artifacts from the hewg cache";
 
   constexpr static auto description =
-    "Removes any and all build artifacts from the hewg cache, that is object "
-    "files and persistent information about the build system. Use this to "
-    "force a full recompile of a project.";
+    "Removes the build artifacts of a build profile from the hewg cache, or "
+    "any and all of them if no profile is given, that is object files and "
+    "persistent information about the build system. Use this to force a full "
+    "recompile of a project. Folders are moved aside and deleted in the "
+    "background, so this returns right away.";
 
   bool help = false;
+  bool release = false;
+  bool pic = false;
 
   using options = std::tuple<
-    terse::Option<"help", 'h', "prints this help", &CleanOptions::help>>;
+    terse::Option<"help", 'h', "prints this help", &CleanOptions::help>,
+    terse::Option<"release",
+                  std::nullopt,
+                  "cleans the profile's release build",
+                  &CleanOptions::release>,
+    terse::Option<"pic",
+                  std::nullopt,
+                  "cleans the profile's PIC build",
+                  &CleanOptions::pic>>;
 };
 
 struct InitOptions : terse::TerminalSubcommand
@@ -63,6 +75,119 @@ struct InstallOptions : terse::TerminalSubcommand
     terse::Option<"help", 'h', "prints this help", &InstallOptions::help>>;
 };
 
+struct UpdateOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "update";
+  constexpr static auto usage = "";
+  constexpr static auto short_description =
+    "resolves the projects dependencies again, rewriting hewg.lock";
+  constexpr static auto description =
+    "Resolves the internal dependencies of the current project from scratch, "
+    "picking the newest compatible version of each installed package, and "
+    "rewrites hewg.lock with them. Builds otherwise only resolve dependencies "
+    "when hewg.scl's dependencies change.";
+
+  bool help = false;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &UpdateOptions::help>>;
+};
+
+struct GcOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "gc";
+  constexpr static auto usage = "";
+  constexpr static auto short_description =
+    "deletes stored package files no installed version uses";
+  constexpr static auto description =
+    "Installed package files are stored once in ~/.hewg/store and linked into "
+    "every version directory using them. Deletes the stored files that no "
+    "installed version lists anymore, e.g. after removing a version "
+    "directory.";
+
+  bool help = false;
+  bool dry_run = false;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &GcOptions::help>,
+    terse::Option<"dry-run",
+                  'n',
+                  "only prints what would be deleted",
+                  &GcOptions::dry_run>>;
+};
+
+struct PackOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "pack";
+  constexpr static auto usage = "<package> <version>";
+  constexpr static auto short_description =
+    "packs an installed package version into a single file";
+  constexpr static auto description =
+    "Packs an installed package version into a single compressed file, for "
+    "moving it to another machine with hewg unpack. Writes "
+    "<package>-<version>.hpk in the current directory by default.";
+
+  bool help = false;
+  std::optional<std::string> output;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &PackOptions::help>,
+    terse::Option<"output",
+                  'o',
+                  "the file to write the pack to",
+                  &PackOptions::output>>;
+};
+
+struct UnpackOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "unpack";
+  constexpr static auto usage = "<pack> [member]...";
+  constexpr static auto short_description =
+    "installs a package version from a file made by hewg pack";
+  constexpr static auto description =
+    "Installs the package version in a file made by hewg pack. Files already "
+    "in the package store aren't decompressed again. With --output, extracts "
+    "the given members, or all of them, into a directory instead.";
+
+  bool help = false;
+  bool list = false;
+  std::optional<std::string> output;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &UnpackOptions::help>,
+    terse::Option<"list",
+                  'l',
+                  "lists the members of the pack",
+                  &UnpackOptions::list>,
+    terse::Option<"output",
+                  'o',
+                  "extracts into this directory instead of installing",
+                  &UnpackOptions::output>>;
+};
+
+struct ServePackagesOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "serve-packages";
+  constexpr static auto usage = "<directory>";
+  constexpr static auto short_description =
+    "serves a package directory as a package mirror";
+  constexpr static auto description =
+    "Serves a directory laid out like ~/.hewg/packages over HTTP on localhost, "
+    "the way hewg expects a package mirror to. Point HEWG_MIRROR at it to "
+    "have builds fetch the packages they're missing from it. Serves the "
+    "installed packages if no directory is given.";
+
+  bool help = false;
+  unsigned port = 8737;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &ServePackagesOptions::help>,
+    terse::Option<"port",
+                  'p',
+                  "the port to listen on",
+                  &ServePackagesOptions::port>>;
+};
+
 struct BuildOptions : terse::TerminalSubcommand
 {
   constexpr static auto name = "build";
@@ -76,6 +201,9 @@ struct BuildOptions : terse::TerminalSubcommand
   bool help = false;
   bool release = false;
   bool generate_compile_commands = false;
+  std::optional<std::string> pgo;
+  std::optional<std::string> layout_profile;
+  bool workspace = false;
 
   using options = std::tuple<
     terse::Option<"help", 'h', "prints this help", &BuildOptions::help>,
@@ -87,7 +215,75 @@ struct BuildOptions : terse::TerminalSubcommand
     terse::Option<"generate-compile-commands",
                   std::nullopt,
                   "generates a compile_commands.json for a given project, then exits",
-                  &BuildOptions::generate_compile_commands>>;
+                  &BuildOptions::generate_compile_commands>,
+    terse::Option<"pgo",
+                  std::nullopt,
+                  "profile guided optimization, <generate> builds an "
+                  "instrumented binary, <use> optimizes with what it recorded",
+                  &BuildOptions::pgo>,
+    terse::Option<"layout-profile",
+                  std::nullopt,
+                  "optimizes the executables code layout after linking. "
+                  "a perf .data or .fdata profile runs llvm-bolt, a .order or "
+                  ".txt symbol list relinks with lld, which wants "
+                  "-ffunction-sections in the compile flags",
+                  &BuildOptions::layout_profile>,
+    terse::Option<"workspace",
+                  'w',
+                  "builds every project listed in hewg-workspace.scl at "
+                  "once, each after the members it depends on",
+                  &BuildOptions::workspace>>;
+};
+
+struct WatchOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "watch";
+  constexpr static auto usage = "<profile>";
+  constexpr static auto short_description =
+    "rebuilds the current project whenever its files change";
+  constexpr static auto description =
+    "Builds the current project, then keeps watching its sources and every "
+    "header they include, recompiling only the affected files and relinking "
+    "on each change. Changes to hewg.scl require restarting the watch.";
+
+  bool help = false;
+  bool release = false;
+  unsigned debounce_ms = 50;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &WatchOptions::help>,
+    terse::Option<"release",
+                  std::nullopt,
+                  "changes the build type to release mode",
+                  &WatchOptions::release>,
+    terse::Option<"debounce",
+                  std::nullopt,
+                  "milliseconds to wait for changes to settle before building",
+                  &WatchOptions::debounce_ms>>;
+};
+
+struct ServerOptions : terse::TerminalSubcommand
+{
+  constexpr static auto name = "server";
+  constexpr static auto usage = "";
+  constexpr static auto short_description =
+    "keeps a build server running for the current project";
+  constexpr static auto description =
+    "Runs a build server for the current project in the foreground. While it "
+    "is running, hewg build hands builds off to it instead of loading the "
+    "project from scratch, falling back to building in-process when no server "
+    "is running. Builds given --force, --skip, --tasks, --config, --pgo, "
+    "--layout-profile or --generate-compile-commands are never handed off.";
+
+  bool help = false;
+  bool stop = false;
+
+  using options = std::tuple<
+    terse::Option<"help", 'h', "prints this help", &ServerOptions::help>,
+    terse::Option<"stop",
+                  std::nullopt,
+                  "stops the server running for the current project",
+                  &ServerOptions::stop>>;
 };
 
 struct ToplevelOptions : terse::NonterminalSubcommand
@@ -136,8 +332,17 @@ struct ToplevelOptions : terse::NonterminalSubcommand
                   "prints the version of hewg",
                   &ToplevelOptions::print_version>>;
 
-  using subcommands =
-    std::tuple<BuildOptions, CleanOptions, InitOptions, InstallOptions>;
+  using subcommands = std::tuple<BuildOptions,
+                                 CleanOptions,
+                                 InitOptions,
+                                 InstallOptions,
+                                 WatchOptions,
+                                 ServerOptions,
+                                 UpdateOptions,
+                                 ServePackagesOptions,
+                                 GcOptions,
+                                 PackOptions,
+                                 UnpackOptions>;
 };
 
 decltype(terse::execute<ToplevelOptions>({}, {}))
@@ -3,8 +3,11 @@
 #include <expected>
 #include <filesystem>
 #include <future>
+#include <memory>
 
+#include "build_cache.hh"
 #include "confs.hh"
+#include "pgo.hh"
 #include "thread_pool.hh"
 
 /*
@@ -23,22 +26,62 @@ std::pair<std::vector<std::filesystem::path>,
 compile_cxx(ThreadPool& pool,
             ConfigurationFile const& config,
             ToolFile const& tools,
+            BuildCache& build_cache,
             std::filesystem::path const& cache_folder,
             bool const release,
-            bool const PIC);
+            bool const PIC,
+            std::optional<PGOConf> const& pgo);
 
 std::pair<std::vector<std::filesystem::path>,
           std::vector<std::future<std::optional<std::string>>>>
 compile_c(ThreadPool& pool,
           ConfigurationFile const& config,
           ToolFile const& tools,
+          BuildCache& build_cache,
           std::filesystem::path const& cache_folder,
           bool const release,
-          bool const PIC);
+          bool const PIC,
+          std::optional<PGOConf> const& pgo);
+
+// where split dwarf puts the debug info of an object
+std::filesystem::path
+dwo_file_for_object(std::filesystem::path object);
+
+// every c & cxx source that needs recompiling, the same
+// way compile_cxx() and compile_c() decide it for a build without pgo
+std::vector<std::filesystem::path>
+sources_to_rebuild(ConfigurationFile const& config,
+                   ToolFile const& tools,
+                   BuildCache& build_cache,
+                   std::filesystem::path const& cache_folder,
+                   bool const release,
+                   bool const PIC);
+
+// starts compiling just one source file, without
+// checking if it needs to be rebuilt first.
+// cancelling the handle kills the compiler early,
+// the future then holds the failed filename
+std::future<std::optional<std::string>>
+start_single_compile(ThreadPool& pool,
+                     ConfigurationFile const& config,
+                     ToolFile const& tools,
+                     BuildCache& build_cache,
+                     std::filesystem::path const& cache_folder,
+                     std::filesystem::path const& source,
+                     bool const release,
+                     bool const PIC,
+                     std::shared_ptr<CommandHandle> handle);
 
 // builds the special hewg symbols object file
-// and returns a path to it
+// and returns a path to it. the object is only
+// recompiled when its generated source changes
 std::filesystem::path
 compile_hewgsym(ConfigurationFile const& config,
                 ToolFile const& tools,
-                bool PIC);
+                bool PIC,
+                bool release);
+
+// extra link arguments for the hewgsym object,
+// which carry the build date when it's injected at link time
+std::vector<std::string>
+hewgsym_link_flags(ConfigurationFile const& config, bool release);
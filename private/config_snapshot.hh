@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+  every run would otherwise parse hewg.scl, overlay the build
+  profile's tables and parse the tool file. what that resolves
+  to is kept in .hcache/config as a flat binary snapshot, along
+  with the digest of the file it came from, so later runs only
+  read & digest the file and skip parsing it
+
+  a snapshot is only ever taken of a config that passed its
+  checks, and only trusted by the hewg version that took it
+*/
+
+#include <optional>
+#include <string_view>
+
+#include "confs.hh"
+
+// nullopt if there's no snapshot of the profile
+// taken of a hewg.scl with this digest
+std::optional<ConfigurationFile>
+read_config_snapshot(std::string_view build_profile,
+                     std::string_view source_digest);
+
+void
+write_config_snapshot(std::string_view build_profile,
+                      std::string_view source_digest,
+                      ConfigurationFile const& config);
+
+// the same for tool files, by the name of their tool profile
+std::optional<ToolFile>
+read_tool_snapshot(std::string_view tool_profile,
+                   std::string_view source_digest);
+
+void
+write_tool_snapshot(std::string_view tool_profile,
+                    std::string_view source_digest,
+                    ToolFile const& tools);
@@ -25,7 +25,11 @@ operator<(version_triplet const l, version_triplet const r)
   auto const [lx, ly, lz] = l;
   auto const [rx, ry, rz] = r;
 
-  return lx < rx and ly < ry and lz < rz;
+  if (lx != rx)
+    return lx < rx;
+  if (ly != ry)
+    return ly < ry;
+  return lz < rz;
 }
 
 std::string inline version_triplet_to_string(version_triplet const t)
@@ -61,6 +65,11 @@ struct Dependency
   using scl_fields = std::tuple<scl::field<&Dependency::name, "name">,
                                 scl::field<&Dependency::version, "version">,
                                 scl::field<&Dependency::exact, "exact", false>>;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"name", &Dependency::name>,
+               jayson::obj_field<"version", &Dependency::version>,
+               jayson::obj_field<"exact", &Dependency::exact>>;
 };
 
 struct MetaConf
@@ -70,10 +79,20 @@ struct MetaConf
 
   std::optional<std::string> profile_override;
 
+  // passes the build date to the linker instead of compiling it
+  // into the hewgsym object, so the object never has to be rebuilt
+  bool build_date_at_link = false;
+
+  // static libraries compile only the PIC variant,
+  // and both archives are packed from those objects
+  bool pic_only = false;
+
   using scl_fields = std::tuple<
     scl::field<&MetaConf::version, "version">,
     scl::enum_field<&MetaConf::type, "type", ProjectTypeEnumDescriptor>,
-    scl::field<&MetaConf::profile_override, "profile_override", false>>;
+    scl::field<&MetaConf::profile_override, "profile_override", false>,
+    scl::field<&MetaConf::build_date_at_link, "build_date_at_link", false>,
+    scl::field<&MetaConf::pic_only, "pic_only", false>>;
 };
 
 struct ProjectConf
@@ -136,6 +155,36 @@ struct HooksConf
                scl::field<&HooksConf::always, "always", false>>;
 };
 
+// settings for one build type, debug or release.
+// read from [debug.default] / [release.default], then
+// overridden by the tables of the build profile, e.g. [debug.linux]
+struct BuildTypeConf
+{
+  std::optional<int> opt_level;
+  std::optional<bool> lto;
+
+  // "thin" or "fat", defaults to thin.
+  // static libraries' objects are always fat
+  std::optional<std::string> lto_mode;
+
+  std::optional<bool> strip;
+
+  // keeps debug info out of the objects & the link,
+  // in .dwo files next to each object
+  std::optional<bool> split_dwarf;
+
+  // packages the .dwo files into a .dwp after linking
+  std::optional<bool> dwp;
+
+  using scl_fields = std::tuple<
+    scl::field<&BuildTypeConf::opt_level, "opt_level", false>,
+    scl::field<&BuildTypeConf::lto, "lto", false>,
+    scl::field<&BuildTypeConf::lto_mode, "lto_mode", false>,
+    scl::field<&BuildTypeConf::strip, "strip", false>,
+    scl::field<&BuildTypeConf::split_dwarf, "split_dwarf", false>,
+    scl::field<&BuildTypeConf::dwp, "dwp", false>>;
+};
+
 struct ToolProfile
 {
   std::string tool_profile_name;
@@ -164,6 +213,10 @@ struct ConfigurationFile
   HooksConf prebuild_hooks;
   HooksConf postbuild_hooks;
 
+  // modified with build profile
+  BuildTypeConf debug;
+  BuildTypeConf release;
+
   using scl_recurse = std::tuple<
     scl::field<&ConfigurationFile::meta, "hewg">,
     scl::field<&ConfigurationFile::project, "project">,
@@ -183,17 +236,65 @@ struct ToolFile
   std::string cc;
   std::string ld;
   std::string ar;
+  std::optional<std::string> dwp;
+  std::optional<std::string> profdata;
+  std::optional<std::string> bolt;
+
+  using scl_fields =
+    std::tuple<scl::field<&ToolFile::cxx, "cxx">,
+               scl::field<&ToolFile::cc, "cc">,
+               scl::field<&ToolFile::ld, "ld">,
+               scl::field<&ToolFile::ar, "ar">,
+               scl::field<&ToolFile::dwp, "dwp", false>,
+               scl::field<&ToolFile::profdata, "profdata", false>,
+               scl::field<&ToolFile::bolt, "bolt", false>>;
+};
+
+// hewg-workspace.scl, the projects hewg build --workspace builds together
+struct WorkspaceConf
+{
+  // project directories, relative to the workspace file
+  std::vector<std::string> members;
 
-  using scl_fields = std::tuple<scl::field<&ToolFile::cxx, "cxx">,
-                                scl::field<&ToolFile::cc, "cc">,
-                                scl::field<&ToolFile::ld, "ld">,
-                                scl::field<&ToolFile::ar, "ar">>;
+  // installs library members once they're built, so the members
+  // depending on them build against the workspace's version
+  bool install_libraries = false;
+
+  using scl_fields = std::tuple<
+    scl::field<&WorkspaceConf::members, "members">,
+    scl::field<&WorkspaceConf::install_libraries, "install_libraries", false>>;
 };
 
+inline BuildTypeConf const&
+get_build_type_conf(ConfigurationFile const& config, bool const release)
+{
+  return release ? config.release : config.debug;
+}
+
+// split dwarf only means anything with debug info,
+// which release builds don't have
+inline bool
+uses_split_dwarf(ConfigurationFile const& config, bool const release)
+{
+  return not release and config.debug.split_dwarf.value_or(false);
+}
+
+// abi flags get_config_file appends to the project's own, so a
+// package can be built from source the way a dependent needs it
+constexpr auto cxx_abi_flags_variable = "HEWG_ABI_CXXFLAGS";
+constexpr auto c_abi_flags_variable = "HEWG_ABI_CFLAGS";
+
 ConfigurationFile
 get_config_file(ToplevelOptions const&,
                 std::filesystem::path path,
                 std::string_view build_profile);
 
+// where the tool file a config asks for lives
+std::filesystem::path
+get_tool_file_path(ConfigurationFile const& confs);
+
 ToolFile
 get_tool_file(ConfigurationFile const& confs, std::string_view build_profile);
+
+WorkspaceConf
+get_workspace_file(std::filesystem::path path);
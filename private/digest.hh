@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+/*
+  sha256 content digests
+
+  used anywhere hewg needs to know if a file
+  *actually* changed, rather than just being touched
+*/
+
+class Digest
+{
+  std::array<std::uint32_t, 8> m_state;
+  std::array<unsigned char, 64> m_block;
+  std::size_t m_block_len = 0;
+  std::uint64_t m_total_len = 0;
+
+  void compress(unsigned char const* block);
+
+public:
+  Digest();
+
+  Digest& update(std::span<unsigned char const> data);
+  Digest& update(std::string_view data);
+
+  // returns the lowercase hex form of the digest,
+  // the digest must not be updated after calling this
+  std::string finish();
+};
+
+std::string
+digest_string(std::string_view what);
+
+// throws if the file can't be opened
+std::string
+digest_file(std::filesystem::path const& path);
@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+  packages that aren't installed get fetched from a mirror,
+  set with the HEWG_MIRROR environment variable:
+
+    HEWG_MIRROR=http://localhost:8737 hewg build
+
+  a mirror serves two things for every package it has:
+
+    /<name>/versions.json   every version, the digest of its
+                            archive & its internal dependencies
+    /<name>/<x.y.z>.tar     the version directory, see tar.hh
+
+  downloads are extracted into ~/.hewg/packages as they arrive,
+  in a hidden directory that's only renamed into place once the
+  archive's digest checks out. a dropped connection picks the
+  download back up where it left off
+*/
+
+#include <jayson.hh>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "confs.hh"
+#include "http.hh"
+#include "packages.hh"
+#include "resolve.hh"
+#include "thread_pool.hh"
+
+struct MirrorVersion
+{
+  version_triplet version;
+
+  // digest of the version's archive
+  std::string digest;
+
+  std::vector<Dependency> dependencies;
+
+  using jayson_fields = std::tuple<
+    jayson::obj_field<"version", &MirrorVersion::version>,
+    jayson::obj_field<"digest", &MirrorVersion::digest>,
+    jayson::obj_field<"dependencies", &MirrorVersion::dependencies>>;
+};
+
+// a packages versions.json
+struct MirrorListing
+{
+  std::string name;
+
+  // lowest to highest
+  std::vector<MirrorVersion> versions;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"name", &MirrorListing::name>,
+               jayson::obj_field<"versions", &MirrorListing::versions>>;
+};
+
+// HEWG_MIRROR, if it's set
+std::optional<std::string>
+package_mirror_url();
+
+// everything installed, plus everything on the mirror
+class PackageMirror : public PackageSource
+{
+  HttpUrl m_url;
+  InstalledPackages m_installed;
+
+  // only ever touched from the thread resolving
+  std::map<std::string, MirrorListing, std::less<>> m_listings;
+  std::map<std::string, std::vector<version_triplet>, std::less<>> m_versions;
+
+  MirrorListing const& listing(std::string_view name);
+
+  // runs on the pool
+  void fetch_one(std::string const& name,
+                 version_triplet version,
+                 std::string const& digest) const;
+
+public:
+  explicit PackageMirror(std::string_view url);
+
+  std::span<version_triplet const> versions(std::string_view name) override;
+
+  std::span<Dependency const> dependencies(std::string_view name,
+                                           version_triplet version) override;
+
+  // downloads every package that isn't installed yet, all at
+  // once on the pool. throws once they're done if any failed
+  void fetch(ThreadPool& threads,
+             std::span<std::pair<std::string, version_triplet> const> packages);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+/*
+  just enough plain http/1.1 to talk to a package mirror,
+  and for hewg serve-packages to be one.
+
+  one request per connection, bodies are always sized with
+  content-length, and the only range ever asked for is
+  "bytes=<start>-", for picking a download back up
+*/
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+struct HttpUrl
+{
+  std::string host;
+  std::string port;
+
+  // without a trailing slash, empty for the root
+  std::string path;
+};
+
+// throws if url isn't an http:// url
+HttpUrl
+parse_http_url(std::string_view url);
+
+struct HttpResponse
+{
+  int status;
+
+  // where in the resource the body starts, non-zero on a 206
+  std::uint64_t offset;
+
+  // total bytes of the body that were sent
+  std::uint64_t received;
+};
+
+// gets url.path + path, asking for everything from from onwards.
+// on_body is called with the body of a successful
+// response as it arrives, and the response so far.
+// throws if the connection fails or closes before
+// the whole body arrived, after passing on what did
+HttpResponse
+http_get(
+  HttpUrl const& url,
+  std::string_view path,
+  std::uint64_t from,
+  std::function<void(HttpResponse const&, std::string_view)> const& on_body);
+
+struct HttpRequest
+{
+  std::string method;
+  std::string path;
+  std::optional<std::uint64_t> range_start;
+};
+
+// nullopt if the client sent something that isn't a request
+std::optional<HttpRequest>
+read_http_request(int fd);
+
+// sends resource, or the range of it the request asked for
+void
+write_http_response(int fd,
+                    HttpRequest const& request,
+                    std::string_view content_type,
+                    std::string_view resource);
+
+void
+write_http_error(int fd, int status);
@@ -4,8 +4,10 @@
 
 #include "cmdline.hh"
 #include "confs.hh"
+#include "thread_pool.hh"
 
 void
-install(ConfigurationFile const& config,
+install(ThreadPool& threads,
+        ConfigurationFile const& config,
         InstallOptions const& options,
         std::string_view profile);
@@ -1,25 +1,92 @@
 #pragma once
 
+#include <filesystem>
+#include <optional>
+
+#include "build_cache.hh"
 #include "cmdline.hh"
 #include "confs.hh"
+#include "pgo.hh"
 
-void
+enum class LayoutMethod
+{
+  // llvm-bolt on the linked binary
+  Bolt,
+
+  // relinking with lld's --symbol-ordering-file
+  SymbolOrdering,
+};
+
+// optimizes the code layout of an executable with a profile
+struct LayoutConf
+{
+  LayoutMethod method;
+  std::filesystem::path profile;
+};
+
+// picks the method from the profile's extension,
+// nullopt if no layout profile was given
+std::optional<LayoutConf>
+get_layout_conf(BuildOptions const& options);
+
+// each of these skip their step if the output is already
+// up to date with its inputs, returning false if so.
+// jobs is how many lto backend jobs a link may run.
+// package_archives are linked in after the objects,
+// see get_package_archives()
+
+bool
 link_executable(ConfigurationFile const& config,
                 ToolFile const& tools,
                 BuildOptions const& options,
+                BuildCache& build_cache,
+                unsigned const jobs,
+                std::optional<PGOConf> const& pgo,
+                std::optional<LayoutConf> const& layout,
                 std::span<std::filesystem::path const> object_files,
+                std::span<std::filesystem::path const> package_archives,
                 std::filesystem::path output_directory);
 
-void
+// packs a thin archive, which only references the objects
+bool
 pack_static_library(ConfigurationFile const& config,
                     ToolFile const& tools,
+                    BuildCache& build_cache,
                     std::span<std::filesystem::path const> object_files,
                     std::filesystem::path output_directory,
                     bool const PIC);
 
+// writes a regular archive holding the members of a thin one,
+// only replacing the members which changed since it was last written.
+// returns false if nothing changed
+bool
+materialize_static_library(ToolFile const& tools,
+                           BuildCache& build_cache,
+                           std::filesystem::path const& thin_archive,
+                           std::filesystem::path const& output);
+
+// for pic_only static libraries, makes the non-PIC
+// archive the same file as the PIC one
 void
+link_static_library_variants(ConfigurationFile const& config,
+                             std::filesystem::path const& directory);
+
+bool
 shared_link(ConfigurationFile const& config,
             ToolFile const& tools,
             BuildOptions const& options,
+            BuildCache& build_cache,
+            unsigned const jobs,
+            std::optional<PGOConf> const& pgo,
             std::span<std::filesystem::path const> object_files,
             std::filesystem::path output_directory);
+
+// packages the .dwo files of a split dwarf build into
+// a .dwp next to the linked output, if the build type asks for it
+bool
+package_dwarf(ConfigurationFile const& config,
+              ToolFile const& tools,
+              BuildOptions const& options,
+              BuildCache& build_cache,
+              std::span<std::filesystem::path const> object_files,
+              std::filesystem::path output_directory);
@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+  hewg.lock pins the exact version of every package a
+  project depends on, so builds never resolve dependencies
+  themselves. it's only rewritten when the dependency
+  tables of hewg.scl change, or on hewg update
+*/
+
+#include <jayson.hh>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "confs.hh"
+#include "thread_pool.hh"
+
+struct LockedPackage
+{
+  std::string name;
+  version_triplet version;
+
+  // digest of everything installed for the version
+  std::string digest;
+
+  // names of the packages it depends on
+  std::vector<std::string> dependencies;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"name", &LockedPackage::name>,
+               jayson::obj_field<"version", &LockedPackage::version>,
+               jayson::obj_field<"digest", &LockedPackage::digest>,
+               jayson::obj_field<"dependencies", &LockedPackage::dependencies>>;
+};
+
+struct LockFile
+{
+  // digest of the [[internal]] tables the packages were resolved from
+  std::string requirements;
+
+  // dependencies come before their dependents
+  std::vector<LockedPackage> packages;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"requirements", &LockFile::requirements>,
+               jayson::obj_field<"packages", &LockFile::packages>>;
+};
+
+std::string
+digest_package(std::string_view name, version_triplet version);
+
+// the locked packages, dependencies first.
+// resolves & writes hewg.lock if it's missing or out of date
+std::vector<LockedPackage>
+get_locked_packages(ConfigurationFile const& config);
+
+// fetches every locked package that isn't installed from the
+// mirror, resolving against the mirror first if hewg.lock is out
+// of date. does nothing without a mirror, see fetch.hh
+void
+fetch_locked_packages(ThreadPool& threads, ConfigurationFile const& config);
+
+// resolves from scratch and rewrites hewg.lock,
+// printing every package that changed
+void
+update_lock_file(ThreadPool& threads, ConfigurationFile const& config);
@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+  a package version as a single file, for moving it between
+  machines without a mirror
+
+  the file starts with an index of every member, with its
+  digest and where its compressed bytes are, followed by one
+  zstd frame per distinct file. frames don't depend on each
+  other, so unpacking only decompresses the members it's asked
+  for, in parallel, straight into the store, and skips the ones
+  whose digest is already stored
+*/
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "cmdline.hh"
+#include "confs.hh"
+#include "thread_pool.hh"
+
+namespace pack_format {
+
+// written as is, so pack files only move
+// between machines of the same byte order
+struct Header
+{
+  char magic[8];
+  std::int32_t major;
+  std::int32_t minor;
+  std::int32_t patch;
+  std::uint32_t name;
+  std::uint32_t name_length;
+  std::uint32_t members;
+  std::uint32_t strings;
+  std::uint32_t reserved;
+};
+
+struct Member
+{
+  std::uint32_t path;
+  std::uint32_t path_length;
+  std::uint32_t executable;
+  std::uint32_t reserved;
+  char digest[64];
+  std::uint64_t size;
+
+  // from the start of the file, members with
+  // the same contents share a frame
+  std::uint64_t offset;
+  std::uint64_t compressed_size;
+};
+
+static_assert(sizeof(Header) == 40 and sizeof(Member) == 104);
+
+}
+
+// packs an installed version into output
+void
+pack_package(std::string_view name,
+             version_triplet version,
+             std::filesystem::path const& output);
+
+// installs the packed version, or with --output, extracts the
+// members into that directory instead. a member names a file,
+// or a directory to extract everything under
+void
+unpack_package(ThreadPool& threads,
+               UnpackOptions const& options,
+               std::filesystem::path const& archive,
+               std::span<std::string const> members);
@@ -0,0 +1,150 @@
+#pragma once
+
+/*
+  a single binary index of every installed package,
+  at ~/.hewg/packages/index.bin
+
+  it's mapped straight into memory, packages are sorted by
+  name and their versions from lowest to highest, so finding
+  a package or the best version for a request is a binary
+  search with nothing to parse
+
+  installs rewrite it into a temporary file and rename it
+  over the old one while holding index.lock, so readers
+  only ever see a whole index
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "confs.hh"
+
+struct IndexedVersion
+{
+  version_triplet version;
+  ProjectType type;
+  std::vector<Dependency> dependencies;
+};
+
+namespace index_format {
+
+struct Header
+{
+  char magic[8];
+  std::uint32_t packages;
+  std::uint32_t versions;
+  std::uint32_t dependencies;
+  std::uint32_t strings;
+};
+
+struct Package
+{
+  std::uint32_t name;
+  std::uint32_t name_length;
+  std::uint32_t first_version;
+  std::uint32_t version_count;
+};
+
+struct Version
+{
+  std::int32_t major;
+  std::int32_t minor;
+  std::int32_t patch;
+  std::uint32_t type;
+  std::uint32_t first_dependency;
+  std::uint32_t dependency_count;
+};
+
+struct Dependency
+{
+  std::uint32_t name;
+  std::uint32_t name_length;
+  std::int32_t major;
+  std::int32_t minor;
+  std::int32_t patch;
+  std::uint32_t exact;
+};
+
+}
+
+// name -> version -> what's installed for it
+using IndexEntries =
+  std::map<std::string, std::map<version_triplet, IndexedVersion>>;
+
+class PackageIndex
+{
+  void* m_mapping = nullptr;
+  std::size_t m_size = 0;
+
+  std::span<index_format::Package const> m_packages;
+  std::span<index_format::Version const> m_versions;
+  std::span<index_format::Dependency const> m_dependencies;
+  std::string_view m_strings;
+
+  // false if the file isn't a whole index
+  bool map(std::filesystem::path const& path);
+  void unmap();
+
+  std::string_view string_at(std::uint32_t offset, std::uint32_t length) const;
+
+  std::span<index_format::Version const> versions_of(
+    std::string_view name) const;
+
+  index_format::Version const* find(std::string_view name,
+                                    version_triplet version) const;
+
+  IndexedVersion decode(index_format::Version const& version) const;
+
+  // maps whatever index there is, even none
+  struct NoRebuild
+  {
+  };
+  explicit PackageIndex(NoRebuild);
+
+  IndexEntries entries() const;
+
+  friend void index_package_version(std::string_view, IndexedVersion);
+
+public:
+  PackageIndex(const PackageIndex&) = delete;
+  PackageIndex& operator=(const PackageIndex&) = delete;
+
+  // maps the index, building it from the package
+  // directories first if it's missing or unreadable
+  PackageIndex();
+  ~PackageIndex();
+
+  // lowest to highest, empty if the package isn't installed
+  std::vector<version_triplet> versions(std::string_view name) const;
+
+  bool contains(std::string_view name, version_triplet version) const;
+
+  // the highest installed version compatible with requested
+  std::optional<version_triplet> best_compatible(
+    std::string_view name,
+    version_triplet requested) const;
+
+  std::optional<IndexedVersion> get(std::string_view name,
+                                    version_triplet version) const;
+};
+
+// "1.2.3" -> { 1, 2, 3 }, nullopt for anything else
+std::optional<version_triplet>
+parse_version_directory(std::string_view name);
+
+// adds a version of a package to the index,
+// replacing what was there for the same version
+void
+index_package_version(std::string_view name, IndexedVersion version);
+
+// rebuilds the whole index from the info.scl
+// of every installed version of every package
+void
+rebuild_package_index();
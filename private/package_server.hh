@@ -0,0 +1,13 @@
+#pragma once
+
+#include <filesystem>
+
+#include "thread_pool.hh"
+
+// serves a directory laid out like ~/.hewg/packages
+// as a package mirror on localhost, see fetch.hh.
+// runs until the process is killed
+void
+serve_packages(ThreadPool& threads,
+               std::filesystem::path const& directory,
+               unsigned port);
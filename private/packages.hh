@@ -2,11 +2,17 @@
 
 #include <filesystem>
 #include <list>
+#include <map>
 #include <memory>
 #include <optional>
 #include <scl.hh>
+#include <span>
+#include <string>
+#include <vector>
 
 #include "confs.hh"
+#include "package_index.hh"
+#include "resolve.hh"
 
 struct PackageIdentifier
 {
@@ -24,7 +30,7 @@ struct PackageIdentifier
 
   bool operator==(PackageIdentifier const& rhs) const
   {
-    return name == rhs.name and version == version;
+    return name == rhs.name and version == rhs.version;
   }
 
   std::string name;
@@ -57,16 +63,6 @@ struct Package
   std::list<std::shared_ptr<Package>> internal_dependencies;
 };
 
-struct VersionManifest
-{
-  std::string name;
-  std::vector<std::tuple<int, int, int>> versions;
-
-  using jayson_fields =
-    std::tuple<jayson::obj_field<"name", &VersionManifest::name>,
-               jayson::obj_field<"versions", &VersionManifest::versions>>;
-};
-
 // attempts to open the directory
 // where the version of a specific
 // package lives
@@ -74,20 +70,45 @@ std::optional<std::filesystem::path>
 try_get_compatable_package(std::string_view name,
                            version_triplet requested_version);
 
+// the packages installed in hewg_packages_directory,
+// as the package index has them
+class InstalledPackages : public PackageSource
+{
+  PackageIndex m_index;
+
+  std::map<std::string, std::vector<version_triplet>, std::less<>> m_versions;
+  std::map<std::pair<std::string, version_triplet>, std::vector<Dependency>>
+    m_dependencies;
+
+public:
+  std::span<version_triplet const> versions(std::string_view name) override;
+
+  std::span<Dependency const> dependencies(std::string_view name,
+                                           version_triplet version) override;
+};
+
 // version is exact
 std::shared_ptr<Package>
 construct_dependency_graph(std::string_view package_name,
                            version_triplet version);
 
-PackageInfo
-get_package_info(std::string_view name, version_triplet requested_version);
+// the include directories of every package
+// the project depends on, directly or not
+std::vector<std::filesystem::path>
+get_package_include_directories(ConfigurationFile const& config);
 
-VersionManifest
-open_version_manifest(std::string_view package_name);
+// whether a name from outside, e.g. a mirror or a pack file,
+// can be a directory under ~/.hewg/packages and a request path.
+// empty names, hidden ones, slashes & control characters aren't
+bool
+is_safe_package_name(std::string_view name);
 
-void
-write_version_manifest(std::string_view package_name,
-                       VersionManifest const& manifest);
+// reads the info.scl of a version directory
+PackageInfo
+read_package_info(std::filesystem::path const& version_directory);
+
+PackageInfo
+get_package_info(std::string_view name, version_triplet requested_version);
 
 // returns the directory where the version
 // of the hewg project is stored
@@ -1,37 +1,149 @@
 #pragma once
 
 #include <filesystem>
+#include <string>
 
 #include "common.hh"
+#include "thread_pool.hh"
 
-auto static const hewg_config_path =
-  std::filesystem::current_path() / "hewg.scl";
+// where the project being worked on lives. the working directory,
+// looked up the first time a project path is used, unless this
+// thread is working on a member of a workspace
+inline std::filesystem::path const&
+project_root()
+{
+  if (current_project_root != nullptr)
+    return *current_project_root;
 
-auto const hewg_cache_path = std::filesystem::current_path() / ".hcache";
+  static auto const root = std::filesystem::current_path();
+  return root;
+}
 
-auto const hewg_hook_path = std::filesystem::current_path() / "hooks";
-auto const hewg_hook_cache_path = hewg_cache_path / "hooks.json";
+// how a path is given to commands, which run in the project root
+inline std::filesystem::path
+project_relative(std::filesystem::path const& path)
+{
+  return std::filesystem::relative(path, project_root());
+}
 
-// auto const hewg_builtinsym_cache_path = hewg_cache_path / "hewgsyms.json";
-auto const hewg_builtinsym_src_path = hewg_cache_path / "hewgsyms.c";
-auto const hewg_builtinsym_obj_path = hewg_cache_path / "hewgsyms.o";
-auto const hewg_builtinsym_obj_pic_path = hewg_cache_path / "hewgsyms-pic.o";
+// a path worked out when it's used rather than at startup, so
+// commands that never touch the project or ~/.hewg don't pay for
+// looking up either. converts to a std::filesystem::path anywhere
+// one is taken, get() where a path has to be spelled out
+class LazyPath
+{
+  std::filesystem::path (*m_compute)();
 
-auto const hewg_modification_date_cache_path =
-  hewg_cache_path / "modification_dates.json";
-auto const hewg_cxx_src_directory_path =
-  std::filesystem::current_path() / "src";
+public:
+  constexpr LazyPath(std::filesystem::path (*compute)())
+    : m_compute(compute)
+  {
+  }
 
-auto const hewg_c_src_directory_path = std::filesystem::current_path() / "csrc";
+  std::filesystem::path get() const { return m_compute(); }
+  operator std::filesystem::path() const { return get(); }
 
-auto const hewg_public_header_directory_path =
-  std::filesystem::current_path() / "include";
-auto const hewg_private_header_directory_path =
-  std::filesystem::current_path() / "private";
-auto const hewg_err_directory_path = std::filesystem::current_path() / "err";
-auto const hewg_target_directory_path =
-  std::filesystem::current_path() / "target";
+  std::string string() const { return get().string(); }
+  std::filesystem::path parent_path() const { return get().parent_path(); }
 
-auto const user_hewg_directory = get_home_directory() / ".hewg";
-auto const hewg_packages_directory = user_hewg_directory / "packages";
-auto const hewg_bin_directory = user_hewg_directory / "bin";
+  std::filesystem::path lexically_relative(
+    std::filesystem::path const& base) const
+  {
+    return get().lexically_relative(base);
+  }
+
+  friend std::filesystem::path operator/(LazyPath const& l,
+                                         std::filesystem::path const& r)
+  {
+    return l.get() / r;
+  }
+};
+
+constexpr LazyPath hewg_config_path{ [] {
+  return project_root() / "hewg.scl";
+} };
+
+constexpr LazyPath hewg_workspace_path{ [] {
+  return project_root() / "hewg-workspace.scl";
+} };
+
+constexpr LazyPath hewg_lock_path{ [] {
+  return project_root() / "hewg.lock";
+} };
+
+constexpr LazyPath hewg_cache_path{ [] { return project_root() / ".hcache"; } };
+
+constexpr LazyPath hewg_server_socket_path{ [] {
+  return hewg_cache_path / "server.sock";
+} };
+
+constexpr LazyPath hewg_trash_path{ [] { return hewg_cache_path / "trash"; } };
+
+constexpr LazyPath hewg_config_snapshot_path{ [] {
+  return hewg_cache_path / "config";
+} };
+
+constexpr LazyPath hewg_hook_path{ [] { return project_root() / "hooks"; } };
+constexpr LazyPath hewg_hook_cache_path{ [] {
+  return hewg_cache_path / "hooks.json";
+} };
+
+constexpr LazyPath hewg_builtinsym_cache_path{ [] {
+  return hewg_cache_path / "hewgsyms.json";
+} };
+constexpr LazyPath hewg_builtinsym_src_path{ [] {
+  return hewg_cache_path / "hewgsyms.c";
+} };
+constexpr LazyPath hewg_builtinsym_obj_path{ [] {
+  return hewg_cache_path / "hewgsyms.o";
+} };
+constexpr LazyPath hewg_builtinsym_obj_pic_path{ [] {
+  return hewg_cache_path / "hewgsyms-pic.o";
+} };
+
+constexpr LazyPath hewg_modification_date_cache_path{ [] {
+  return hewg_cache_path / "modification_dates.json";
+} };
+constexpr LazyPath hewg_cxx_src_directory_path{ [] {
+  return project_root() / "src";
+} };
+
+constexpr LazyPath hewg_c_src_directory_path{ [] {
+  return project_root() / "csrc";
+} };
+
+constexpr LazyPath hewg_public_header_directory_path{ [] {
+  return project_root() / "include";
+} };
+constexpr LazyPath hewg_private_header_directory_path{ [] {
+  return project_root() / "private";
+} };
+constexpr LazyPath hewg_err_directory_path{ [] {
+  return project_root() / "err";
+} };
+constexpr LazyPath hewg_target_directory_path{ [] {
+  return project_root() / "target";
+} };
+
+constexpr LazyPath user_hewg_directory{ [] {
+  return get_home_directory() / ".hewg";
+} };
+constexpr LazyPath hewg_packages_directory{ [] {
+  return user_hewg_directory / "packages";
+} };
+constexpr LazyPath hewg_bin_directory{ [] {
+  return user_hewg_directory / "bin";
+} };
+constexpr LazyPath hewg_package_index_path{ [] {
+  return hewg_packages_directory / "index.bin";
+} };
+constexpr LazyPath hewg_package_index_lock_path{ [] {
+  return hewg_packages_directory / "index.lock";
+} };
+
+constexpr LazyPath hewg_store_directory{ [] {
+  return user_hewg_directory / "store";
+} };
+constexpr LazyPath hewg_store_lock_path{ [] {
+  return hewg_store_directory / "lock";
+} };
@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+  profile guided optimization,
+  a --pgo=generate build produces an instrumented binary which
+  writes profile data when run, a --pgo=use build then reads it
+*/
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cmdline.hh"
+#include "confs.hh"
+
+enum class PGOMode
+{
+  Generate,
+  Use,
+};
+
+struct PGOConf
+{
+  PGOMode mode;
+
+  // shared by the generate & use builds of a profile,
+  // the instrumented binary writes its counters here
+  std::filesystem::path profile_folder;
+};
+
+std::string_view
+pgo_mode_to_string(PGOMode);
+
+// nullopt if the build doesn't use pgo at all
+std::optional<PGOConf>
+get_pgo_conf(BuildOptions const& options,
+             std::string_view build_profile,
+             bool pic);
+
+// makes sure a use build has profile data to use,
+// merging clang's raw profiles if they changed
+void
+prepare_pgo_profile(ToolFile const& tools, PGOConf const& pgo);
+
+// flags both the compiles and the link need
+std::vector<std::string>
+pgo_flags(std::string const& compiler,
+          PGOConf const& pgo,
+          std::filesystem::path const& cache_folder);
+
+// digest of all the profile data a use build reads
+std::string
+pgo_profile_digest(std::string const& compiler, PGOConf const& pgo);
@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+  installed static libraries carry the archives they were built
+  with, under prebuilt/<key digest>/, so linking against them
+  doesn't need to build anything.
+
+  a key is everything that has to match for an archive to be
+  linked in safely: the tool profile, the compiler it was built
+  with, release or not, PIC or not, and the few flags that
+  change the abi. a package with no matching archive is built
+  from its installed sources instead, once per project
+*/
+
+#include <filesystem>
+#include <jayson.hh>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "confs.hh"
+
+struct ArtifactKey
+{
+  std::string tool_profile;
+  std::string toolchain;
+  bool release = false;
+  bool pic = false;
+
+  // digest of the flags affects_abi() picks out
+  std::string abi_flags;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"tool_profile", &ArtifactKey::tool_profile>,
+               jayson::obj_field<"toolchain", &ArtifactKey::toolchain>,
+               jayson::obj_field<"release", &ArtifactKey::release>,
+               jayson::obj_field<"pic", &ArtifactKey::pic>,
+               jayson::obj_field<"abi_flags", &ArtifactKey::abi_flags>>;
+};
+
+struct BuiltArtifact
+{
+  // relative to the target folder
+  std::string filename;
+  ArtifactKey key;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"filename", &BuiltArtifact::filename>,
+               jayson::obj_field<"key", &BuiltArtifact::key>>;
+};
+
+struct BuiltArtifacts
+{
+  std::vector<BuiltArtifact> artifacts;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"artifacts", &BuiltArtifacts::artifacts>>;
+};
+
+ArtifactKey
+artifact_key(ConfigurationFile const& config,
+             ToolFile const& tools,
+             bool release,
+             bool pic);
+
+// names the prebuilt/ directory a key's archive is installed in
+std::string
+digest_artifact_key(ArtifactKey const& key);
+
+// records what the static library archives in
+// target_folder were built with, for installing them
+void
+write_built_artifacts(ConfigurationFile const& config,
+                      ToolFile const& tools,
+                      bool release,
+                      std::filesystem::path const& target_folder);
+
+// empty if the target folder was never built into
+std::vector<BuiltArtifact>
+read_built_artifacts(std::filesystem::path const& target_folder);
+
+// an archive for every locked static library package,
+// dependents before their dependencies as the linker wants them.
+// packages without a matching prebuilt archive are built from
+// source into .hcache/packages, with the abi flags of config
+std::vector<std::filesystem::path>
+get_package_archives(ConfigurationFile const& config,
+                     ToolFile const& tools,
+                     std::string_view build_profile,
+                     bool release,
+                     bool pic);
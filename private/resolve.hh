@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+  picks a single version for every package reachable
+  through internal dependencies, so a diamond of
+  dependencies always meets at the same version
+
+  it's a trimmed down pubgrub: versions are tried newest
+  first, and whenever a package runs out of versions the
+  packages that ruled them out are remembered as being
+  incompatible with each other. the search then jumps
+  straight back to the most recent of them, instead of
+  retrying everything decided in between
+*/
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "confs.hh"
+
+// where the resolver learns about packages from
+class PackageSource
+{
+public:
+  virtual ~PackageSource() = default;
+
+  // every version of a package, lowest to highest.
+  // empty if there's no such package
+  virtual std::span<version_triplet const> versions(std::string_view name) = 0;
+
+  virtual std::span<Dependency const> dependencies(
+    std::string_view name,
+    version_triplet version) = 0;
+};
+
+struct ResolvedPackage
+{
+  std::string name;
+  version_triplet version;
+
+  // names of the packages it depends on
+  std::vector<std::string> dependencies;
+};
+
+// true if version is something requirement accepts
+bool
+requirement_allows(Dependency const& requirement, version_triplet version);
+
+// dependencies always come before their dependents.
+// throws with an explanation if no set of versions
+// satisfies every requirement, or the packages depend
+// on each other in a cycle
+std::vector<ResolvedPackage>
+resolve_dependencies(PackageSource& source,
+                     std::span<Dependency const> requirements);
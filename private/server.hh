@@ -0,0 +1,26 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+#include "cmdline.hh"
+#include "thread_pool.hh"
+
+// runs in the foreground until a client sends a stop,
+// serving builds for the project in the current directory
+void
+serve(ThreadPool& threads,
+      ToplevelOptions const& tl_options,
+      std::filesystem::path const& config_path);
+
+// asks a running server to stop,
+// returns false if none was running
+bool
+stop_server();
+
+// hands a build off to a running server, streaming its output to stdout.
+// returns the builds exit code, or nullopt if no server is running
+std::optional<int>
+forward_build_to_server(BuildOptions const& options,
+                        std::string_view build_profile);
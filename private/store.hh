@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+  every installed file is kept once in ~/.hewg/store, named by
+  its digest, and version directories are made of hardlinks to
+  those blobs. where a hardlink can't reach, e.g. another
+  filesystem, a reflink is tried, then a copy in the kernel with
+  copy_file_range or sendfile.
+
+  blobs are read only, since every version sharing one would
+  see an edit. each version lists what it's made of in its
+  files.json, and hewg gc deletes the blobs none of them list
+
+  adding files holds store/lock shared, and gc holds it
+  exclusively, so gc never deletes a blob that an install
+  is about to link
+*/
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <jayson.hh>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct StoredFile
+{
+  // relative to the version directory
+  std::string path;
+  std::string digest;
+  bool executable = false;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"path", &StoredFile::path>,
+               jayson::obj_field<"digest", &StoredFile::digest>,
+               jayson::obj_field<"executable", &StoredFile::executable>>;
+};
+
+// a version directory's files.json
+struct StoreManifest
+{
+  std::vector<StoredFile> files;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"files", &StoreManifest::files>>;
+};
+
+struct StoreChanges
+{
+  // files that weren't linked to the right blob yet
+  std::size_t updated = 0;
+
+  // files an earlier files.json listed that weren't added again
+  std::size_t removed = 0;
+};
+
+// fills in a version directory from the store
+class StoreWriter
+{
+  int m_lock;
+  std::filesystem::path m_version_directory;
+
+  std::mutex m_mutex;
+  std::vector<StoredFile> m_files;
+  StoreChanges m_changes;
+
+  void add_file(std::filesystem::path const& source,
+                std::filesystem::path const& relative,
+                bool source_is_installed);
+
+  void link_blob(std::filesystem::path const& blob,
+                 std::filesystem::path const& relative,
+                 std::string const& digest,
+                 bool executable);
+
+public:
+  StoreWriter(const StoreWriter&) = delete;
+  StoreWriter& operator=(const StoreWriter&) = delete;
+
+  explicit StoreWriter(std::filesystem::path version_directory);
+  ~StoreWriter();
+
+  // copies source into the store unless the same contents are
+  // already there, and links the blob in at relative.
+  // safe to call from several threads at once
+  void add(std::filesystem::path const& source,
+           std::filesystem::path const& relative);
+
+  // links in the blob named digest at relative. if the store
+  // doesn't have it yet, write is called to write it to the path
+  // it's given first, which is then checked against digest.
+  // returns whether write was called
+  bool add_blob(
+    std::filesystem::path const& relative,
+    std::string const& digest,
+    bool executable,
+    std::function<void(std::filesystem::path const&)> const& write);
+
+  // moves whatever files are already in the version
+  // directory into the store, e.g. an extracted download
+  void add_existing_files();
+
+  // writes files.json, call once every file was added.
+  // files an earlier files.json listed that weren't
+  // added again are deleted
+  StoreChanges finish();
+};
+
+struct GarbageStats
+{
+  std::size_t blobs = 0;
+  std::uintmax_t bytes = 0;
+};
+
+// deletes every blob no files.json lists.
+// with dry_run, only counts them
+GarbageStats
+collect_store_garbage(bool dry_run);
@@ -0,0 +1,50 @@
+#pragma once
+
+/*
+  packages travel between machines as plain ustar archives
+  of their version directory, so any tar can open one.
+
+  only regular files are stored, in sorted order with
+  zeroed owners & times, so archiving the same files
+  always produces the same bytes and the same digest
+*/
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+// the whole archive of everything under directory
+std::string
+archive_directory(std::filesystem::path const& directory);
+
+// extracts an archive into a directory as it's fed to it,
+// without ever holding more than a block of it
+class TarExtractor
+{
+  std::filesystem::path m_directory;
+
+  // a header block being filled in
+  std::string m_header;
+
+  std::ofstream m_file;
+  std::uint64_t m_file_left = 0;
+
+  // padding after the file's data
+  std::uint64_t m_skip = 0;
+
+  bool m_finished = false;
+
+  void start_entry();
+
+public:
+  explicit TarExtractor(std::filesystem::path directory);
+
+  // throws on anything that isn't a regular file
+  // or directory, or a path leaving the directory
+  void feed(std::string_view data);
+
+  // true once the end of archive marker was read
+  bool finished() const { return m_finished; }
+};
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <condition_variable>
+#include <filesystem>
 #include <functional>
 #include <future>
 #include <latch>
 #include <mutex>
 #include <queue>
+#include <span>
+#include <sys/types.h>
 #include <thread>
 #include <vector>
 
@@ -15,6 +18,12 @@ using task_t = std::function<void()>;
 constexpr int MAIN_THREAD_ID = -1;
 thread_local inline int thread_id = MAIN_THREAD_ID;
 
+// the root of the project a thread is working on, when that isn't
+// the working directory. set for the members of a workspace, and
+// carried over to the pool threads running jobs queued for them
+thread_local inline std::filesystem::path const* current_project_root =
+  nullptr;
+
 class ThreadPool
 {
   struct TaskBase
@@ -23,6 +32,8 @@ class ThreadPool
     virtual ~TaskBase() = default;
 
     virtual void operator()() = 0;
+
+    std::filesystem::path const* project_root = current_project_root;
   };
 
   template<typename T>
@@ -39,6 +50,10 @@ class ThreadPool
     std::promise<decltype(std::declval<T>()())> m_promise;
   };
 
+  // the threads are only started by the first job, commands
+  // that never run anything in parallel never spawn them
+  int m_num_threads;
+  std::once_flag m_started;
   std::vector<std::thread> m_threads;
 
   std::condition_variable m_queueCondition;
@@ -47,6 +62,7 @@ class ThreadPool
   bool m_closing = false;
 
   void internal_add_job(TaskBase* base);
+  void start();
 
 public:
   ThreadPool(const ThreadPool&) = delete;
@@ -57,13 +73,18 @@ public:
   ThreadPool(int const num_threads);
   ~ThreadPool();
 
-  // empties the task queue, without finishing
+  // empties the task queue of the current project's
+  // jobs, without finishing them
   void drain();
 
+  unsigned size() const { return m_num_threads; }
+
   // responsibility of lifetime
   // for task moves into ThreadPool
   auto add_job(auto fn)
   {
+    std::call_once(m_started, [this] { start(); });
+
     auto task = new Task(fn);
     auto future = task->m_promise.get_future();
 
@@ -77,9 +98,32 @@ public:
   }
 };
 
+// lets another thread kill a command
+// started with run_command() early
+class CommandHandle
+{
+  std::mutex m_mutex;
+  pid_t m_pid = 0;
+  bool m_cancelled = false;
+
+public:
+  // kills the command if it's running,
+  // or keeps it from starting if it hasn't yet
+  void cancel();
+  bool cancelled();
+
+  // used by run_command(),
+  // attach() returns false if cancelled already
+  bool attach(pid_t pid);
+  void detach();
+};
+
 // returns the exit code & stdout + stderr
+// a command killed through its handle returns an exit code of -1
 std::pair<int, std::string>
-run_command(std::string const command, std::span<std::string const> args);
+run_command(std::string const command,
+            std::span<std::string const> args,
+            CommandHandle* handle = nullptr);
 
 template<typename... Ts>
   requires(std::convertible_to<Ts, std::string_view> && ...)
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+  what kind of compiler a tool file points at,
+  for the flags that differ between gcc and clang
+*/
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "confs.hh"
+
+enum class CompilerFamily
+{
+  GCC,
+  Clang,
+};
+
+struct Toolchain
+{
+  CompilerFamily family;
+  int major_version;
+};
+
+// runs the compiler once per process to find out,
+// later calls with the same compiler are cached
+Toolchain
+detect_toolchain(std::string const& compiler);
+
+// a digest of what the compiler says it is and what it targets,
+// so artifacts built by another compiler are never mixed in.
+// cached per process like detect_toolchain()
+std::string
+toolchain_identity(std::string const& compiler);
+
+// flags both the compiles and the link need for
+// the build types lto setting, empty if lto is off
+std::vector<std::string>
+lto_flags(ConfigurationFile const& config,
+          std::string const& compiler,
+          bool release);
+
+// how many ltrans/thinlto backend jobs the link may run,
+// and where it may keep its incremental cache.
+// these never change the output, so aren't part of a link's record
+std::vector<std::string>
+lto_parallel_flags(ConfigurationFile const& config,
+                   ToolFile const& tools,
+                   bool release,
+                   unsigned jobs,
+                   std::filesystem::path const& cache_folder);
@@ -0,0 +1,19 @@
+#pragma once
+
+/*
+  deleting a big cache folder can take a while, so it's renamed
+  into .hcache/trash instead, which is instant, and a detached
+  process deletes it from there while hewg has long returned.
+  whatever an interrupted one left behind goes with the next
+*/
+
+#include <filesystem>
+
+// throws if what can't be moved aside
+void
+move_to_trash(std::filesystem::path const& what);
+
+// deletes everything in the trash from a child process,
+// with jobs threads unlinking at once. returns straight away
+void
+empty_trash_in_background(unsigned jobs);
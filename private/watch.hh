@@ -0,0 +1,13 @@
+#pragma once
+
+#include "cmdline.hh"
+#include "confs.hh"
+#include "thread_pool.hh"
+
+// never returns, unless something goes
+// fatally wrong with watching the filesystem
+void
+watch(ThreadPool& threads,
+      ConfigurationFile const& config,
+      WatchOptions const& options,
+      std::string_view build_profile);
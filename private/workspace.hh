@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+  builds every member of a workspace in one process, on one
+  thread pool. a member waits only on the members it lists in
+  its internal dependencies, everything else compiles & links
+  alongside each other, instead of project by project
+
+  each member is built from its own directory: the project root
+  follows the member onto every pool thread running its jobs
+*/
+
+#include <string_view>
+
+#include "cmdline.hh"
+#include "thread_pool.hh"
+
+// builds the workspace in hewg-workspace.scl,
+// throws once every member that could be built was
+void
+build_workspace(ThreadPool& threads,
+                ToplevelOptions const& tl_options,
+                BuildOptions const& options,
+                std::string_view build_profile);
@@ -3,6 +3,8 @@
 #include <filesystem>
 #include <format>
 #include <jayson.hh>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <sys/stat.h>
@@ -116,10 +118,16 @@ get_c_source_filepaths(ConfigurationFile const& conf)
   return paths;
 }
 
+std::string
+static_library_name(std::string_view project_name, bool const PIE)
+{
+  return std::format("lib{}{}.a", project_name, PIE ? "-PIE" : "");
+}
+
 std::string
 static_library_name_for_project(ConfigurationFile const& config, bool const PIE)
 {
-  return std::format("lib{}{}.a", config.project.name, PIE ? "-PIE" : "");
+  return static_library_name(config.project.name, PIE);
 }
 
 std::string
@@ -135,12 +143,27 @@ get_target_folder_for_build_profile(std::string_view const profile)
 }
 
 std::filesystem::path
-get_cache_folder(std::string_view build_profile, bool release, bool pic)
+cache_folder_path(std::string_view build_profile,
+                  bool release,
+                  bool pic,
+                  std::optional<PGOMode> pgo)
 {
-  auto const inner = std::format(
+  auto inner = std::format(
     "{}{}{}", build_profile, pic ? "-pic" : "", release ? "-rel" : "");
 
-  auto const folder = hewg_cache_path / "incremental" / inner;
+  if (pgo)
+    inner += std::format("-pgo{}", pgo_mode_to_string(*pgo));
+
+  return hewg_cache_path / "incremental" / inner;
+}
+
+std::filesystem::path
+get_cache_folder(std::string_view build_profile,
+                 bool release,
+                 bool pic,
+                 std::optional<PGOMode> pgo)
+{
+  auto const folder = cache_folder_path(build_profile, release, pic, pgo);
 
   create_directory_checked(folder);
 
@@ -155,7 +178,7 @@ get_cache_folder(std::string_view build_profile, bool release, bool pic)
   create_directory_checked(folder / "cxx_depends");
   create_directory_checked(folder / "c_depends");
 
-  return hewg_cache_path / "incremental" / inner;
+  return folder;
 }
 
 std::filesystem::path
@@ -266,6 +289,31 @@ get_modification_date_of_file(std::filesystem::path const p)
     .count();
 }
 
+// a depfile only changes when its source recompiles,
+// so parses are kept for as long as the process lives.
+// only really matters for the build server
+static Depfile
+parse_depfile_cached(std::filesystem::path const& depfile_path)
+{
+  static std::mutex mutex;
+  static std::map<std::filesystem::path,
+                  std::pair<std::filesystem::file_time_type, Depfile>>
+    parsed_depfiles;
+
+  auto const write_time = std::filesystem::last_write_time(depfile_path);
+
+  std::scoped_lock lock(mutex);
+
+  auto const found = parsed_depfiles.find(depfile_path);
+  if (found != parsed_depfiles.end() and found->second.first == write_time)
+    return found->second.second;
+
+  auto parsed = parse_depfile(depfile_path);
+  parsed_depfiles.insert_or_assign(depfile_path, std::pair(write_time, parsed));
+
+  return parsed;
+}
+
 std::vector<Depfile> static get_dependencies_for_c(
   std::filesystem::path const cache_folder,
   std::span<std::filesystem::path const> source_files)
@@ -278,7 +326,7 @@ std::vector<Depfile> static get_dependencies_for_c(
     if (not std::filesystem::exists(depfile_path))
       continue;
 
-    files.push_back(parse_depfile(depfile_path));
+    files.push_back(parse_depfile_cached(depfile_path));
   }
 
   return files;
@@ -296,7 +344,7 @@ std::vector<Depfile> static get_dependencies_for_cxx(
     if (not std::filesystem::exists(depfile_path))
       continue;
 
-    files.push_back(parse_depfile(depfile_path));
+    files.push_back(parse_depfile_cached(depfile_path));
   }
 
   return files;
@@ -385,35 +433,25 @@ semantically_valid(version_triplet const request_for,
 }
 
 std::optional<version_triplet>
-select_best_compatable_semver(std::span<version_triplet const> list_,
+select_best_compatable_semver(std::span<version_triplet const> list,
                               version_triplet const requested)
 {
-  std::vector<version_triplet> list(list_.begin(), list_.end());
-
   auto const [rx, ry, rz] = requested;
 
-  // requested major version must be
-  // exactly equal to the provided minor version
-  std::erase_if(list, [=](version_triplet const in) {
-    auto const [x, _y, _z] = in;
-    return x != rx;
-  });
-
-  if (list.empty())
-    return std::nullopt;
+  std::optional<version_triplet> best;
 
-  // requested minor version must be less than or equal to
-  // the provided minor version
-  std::erase_if(list, [=](version_triplet const in) {
-    auto const [_x, y, _z] = in;
-    return y < ry;
-  });
+  for (auto const& version : list) {
+    auto const [x, y, _z] = version;
 
-  if (list.empty())
-    return std::nullopt;
+    // requested major version must be exactly equal
+    // to the provided major version, and the requested
+    // minor version must be less than or equal to it
+    if (x != rx or y < ry)
+      continue;
 
-  // select the highest patch version
-  std::sort(list.begin(), list.end());
+    if (not best or *best < version)
+      best = version;
+  }
 
-  return list.back();
+  return best;
 }
@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -9,6 +11,7 @@
 
 #include "analysis.hh"
 #include "build.hh"
+#include "build_cache.hh"
 #include "cmdline.hh"
 #include "common.hh"
 #include "compile.hh"
@@ -16,37 +19,12 @@
 #include "confs.hh"
 #include "hooks.hh"
 #include "link.hh"
+#include "lock.hh"
 #include "paths.hh"
+#include "pgo.hh"
+#include "prebuilt.hh"
 #include "thread_pool.hh"
 
-// TODO: for each package, find the exported packages in them
-// build a graph, check for version clashes, etc,
-// then also add them as includes
-// static std::vector<std::filesystem::path>
-// get_include_directories_for_packages(ConfigurationFile const& config)
-// {
-//   std::vector<std::filesystem::path> include_dirs;
-
-//   auto const& packages = config.libs.packages;
-
-//   for (auto const& [name, version] : packages) {
-//     auto const package = try_get_compatable_package(name, version);
-
-//     if (not package)
-//       throw std::runtime_error(
-//         std::format("unable to get compatable version <{}> for package <{}> "
-//                     "while searching for headers",
-//                     version_triplet_to_string(version),
-//                     name));
-
-//     auto const package_include_dir = (*package) / "include";
-
-//     include_dirs.push_back(package_include_dir);
-//   }
-
-//   return include_dirs;
-// }
-
 static std::vector<std::string>
 generate_compile_arguments(std::string const& compiler,
                            std::string const& standard,
@@ -101,32 +79,62 @@ generate_compile_commands(ConfigurationFile const& config,
   std::ofstream("compile_commands.json") << serialize_compile_commands(commands);
 }
 
-// helper function to build both
-// c/cxx and return the object files
-static std::vector<std::filesystem::path>
-build_c_cxx(ThreadPool& threads,
+struct PendingCompiles
+{
+  std::vector<std::filesystem::path> object_files;
+  std::vector<std::future<std::optional<std::string>>> futures;
+
+  // blocks until every compile is done, without taking the results
+  void wait() const
+  {
+    for (auto const& future : futures)
+      future.wait();
+  }
+};
+
+// queues up every c/cxx compile of one variant,
+// without waiting on any of them
+static PendingCompiles
+start_c_cxx(ThreadPool& threads,
             ConfigurationFile const& config,
             ToolFile const& tools,
+            BuildCache& build_cache,
             std::filesystem::path const& cache,
             bool release,
-            bool pic)
+            bool pic,
+            std::optional<PGOConf> const& pgo)
 {
+  if (pgo)
+    prepare_pgo_profile(tools, *pgo);
+
   auto [cxx_object_files, cxx_futures] =
-    compile_cxx(threads, config, tools, cache, release, pic);
+    compile_cxx(threads, config, tools, build_cache, cache, release, pic, pgo);
 
   auto [c_object_files, c_futures] =
-    compile_c(threads, config, tools, cache, release, pic);
+    compile_c(threads, config, tools, build_cache, cache, release, pic, pgo);
 
-  auto const obj_files = cxx_object_files + c_object_files;
-  auto futures = std::move(cxx_futures) + std::move(c_futures);
+  return PendingCompiles{ cxx_object_files + c_object_files,
+                          std::move(cxx_futures) + std::move(c_futures) };
+}
 
+// waits for the compiles, throwing if any failed
+static std::vector<std::filesystem::path>
+finish_c_cxx(BuildCache& build_cache, PendingCompiles pending)
+{
   std::vector<std::string> failed_compiles;
-
-  for (auto& future : futures) {
-    auto const val = future.get();
-
-    if (val)
-      failed_compiles.push_back(*val);
+  bool dropped = false;
+
+  for (auto& future : pending.futures) {
+    try {
+      auto const val = future.get();
+
+      if (val)
+        failed_compiles.push_back(*val);
+    } catch (std::future_error const&) {
+      // dropped from the queue after some other compile failed,
+      // possibly one belonging to another variant
+      dropped = true;
+    }
   }
 
   if (not failed_compiles.empty()) {
@@ -138,10 +146,35 @@ build_c_cxx(ThreadPool& threads,
     throw std::runtime_error("fatal errors when compiling cxx source files");
   }
 
-  return obj_files;
+  if (dropped)
+    throw std::runtime_error("compiling stopped early after an error");
+
+  // keep the object digests & flags even if the link fails
+  build_cache.write();
+
+  return std::move(pending.object_files);
 }
 
-static void
+// helper function to build both
+// c/cxx and return the object files
+static std::vector<std::filesystem::path>
+build_c_cxx(ThreadPool& threads,
+            ConfigurationFile const& config,
+            ToolFile const& tools,
+            BuildCache& build_cache,
+            std::filesystem::path const& cache,
+            bool release,
+            bool pic,
+            std::optional<PGOConf> const& pgo)
+{
+  return finish_c_cxx(
+    build_cache,
+    start_c_cxx(threads, config, tools, build_cache, cache, release, pic, pgo));
+}
+
+// returns false if the link was skipped,
+// because the executable was already up to date
+static bool
 build_executable(ThreadPool& threads,
                  ConfigurationFile const& config,
                  ToolFile const& tools,
@@ -149,40 +182,138 @@ build_executable(ThreadPool& threads,
                  std::string_view build_profile,
                  std::filesystem::path const& emit_dir)
 {
-  // auto const include_dirs = get_include_directories_for_packages(config);
-  auto const cache = get_cache_folder(build_profile, build_opts.release, false);
-  auto object_files =
-    build_c_cxx(threads, config, tools, cache, build_opts.release, false);
-
-  object_files.push_back(compile_hewgsym(config, tools, false));
-
-  link_executable(config, tools, build_opts, object_files, emit_dir);
-
-  if (build_opts.release)
-    run_command("strip", "-s", (emit_dir / config.project.name).string());
+  auto const pgo = get_pgo_conf(build_opts, build_profile, false);
+  auto const cache = get_cache_folder(
+    build_profile,
+    build_opts.release,
+    false,
+    pgo.transform([](auto const& conf) { return conf.mode; }));
+  BuildCache build_cache(cache);
+
+  auto const object_files = build_c_cxx(threads,
+                                        config,
+                                        tools,
+                                        build_cache,
+                                        cache,
+                                        build_opts.release,
+                                        false,
+                                        pgo);
+
+  auto const package_archives = get_package_archives(
+    config, tools, build_profile, build_opts.release, false);
+
+  bool linked = link_executable(config,
+                                tools,
+                                build_opts,
+                                build_cache,
+                                threads.size(),
+                                pgo,
+                                get_layout_conf(build_opts),
+                                object_files,
+                                package_archives,
+                                emit_dir);
+
+  linked |= package_dwarf(
+    config, tools, build_opts, build_cache, object_files, emit_dir);
+
+  build_cache.write();
+  return linked;
 }
 
-[[maybe_unused]] static void
-build_static_library(ThreadPool& threads [[maybe_unused]],
-                     ConfigurationFile const& config [[maybe_unused]],
-                     BuildOptions const& build_opts [[maybe_unused]],
-                     std::filesystem::path const& emit_dir [[maybe_unused]])
+// both variants are compiled in the same pass over the pool,
+// each archive is packed as soon as its own objects are done
+static bool
+build_static_library(ThreadPool& threads,
+                     ConfigurationFile const& config,
+                     ToolFile const& tools,
+                     BuildOptions const& build_opts,
+                     std::string_view build_profile,
+                     std::filesystem::path const& emit_dir)
 {
-  // auto const include_dirs = get_include_directories_for_packages(config);
-
-  // threadsafe_print("building non-PIC library code...");
-  // auto const object_files =
-  //   compile_c_cxx(threads, config, {}, build_opts.release, false);
+  struct Variant
+  {
+    bool pic;
+    std::filesystem::path cache = {};
+    std::unique_ptr<BuildCache> build_cache = nullptr;
+    std::optional<PendingCompiles> pending = std::nullopt;
+  };
+
+  // the PIC objects are the same ones a shared library build uses
+  std::vector<Variant> variants;
+  if (not config.meta.pic_only)
+    variants.push_back(Variant{ .pic = false });
+  variants.push_back(Variant{ .pic = true });
+
+  auto const start_variant = [&](Variant& variant) {
+    auto const pgo = get_pgo_conf(build_opts, build_profile, variant.pic);
+
+    variant.cache = get_cache_folder(
+      build_profile,
+      build_opts.release,
+      variant.pic,
+      pgo.transform([](auto const& conf) { return conf.mode; }));
+    variant.build_cache = std::make_unique<BuildCache>(variant.cache);
+
+    variant.pending = start_c_cxx(threads,
+                                  config,
+                                  tools,
+                                  *variant.build_cache,
+                                  variant.cache,
+                                  build_opts.release,
+                                  variant.pic,
+                                  pgo);
+  };
+
+  auto const pack_variant = [&](Variant& variant, bool& packed) {
+    variant.pending->wait();
+
+    auto const object_files =
+      finish_c_cxx(*variant.build_cache, *std::move(variant.pending));
+    variant.pending.reset();
+
+    packed |= pack_static_library(config,
+                                  tools,
+                                  *variant.build_cache,
+                                  object_files,
+                                  emit_dir,
+                                  variant.pic);
+
+    if (config.meta.pic_only)
+      link_static_library_variants(config, emit_dir);
+
+    variant.build_cache->write();
+  };
+
+  bool packed = false;
+
+  try {
+    for (auto& variant : variants)
+      start_variant(variant);
+
+    // the first variant's jobs were queued first, so it's done
+    // first. it's packed while the pool works on the next one
+    for (auto& variant : variants)
+      pack_variant(variant, packed);
+  } catch (...) {
+    // compiles still running reference the build caches,
+    // they have to be done before those go away
+    for (auto& variant : variants)
+      if (variant.pending)
+        for (auto& future : variant.pending->futures)
+          if (future.valid())
+            future.wait();
+
+    throw;
+  }
 
-  // threadsafe_print("building PIC library code...");
-  // auto const object_files_pic =
-  //   compile_c_cxx(threads, config, {}, build_opts.release, true);
+  // what hewg install needs to know to pick these
+  // archives for projects built the same way
+  write_built_artifacts(config, tools, build_opts.release, emit_dir);
 
-  // pack_static_library(config, object_files, emit_dir, false);
-  // pack_static_library(config, object_files, emit_dir, true);
+  return packed;
 }
 
-static void
+static bool
 build_shared_library(ThreadPool& threads,
                      ConfigurationFile const& config,
                      ToolFile const& tools,
@@ -190,12 +321,37 @@ build_shared_library(ThreadPool& threads,
                      std::string_view build_profile,
                      std::filesystem::path const& emit_dir)
 {
-  auto const cache = get_cache_folder(build_profile, build_opts.release, true);
-
-  auto object_files =
-    build_c_cxx(threads, config, tools, cache, build_opts.release, true);
-  object_files.push_back(compile_hewgsym(config, tools, true));
-  shared_link(config, tools, build_opts, object_files, emit_dir);
+  auto const pgo = get_pgo_conf(build_opts, build_profile, true);
+  auto const cache = get_cache_folder(
+    build_profile,
+    build_opts.release,
+    true,
+    pgo.transform([](auto const& conf) { return conf.mode; }));
+  BuildCache build_cache(cache);
+
+  auto const object_files = build_c_cxx(threads,
+                                        config,
+                                        tools,
+                                        build_cache,
+                                        cache,
+                                        build_opts.release,
+                                        true,
+                                        pgo);
+
+  bool linked = shared_link(config,
+                            tools,
+                            build_opts,
+                            build_cache,
+                            threads.size(),
+                            pgo,
+                            object_files,
+                            emit_dir);
+
+  linked |= package_dwarf(
+    config, tools, build_opts, build_cache, object_files, emit_dir);
+
+  build_cache.write();
+  return linked;
 }
 
 void
@@ -205,6 +361,18 @@ build(ThreadPool& threads,
       std::string_view build_profile)
 {
   ToolFile const tools = get_tool_file(config, build_profile);
+  build(threads, config, tools, build_opts, build_profile);
+}
+
+void
+build(ThreadPool& threads,
+      ConfigurationFile const& config,
+      ToolFile const& tools,
+      BuildOptions const& build_opts,
+      std::string_view build_profile)
+{
+  // dependencies have to be there before anything includes them
+  fetch_locked_packages(threads, config);
 
   if (build_opts.generate_compile_commands) {
     // just create the compile_commands.json and exit
@@ -213,6 +381,11 @@ build(ThreadPool& threads,
     generate_compile_commands(config, tools);
     return;
   }
+  if (build_opts.layout_profile and
+      config.meta.type != ProjectType::Executable)
+    throw std::runtime_error(
+      "layout optimization is only supported for executables");
+
   // get the dependency graph
   trigger_prebuild_hooks(config);
 
@@ -223,20 +396,23 @@ build(ThreadPool& threads,
 
   auto const emit_dir = hewg_target_directory_path / build_profile;
 
+  // post-build hooks only run if an artifact was actually produced
+  bool produced_artifact = false;
+
   switch (config.meta.type) {
     case ProjectType::Executable:
-      build_executable(
+      produced_artifact = build_executable(
         threads, config, tools, build_opts, build_profile, emit_dir);
       break;
 
     case ProjectType::StaticLibrary:
-      threadsafe_print("static library building not yet supported");
-      // build_static_library(threads, config, tools, build_opts, emit_dir);
+      produced_artifact = build_static_library(
+        threads, config, tools, build_opts, build_profile, emit_dir);
       break;
 
     case ProjectType::SharedLibrary: {
       threadsafe_print("shared library building not yet supported");
-      build_shared_library(
+      produced_artifact = build_shared_library(
         threads, config, tools, build_opts, build_profile, emit_dir);
     } break;
 
@@ -247,5 +423,6 @@ build(ThreadPool& threads,
       return;
   }
 
-  triggers_postbuild_hooks(config);
+  if (produced_artifact)
+    triggers_postbuild_hooks(config);
 }
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <jayson.hh>
+#include <mutex>
+#include <optional>
+#include <sstream>
+
+#include "build_cache.hh"
+#include "common.hh"
+#include "digest.hh"
+
+BuildCache::BuildCache(std::filesystem::path const& cache_folder)
+  : m_folder(cache_folder)
+  , m_path(cache_folder / "build_cache.json")
+{
+  if (not std::filesystem::exists(m_path))
+    return;
+
+  std::stringstream ss;
+  ss << std::ifstream(m_path).rdbuf();
+
+  // a cache from an older hewg just means a full rebuild
+  try {
+    jayson::val v = jayson::val::parse(std::move(ss).str());
+    jayson::deserialize(v, m_file);
+  } catch (std::exception const&) {
+    threadsafe_print_verbose(
+      std::format("ignoring unreadable build cache <{}>\n", m_path.string()));
+    m_file = {};
+    return;
+  }
+
+  for (std::size_t i = 0; i < m_file.objects.size(); i++)
+    m_objects.insert_or_assign(m_file.objects[i].object, i);
+}
+
+bool
+BuildCache::restat_object(std::filesystem::path const& object)
+{
+  // hash outside of the lock,
+  // this is the expensive part
+  auto const digest = digest_file(object);
+  auto const key = object.string();
+
+  if (store_digest(key, digest))
+    return true;
+
+  threadsafe_print_verbose(
+    std::format("object <{}> is unchanged after recompile\n", key));
+  return false;
+}
+
+void
+BuildCache::restat_files(std::span<std::filesystem::path const> files)
+{
+  for (auto const& file : files)
+    store_digest(file.string(), digest_file(file));
+}
+
+bool
+BuildCache::store_digest(std::string const& key, std::string const& digest)
+{
+  std::scoped_lock lock(m_mutex);
+
+  auto const found = m_objects.find(key);
+
+  if (found == m_objects.end()) {
+    m_objects.insert_or_assign(key, m_file.objects.size());
+    m_file.objects.push_back(ObjectDigest{ key, digest });
+    return true;
+  }
+
+  auto& stored = m_file.objects[found->second];
+
+  if (stored.digest == digest)
+    return false;
+
+  stored.digest = digest;
+  return true;
+}
+
+static std::string
+output_time_of(std::filesystem::path const& output)
+{
+  return std::to_string(
+    std::filesystem::last_write_time(output).time_since_epoch().count());
+}
+
+static std::string
+digest_of_command(std::span<std::string const> command)
+{
+  Digest digest;
+
+  // null separated, so { "ab", "c" } and { "a", "bc" } differ
+  for (auto const& arg : command)
+    digest.update(arg).update(std::string_view("\0", 1));
+
+  return digest.finish();
+}
+
+std::string
+BuildCache::digest_of_inputs(std::span<std::filesystem::path const> inputs)
+{
+  Digest digest;
+
+  for (auto const& input : inputs) {
+    auto const key = input.string();
+
+    auto const stored = [&]() -> std::optional<std::string> {
+      std::scoped_lock lock(m_mutex);
+      auto const found = m_objects.find(key);
+      if (found == m_objects.end())
+        return std::nullopt;
+      return m_file.objects[found->second].digest;
+    };
+
+    // objects that were never restat'd,
+    // e.g. ones from before the cache existed
+    // get hashed now
+    if (not stored())
+      restat_object(input);
+
+    auto const object_digest = *stored();
+
+    digest.update(key).update(std::string_view("\0", 1));
+    digest.update(object_digest).update(std::string_view("\0", 1));
+  }
+
+  return digest.finish();
+}
+
+LinkRecord*
+BuildCache::find_link(std::filesystem::path const& output)
+{
+  auto const found =
+    std::ranges::find(m_file.links, output.string(), &LinkRecord::output);
+
+  if (found == m_file.links.end())
+    return nullptr;
+
+  return &*found;
+}
+
+bool
+BuildCache::link_up_to_date(std::filesystem::path const& output,
+                            std::span<std::string const> command,
+                            std::span<std::filesystem::path const> inputs)
+{
+  if (not std::filesystem::exists(output))
+    return false;
+
+  auto const inputs_digest = digest_of_inputs(inputs);
+
+  std::scoped_lock lock(m_mutex);
+  auto const record = find_link(output);
+
+  if (record == nullptr)
+    return false;
+
+  if (record->output_time != output_time_of(output)) {
+    threadsafe_print_verbose(
+      std::format("<{}> was modified outside of hewg\n", output.string()));
+    return false;
+  }
+
+  return record->command == digest_of_command(command) and
+         record->inputs == inputs_digest;
+}
+
+void
+BuildCache::forget_link(std::filesystem::path const& output)
+{
+  std::scoped_lock lock(m_mutex);
+  std::erase_if(m_file.links, [&](auto const& record) {
+    return record.output == output.string();
+  });
+}
+
+void
+BuildCache::record_link(std::filesystem::path const& output,
+                        std::span<std::string const> command,
+                        std::span<std::filesystem::path const> inputs)
+{
+  LinkRecord updated{
+    output.string(),
+    digest_of_command(command),
+    digest_of_inputs(inputs),
+    output_time_of(output),
+  };
+
+  std::scoped_lock lock(m_mutex);
+
+  if (auto const record = find_link(output))
+    *record = std::move(updated);
+  else
+    m_file.links.push_back(std::move(updated));
+}
+
+std::optional<std::vector<ObjectDigest>>
+BuildCache::archive_members(std::filesystem::path const& output)
+{
+  if (not std::filesystem::exists(output))
+    return std::nullopt;
+
+  std::scoped_lock lock(m_mutex);
+
+  auto const found =
+    std::ranges::find(m_file.archives, output.string(), &ArchiveRecord::output);
+
+  if (found == m_file.archives.end() or
+      found->output_time != output_time_of(output))
+    return std::nullopt;
+
+  return found->members;
+}
+
+void
+BuildCache::record_archive(std::filesystem::path const& output,
+                           std::vector<ObjectDigest> members)
+{
+  ArchiveRecord updated{
+    output.string(),
+    std::move(members),
+    output_time_of(output),
+  };
+
+  std::scoped_lock lock(m_mutex);
+
+  auto const found =
+    std::ranges::find(m_file.archives, output.string(), &ArchiveRecord::output);
+
+  if (found != m_file.archives.end())
+    *found = std::move(updated);
+  else
+    m_file.archives.push_back(std::move(updated));
+}
+
+bool
+BuildCache::flags_changed(std::string const& language,
+                          std::span<std::string const> flags) const
+{
+  auto const digest = digest_of_command(flags);
+
+  std::scoped_lock lock(m_mutex);
+
+  auto const found =
+    std::ranges::find(m_file.flags, language, &FlagsRecord::language);
+
+  return found == m_file.flags.end() or found->digest != digest;
+}
+
+void
+BuildCache::record_flags(std::string const& language,
+                         std::span<std::string const> flags)
+{
+  auto digest = digest_of_command(flags);
+
+  std::scoped_lock lock(m_mutex);
+
+  auto const found =
+    std::ranges::find(m_file.flags, language, &FlagsRecord::language);
+
+  if (found != m_file.flags.end())
+    found->digest = std::move(digest);
+  else
+    m_file.flags.push_back(FlagsRecord{ language, std::move(digest) });
+}
+
+void
+BuildCache::write() const
+{
+  std::scoped_lock lock(m_mutex);
+  std::ofstream(m_path) << jayson::serialize(m_file).serialize();
+}
@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <expected>
 #include <filesystem>
 #include <format>
@@ -10,31 +13,35 @@
 #include <span>
 
 #include "analysis.hh"
+#include "build_cache.hh"
 #include "common.hh"
 #include "compile.hh"
 #include "confs.hh"
+#include "packages.hh"
 #include "paths.hh"
+#include "pgo.hh"
 #include "thread_pool.hh"
+#include "toolchain.hh"
 
 constexpr auto generate_file_flags =
   [](std::filesystem::path const filepath,
      std::filesystem::path const depfile,
      std::filesystem::path const object_file) static
   -> std::vector<std::string> {
-  using std::filesystem::relative;
-
   return {
     "-MMD",
     "-MF",
-    relative(depfile),
+    project_relative(depfile),
     "-o",
-    relative(object_file),
-    relative(filepath),
+    project_relative(object_file),
+    project_relative(filepath),
   };
 };
 
 constexpr auto generate_common_flags =
-  [](bool const is_release, bool const PIC) static -> std::vector<std::string> {
+  [](ConfigurationFile const& config,
+     bool const is_release,
+     bool const PIC) static -> std::vector<std::string> {
   static const std::vector<std::string> common_flags = {
     "-c",
     "-Iprivate",
@@ -43,32 +50,46 @@ constexpr auto generate_common_flags =
   };
 
   auto copy = common_flags;
+  auto const opt_level = get_build_type_conf(config, is_release).opt_level;
 
   if (is_release)
-    copy = copy + std::vector<std::string>{ "-O2" };
+    copy = copy + std::vector<std::string>{ std::format(
+                    "-O{}", opt_level.value_or(2)) };
   else
-    copy = copy + std::vector<std::string>{ "-Og", "-g" };
+    copy = copy + std::vector<std::string>{
+      opt_level ? std::format("-O{}", *opt_level) : "-Og", "-g"
+    };
+
+  if (uses_split_dwarf(config, is_release))
+    copy = copy + std::vector<std::string>{ "-gsplit-dwarf" };
 
   if (PIC)
     copy = copy + std::vector<std::string>{ "-fPIC" };
 
+  for (auto const& directory : get_package_include_directories(config))
+    copy.push_back(std::format("-I{}", directory.string()));
+
   return copy;
 };
 
 constexpr auto generate_c_flags =
   [](ConfigurationFile const& config,
+     ToolFile const& tools,
      bool const is_release,
      bool const PIC) static -> std::vector<std::string> {
-  return generate_common_flags(is_release, PIC) + config.c.flags +
+  return generate_common_flags(config, is_release, PIC) +
+         lto_flags(config, tools.cc, is_release) + config.c.flags +
          std::vector{ std::format(
            "-std={}", get_c_standard_string(config.c.std.value_or(17))) };
 };
 
 constexpr auto generate_cxx_flags =
   [](ConfigurationFile const& config,
+     ToolFile const& tools,
      bool const is_release,
      bool const PIC) static -> std::vector<std::string> {
-  return generate_common_flags(is_release, PIC) + config.cxx.flags +
+  return generate_common_flags(config, is_release, PIC) +
+         lto_flags(config, tools.cxx, is_release) + config.cxx.flags +
          std::vector{ std::format(
            "-std={}", get_cxx_standard_string(config.cxx.std.value_or(20))) };
 };
@@ -99,16 +120,20 @@ static std::future<std::optional<std::string>>
 start_cxx_compile_task(ThreadPool& thread_pool,
                        ConfigurationFile const&,
                        ToolFile const& tool_file,
+                       BuildCache& build_cache,
                        std::filesystem::path const source_filepath,
                        std::filesystem::path const object_filepath,
                        std::filesystem::path const depend_filepath,
-                       std::vector<std::string> common_flags)
+                       std::vector<std::string> common_flags,
+                       std::shared_ptr<CommandHandle> handle)
 {
   return thread_pool.add_job([source_filepath,
                               object_filepath,
                               depend_filepath,
                               common_flags,
+                              handle,
                               &tool_file,
+                              &build_cache,
                               &thread_pool]() -> std::optional<std::string> {
     auto const relative_source_path =
       std::filesystem::relative(source_filepath, hewg_cxx_src_directory_path);
@@ -119,14 +144,28 @@ start_cxx_compile_task(ThreadPool& thread_pool,
     auto const [exit_code, what] = run_command(
       tool_file.cxx,
       common_flags +
-        generate_file_flags(source_filepath, depend_filepath, object_filepath));
+        generate_file_flags(source_filepath, depend_filepath, object_filepath),
+      handle.get());
 
     if (exit_code != 0) {
-      thread_pool.drain();
+      // compiles with a handle are independent of each other,
+      // the rest of the queue is still wanted
+      if (handle == nullptr)
+        thread_pool.drain();
+
       return relative_source_path.string();
       // write_error_file(source_filepath, what);
     }
 
+    // comment-only edits and the like produce the
+    // exact same object, the link step wants to know
+    build_cache.restat_object(object_filepath);
+
+    // same for the .dwo, which dwp packages
+    if (auto const dwo = dwo_file_for_object(object_filepath);
+        std::filesystem::exists(dwo))
+      build_cache.restat_object(dwo);
+
     return std::nullopt;
   });
 }
@@ -135,16 +174,20 @@ static std::future<std::optional<std::string>>
 start_c_compile_task(ThreadPool& thread_pool,
                      ConfigurationFile const&,
                      ToolFile const& tool_file,
+                     BuildCache& build_cache,
                      std::filesystem::path const source_filepath,
                      std::filesystem::path const object_filepath,
                      std::filesystem::path const depend_filepath,
-                     std::vector<std::string> common_flags)
+                     std::vector<std::string> common_flags,
+                     std::shared_ptr<CommandHandle> handle)
 {
   return thread_pool.add_job([source_filepath,
                               object_filepath,
                               depend_filepath,
                               common_flags,
+                              handle,
                               &tool_file,
+                              &build_cache,
                               &thread_pool]() -> std::optional<std::string> {
     auto const relative_source_path =
       std::filesystem::relative(source_filepath, hewg_c_src_directory_path);
@@ -155,21 +198,103 @@ start_c_compile_task(ThreadPool& thread_pool,
     auto const [exit_code, what] = run_command(
       tool_file.cc,
       common_flags +
-        generate_file_flags(source_filepath, depend_filepath, object_filepath));
+        generate_file_flags(source_filepath, depend_filepath, object_filepath),
+      handle.get());
 
     if (exit_code != 0) {
-      thread_pool.drain();
+      // compiles with a handle are independent of each other,
+      // the rest of the queue is still wanted
+      if (handle == nullptr)
+        thread_pool.drain();
+
       return relative_source_path.string();
       // write_error_file(source_filepath, what);
     }
 
+    // comment-only edits and the like produce the
+    // exact same object, the link step wants to know
+    build_cache.restat_object(object_filepath);
+
+    // same for the .dwo, which dwp packages
+    if (auto const dwo = dwo_file_for_object(object_filepath);
+        std::filesystem::exists(dwo))
+      build_cache.restat_object(dwo);
+
     return std::nullopt;
   });
 }
 
+struct HewgsymCache
+{
+  version_triplet version;
+  std::string build_date;
+
+  using jayson_fields =
+    std::tuple<jayson::obj_field<"version", &HewgsymCache::version>,
+               jayson::obj_field<"build_date", &HewgsymCache::build_date>>;
+};
+
+static std::optional<long>
+get_source_date_epoch()
+{
+  auto const env = std::getenv("SOURCE_DATE_EPOCH");
+
+  if (env == nullptr)
+    return std::nullopt;
+
+  long epoch = 0;
+  auto const [end, ec] =
+    std::from_chars(env, env + std::strlen(env), epoch, 10);
+
+  if (ec != std::errc() or *end != '\0')
+    throw std::runtime_error(
+      std::format("SOURCE_DATE_EPOCH <{}> is not a valid timestamp", env));
+
+  // SOURCE_DATE_EPOCH is unix time,
+  // but the build date is stored against the utc clock
+  using namespace std::chrono;
+  return utc_clock::from_sys(sys_seconds(seconds(epoch)))
+    .time_since_epoch()
+    .count();
+}
+
+// the build date is only moved forward when the version changes,
+// or when a release is linked. debug builds reuse the last one,
+// so the hewgsym object stays identical between them
+static long
+get_hewgsym_build_date(ConfigurationFile const& config, bool const release)
+{
+  if (auto const epoch = get_source_date_epoch())
+    return *epoch;
+
+  HewgsymCache cache;
+
+  if (std::filesystem::exists(hewg_builtinsym_cache_path)) {
+    jayson::val v =
+      jayson::val::parse(read_file(hewg_builtinsym_cache_path));
+    jayson::deserialize(v, cache);
+
+    if (not release and cache.version == config.project.version)
+      return std::stol(cache.build_date);
+  }
+
+  using namespace std::chrono;
+  auto const now = duration_cast<seconds>(utc_clock::now().time_since_epoch());
+
+  cache.version = config.project.version;
+  cache.build_date = std::to_string(now.count());
+  std::ofstream(hewg_builtinsym_cache_path.get())
+    << jayson::serialize(cache).serialize();
+
+  return now.count();
+}
+
+// with no build date, the date symbol is instead read out of
+// an absolute symbol the linker defines, see hewgsym_link_flags()
 static std::string
 emit_symcache_contents(std::string_view package_name,
-                       version_triplet const trip)
+                       version_triplet const trip,
+                       std::optional<long> const build_date)
 {
   auto const [x, y, z] = trip;
 
@@ -181,12 +306,18 @@ emit_symcache_contents(std::string_view package_name,
                      y,
                      z);
 
-  using namespace std::chrono;
-
-  auto const now = duration_cast<seconds>(utc_clock::now().time_since_epoch());
-
-  out += std::format(
-    "long __hewg_build_date_package_{} = {};\n", package_name, now.count());
+  if (build_date) {
+    out += std::format("long __hewg_build_date_package_{} = {};\n",
+                       package_name,
+                       *build_date);
+  } else {
+    out += std::format("extern char __hewg_build_date_abs_package_{}[];\n",
+                       package_name);
+    out += std::format("long __hewg_build_date_package_{} = "
+                       "(long)__hewg_build_date_abs_package_{};\n",
+                       package_name,
+                       package_name);
+  }
 
   return out;
 }
@@ -194,28 +325,118 @@ emit_symcache_contents(std::string_view package_name,
 std::filesystem::path
 compile_hewgsym(ConfigurationFile const& config,
                 ToolFile const& tools,
-                bool PIC)
+                bool const PIC,
+                bool const release)
 {
-  auto const object_file_name =
+  std::filesystem::path const object_file_name =
     PIC ? hewg_builtinsym_obj_pic_path : hewg_builtinsym_obj_path;
 
-  std::ofstream(hewg_builtinsym_src_path)
-    << emit_symcache_contents(config.project.name, config.project.version);
+  auto const contents =
+    config.meta.build_date_at_link
+      ? emit_symcache_contents(
+          config.project.name, config.project.version, std::nullopt)
+      : emit_symcache_contents(config.project.name,
+                               config.project.version,
+                               get_hewgsym_build_date(config, release));
+
+  // only touch the source if it actually changed,
+  // the modification date decides if we recompile
+  if (not std::filesystem::exists(hewg_builtinsym_src_path) or
+      read_file(hewg_builtinsym_src_path) != contents)
+    std::ofstream(hewg_builtinsym_src_path.get()) << contents;
+
+  if (std::filesystem::exists(object_file_name) and
+      std::filesystem::last_write_time(object_file_name) >=
+        std::filesystem::last_write_time(hewg_builtinsym_src_path))
+    return object_file_name;
 
   std::vector<std::string> args;
   args.push_back("-O2");
   args.push_back("-c");
-  args.push_back(hewg_builtinsym_src_path);
+  args.push_back(hewg_builtinsym_src_path.string());
   args.push_back("-o");
   args.push_back(object_file_name);
   if (PIC)
     args.push_back("-fPIC");
 
-  run_command(tools.cc, args);
+  auto const [exit_code, _] = run_command(tools.cc, args);
+
+  if (exit_code != 0)
+    throw std::runtime_error("failed to compile the hewgsym object");
 
   return object_file_name;
 }
 
+std::vector<std::string>
+hewgsym_link_flags(ConfigurationFile const& config, bool const release)
+{
+  if (not config.meta.build_date_at_link)
+    return {};
+
+  return { std::format("-Wl,--defsym=__hewg_build_date_abs_package_{}={}",
+                       config.project.name,
+                       get_hewgsym_build_date(config, release)) };
+}
+
+std::filesystem::path
+dwo_file_for_object(std::filesystem::path object)
+{
+  return object.replace_extension(".dwo");
+}
+
+// on top of whatever the depfiles say, everything is rebuilt
+// when the flags change, as is anything split dwarf left without a .dwo
+static std::vector<std::filesystem::path>
+select_rebuilds(BuildCache& build_cache,
+                std::string const& language,
+                std::span<std::string const> flags,
+                bool const split_dwarf,
+                std::span<std::filesystem::path const> sources,
+                std::span<std::filesystem::path const> objects,
+                std::vector<std::filesystem::path> rebuilds)
+{
+  if (build_cache.flags_changed(language, flags)) {
+    threadsafe_print_verbose(
+      std::format("{} flags changed, rebuilding every {} file\n",
+                  language,
+                  language));
+
+    // only persisted once the build succeeds
+    build_cache.record_flags(language, flags);
+
+    // leftovers from a split dwarf build
+    if (not split_dwarf)
+      for (auto const& object : objects)
+        std::filesystem::remove(dwo_file_for_object(object));
+
+    return { sources.begin(), sources.end() };
+  }
+
+  if (not split_dwarf)
+    return rebuilds;
+
+  for (std::size_t i = 0; i < sources.size(); i++)
+    if (not std::filesystem::exists(dwo_file_for_object(objects[i])) and
+        std::ranges::find(rebuilds, sources[i]) == rebuilds.end())
+      rebuilds.push_back(sources[i]);
+
+  return rebuilds;
+}
+
+// what the flags record of a language is made of. a use build
+// also has to recompile whenever the profile it uses changes
+static std::vector<std::string>
+recorded_flags(std::vector<std::string> flags,
+               std::string const& compiler,
+               std::optional<PGOConf> const& pgo)
+{
+  if (pgo and pgo->mode == PGOMode::Use)
+    flags.push_back(
+      std::format("pgo profile {}", pgo_profile_digest(compiler, *pgo)));
+
+  return flags;
+}
+
 static auto
 ensure_object_output_paths_exist(
   std::span<std::filesystem::path const> object_filepaths)
@@ -246,9 +467,11 @@ std::pair<std::vector<std::filesystem::path>,
 compile_cxx(ThreadPool& threads,
             ConfigurationFile const& config,
             ToolFile const& tools,
+            BuildCache& build_cache,
             std::filesystem::path const& cache_folder,
             bool const release,
-            bool const PIC)
+            bool const PIC,
+            std::optional<PGOConf> const& pgo)
 {
   auto const cxx_filepaths = get_cxx_source_filepaths(config);
   std::vector<std::filesystem::path> cxx_objects;
@@ -260,9 +483,18 @@ compile_cxx(ThreadPool& threads,
 
   ensure_object_output_paths_exist(cxx_objects);
 
+  auto cxx_flags = generate_cxx_flags(config, tools, release, PIC);
+  if (pgo)
+    append_vec(cxx_flags, pgo_flags(tools.cxx, *pgo, cache_folder));
+
   auto const cxx_rebuilds =
-    mark_cxx_files_for_rebuild(cache_folder, cxx_filepaths);
-  auto const cxx_flags = generate_cxx_flags(config, release, PIC);
+    select_rebuilds(build_cache,
+                    "cxx",
+                    recorded_flags(cxx_flags, tools.cxx, pgo),
+                    uses_split_dwarf(config, release),
+                    cxx_filepaths,
+                    cxx_objects,
+                    mark_cxx_files_for_rebuild(cache_folder, cxx_filepaths));
 
   {
     std::string cxx_flags_fmt;
@@ -282,10 +514,12 @@ compile_cxx(ThreadPool& threads,
     awaits.push_back(start_cxx_compile_task(threads,
                                             config,
                                             tools,
+                                            build_cache,
                                             rebuild,
                                             object_filepath,
                                             depend_filepath,
-                                            cxx_flags));
+                                            cxx_flags,
+                                            nullptr));
   }
 
   return std::pair{ cxx_objects, std::move(awaits) };
@@ -296,9 +530,11 @@ std::pair<std::vector<std::filesystem::path>,
 compile_c(ThreadPool& threads,
           ConfigurationFile const& config,
           ToolFile const& tools,
+          BuildCache& build_cache,
           std::filesystem::path const& cache_folder,
           bool const release,
-          bool const PIC)
+          bool const PIC,
+          std::optional<PGOConf> const& pgo)
 {
   auto const c_filepaths = get_c_source_filepaths(config);
   std::vector<std::filesystem::path> c_objects;
@@ -311,8 +547,18 @@ compile_c(ThreadPool& threads,
 
   ensure_object_output_paths_exist(c_objects);
 
-  auto const c_rebuilds = mark_c_files_for_rebuild(cache_folder, c_filepaths);
-  auto c_flags = generate_c_flags(config, release, PIC);
+  auto c_flags = generate_c_flags(config, tools, release, PIC);
+  if (pgo)
+    append_vec(c_flags, pgo_flags(tools.cc, *pgo, cache_folder));
+
+  auto const c_rebuilds =
+    select_rebuilds(build_cache,
+                    "c",
+                    recorded_flags(c_flags, tools.cc, pgo),
+                    uses_split_dwarf(config, release),
+                    c_filepaths,
+                    c_objects,
+                    mark_c_files_for_rebuild(cache_folder, c_filepaths));
 
   {
     std::string c_flags_fmt;
@@ -329,9 +575,98 @@ compile_c(ThreadPool& threads,
     auto const object_file = object_file_for_c(cache_folder, rebuild);
     auto const depend_file = depfile_for_c(cache_folder, rebuild);
 
-    awaits.push_back(start_c_compile_task(
-      threads, config, tools, rebuild, object_file, depend_file, c_flags));
+    awaits.push_back(start_c_compile_task(threads,
+                                          config,
+                                          tools,
+                                          build_cache,
+                                          rebuild,
+                                          object_file,
+                                          depend_file,
+                                          c_flags,
+                                          nullptr));
   }
 
   return { c_objects, std::move(awaits) };
 }
+
+std::vector<std::filesystem::path>
+sources_to_rebuild(ConfigurationFile const& config,
+                   ToolFile const& tools,
+                   BuildCache& build_cache,
+                   std::filesystem::path const& cache_folder,
+                   bool const release,
+                   bool const PIC)
+{
+  auto const cxx_sources = get_cxx_source_filepaths(config);
+  auto const c_sources = get_c_source_filepaths(config);
+
+  std::vector<std::filesystem::path> cxx_objects, c_objects;
+  for (auto const& source : cxx_sources)
+    cxx_objects.push_back(object_file_for_cxx(cache_folder, source));
+  for (auto const& source : c_sources)
+    c_objects.push_back(object_file_for_c(cache_folder, source));
+
+  bool const split_dwarf = uses_split_dwarf(config, release);
+
+  auto const cxx_rebuilds =
+    select_rebuilds(build_cache,
+                    "cxx",
+                    generate_cxx_flags(config, tools, release, PIC),
+                    split_dwarf,
+                    cxx_sources,
+                    cxx_objects,
+                    mark_cxx_files_for_rebuild(cache_folder, cxx_sources));
+
+  auto const c_rebuilds =
+    select_rebuilds(build_cache,
+                    "c",
+                    generate_c_flags(config, tools, release, PIC),
+                    split_dwarf,
+                    c_sources,
+                    c_objects,
+                    mark_c_files_for_rebuild(cache_folder, c_sources));
+
+  return cxx_rebuilds + c_rebuilds;
+}
+
+std::future<std::optional<std::string>>
+start_single_compile(ThreadPool& threads,
+                     ConfigurationFile const& config,
+                     ToolFile const& tools,
+                     BuildCache& build_cache,
+                     std::filesystem::path const& cache_folder,
+                     std::filesystem::path const& source,
+                     bool const release,
+                     bool const PIC,
+                     std::shared_ptr<CommandHandle> handle)
+{
+  switch (translate_filename_to_filetype(source)) {
+    case FileType::CXXSource: {
+      auto flags = generate_cxx_flags(config, tools, release, PIC);
+      return start_cxx_compile_task(threads,
+                                    config,
+                                    tools,
+                                    build_cache,
+                                    source,
+                                    object_file_for_cxx(cache_folder, source),
+                                    depfile_for_cxx(cache_folder, source),
+                                    std::move(flags),
+                                    std::move(handle));
+    }
+
+    case FileType::CSource:
+      return start_c_compile_task(threads,
+                                  config,
+                                  tools,
+                                  build_cache,
+                                  source,
+                                  object_file_for_c(cache_folder, source),
+                                  depfile_for_c(cache_folder, source),
+                                  generate_c_flags(config, tools, release, PIC),
+                                  std::move(handle));
+
+    default:
+      throw std::runtime_error(std::format(
+        "<{}> is not a source file, can't compile it", source.string()));
+  }
+}
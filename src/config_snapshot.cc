@@ -0,0 +1,279 @@
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "common.hh"
+#include "config_snapshot.hh"
+#include "confs.hh"
+#include "paths.hh"
+
+// bumped whenever describe() changes
+static constexpr char snapshot_magic[8] = { 'h', 'e', 'w', 'g',
+                                            'c', 'f', 'g', '1' };
+
+// lists every field of each snapshotted struct once, for both
+// writing and reading. a field missing here is silently lost,
+// so new config fields have to be added here too
+template<typename S, typename T>
+static void
+describe(S& s, T& x)
+{
+  using U = std::remove_const_t<T>;
+
+  if constexpr (std::same_as<U, ConfigurationFile>)
+    s(x.meta,
+      x.project,
+      x.tools,
+      x.c,
+      x.cxx,
+      x.libs,
+      x.internal_deps,
+      x.external_deps,
+      x.prebuild_hooks,
+      x.postbuild_hooks,
+      x.debug,
+      x.release);
+  else if constexpr (std::same_as<U, MetaConf>)
+    s(x.version,
+      x.type,
+      x.profile_override,
+      x.build_date_at_link,
+      x.pic_only);
+  else if constexpr (std::same_as<U, ProjectConf>)
+    s(x.version, x.name, x.description, x.authors);
+  else if constexpr (std::same_as<U, ToolProfile>)
+    s(x.tool_profile_name);
+  else if constexpr (std::same_as<U, CConf> or std::same_as<U, CXXConf>)
+    s(x.std, x.flags, x.sources);
+  else if constexpr (std::same_as<U, LibraryConf>)
+    s(x.native);
+  else if constexpr (std::same_as<U, Dependency>)
+    s(x.name, x.version, x.exact);
+  else if constexpr (std::same_as<U, HooksConf>)
+    s(x.once, x.always);
+  else if constexpr (std::same_as<U, BuildTypeConf>)
+    s(x.opt_level, x.lto, x.lto_mode, x.strip, x.split_dwarf, x.dwp);
+  else if constexpr (std::same_as<U, ToolFile>)
+    s(x.cxx, x.cc, x.ld, x.ar, x.dwp, x.profdata, x.bolt);
+  else
+    static_assert(sizeof(U) == 0, "not a snapshotted struct");
+}
+
+class SnapshotWriter
+{
+  std::string m_out;
+
+  template<typename T>
+  void put(T const& x)
+  {
+    if constexpr (std::is_arithmetic_v<T> or std::is_enum_v<T>) {
+      m_out.append(reinterpret_cast<char const*>(&x), sizeof(x));
+    } else if constexpr (std::same_as<T, std::string>) {
+      put(std::uint64_t(x.size()));
+      m_out += x;
+    } else if constexpr (requires { x.has_value(); }) {
+      put(x.has_value());
+      if (x)
+        put(*x);
+    } else if constexpr (requires { x.begin(); }) {
+      put(std::uint64_t(x.size()));
+      for (auto const& element : x)
+        put(element);
+    } else if constexpr (std::same_as<T, version_triplet>) {
+      std::apply([&](auto const&... parts) { (put(parts), ...); }, x);
+    } else {
+      describe(*this, x);
+    }
+  }
+
+public:
+  template<typename... Ts>
+  void operator()(Ts const&... xs)
+  {
+    (put(xs), ...);
+  }
+
+  std::string const& out() const { return m_out; }
+};
+
+// throws if the snapshot is cut short
+class SnapshotReader
+{
+  std::string_view m_in;
+
+  std::string_view take(std::size_t const n)
+  {
+    if (n > m_in.size())
+      throw std::runtime_error("snapshot is cut short");
+
+    auto const out = m_in.substr(0, n);
+    m_in.remove_prefix(n);
+    return out;
+  }
+
+  template<typename T>
+  void get(T& x)
+  {
+    if constexpr (std::is_arithmetic_v<T> or std::is_enum_v<T>) {
+      std::memcpy(&x, take(sizeof(x)).data(), sizeof(x));
+    } else if constexpr (std::same_as<T, std::string>) {
+      std::uint64_t size;
+      get(size);
+      x = take(size);
+    } else if constexpr (requires { x.has_value(); }) {
+      bool has_value;
+      get(has_value);
+      x.reset();
+      if (has_value)
+        get(x.emplace());
+    } else if constexpr (requires { x.begin(); }) {
+      std::uint64_t size;
+      get(size);
+      x.clear();
+      for (std::uint64_t i = 0; i < size; i++)
+        get(x.emplace_back());
+    } else if constexpr (std::same_as<T, version_triplet>) {
+      std::apply([&](auto&... parts) { (get(parts), ...); }, x);
+    } else {
+      describe(*this, x);
+    }
+  }
+
+public:
+  explicit SnapshotReader(std::string_view in)
+    : m_in(in)
+  {
+  }
+
+  template<typename... Ts>
+  void operator()(Ts&... xs)
+  {
+    (get(xs), ...);
+  }
+
+  bool finished() const { return m_in.empty(); }
+};
+
+// what a snapshot starts with, anything else
+// means it's of something else
+static std::string
+snapshot_header(std::string_view const source_digest)
+{
+  SnapshotWriter header;
+  header(this_hewg_version, std::string(source_digest));
+  return std::string(snapshot_magic, sizeof(snapshot_magic)) + header.out();
+}
+
+static std::optional<std::filesystem::path>
+snapshot_path(std::string_view const kind, std::string_view const name)
+{
+  // names come from the command line & hewg.scl
+  if (name.empty() or name.find('/') != std::string_view::npos)
+    return std::nullopt;
+
+  return hewg_config_snapshot_path / std::format("{}-{}.bin", kind, name);
+}
+
+template<typename T>
+static std::optional<T>
+read_snapshot(std::string_view const kind,
+              std::string_view const name,
+              std::string_view const source_digest)
+{
+  auto const path = snapshot_path(kind, name);
+  if (not path or not std::filesystem::exists(*path))
+    return std::nullopt;
+
+  try {
+    std::string const data = read_file(*path);
+    auto const header = snapshot_header(source_digest);
+
+    if (not data.starts_with(header))
+      return std::nullopt;
+
+    T out;
+    SnapshotReader reader(std::string_view(data).substr(header.size()));
+    reader(out);
+
+    if (not reader.finished())
+      return std::nullopt;
+
+    threadsafe_print_verbose(
+      std::format("using config snapshot <{}>\n", path->string()));
+    return out;
+  } catch (std::exception const&) {
+    // it's only a cache, it gets taken again
+    return std::nullopt;
+  }
+}
+
+template<typename T>
+static void
+write_snapshot(std::string_view const kind,
+               std::string_view const name,
+               std::string_view const source_digest,
+               T const& value)
+{
+  auto const path = snapshot_path(kind, name);
+  if (not path)
+    return;
+
+  SnapshotWriter writer;
+  writer(value);
+
+  // renamed into place, two hewgs can start at once
+  auto const temporary =
+    hewg_config_snapshot_path /
+    std::format(".{}.tmp-{}", path->filename().string(), getpid());
+
+  std::error_code ec;
+  std::filesystem::create_directories(hewg_config_snapshot_path, ec);
+
+  std::ofstream(temporary, std::ios::binary)
+    << snapshot_header(source_digest) << writer.out();
+
+  std::filesystem::rename(temporary, *path, ec);
+  if (ec)
+    std::filesystem::remove(temporary, ec);
+}
+
+std::optional<ConfigurationFile>
+read_config_snapshot(std::string_view const build_profile,
+                     std::string_view const source_digest)
+{
+  return read_snapshot<ConfigurationFile>(
+    "config", build_profile, source_digest);
+}
+
+void
+write_config_snapshot(std::string_view const build_profile,
+                      std::string_view const source_digest,
+                      ConfigurationFile const& config)
+{
+  write_snapshot("config", build_profile, source_digest, config);
+}
+
+std::optional<ToolFile>
+read_tool_snapshot(std::string_view const tool_profile,
+                   std::string_view const source_digest)
+{
+  return read_snapshot<ToolFile>("tools", tool_profile, source_digest);
+}
+
+void
+write_tool_snapshot(std::string_view const tool_profile,
+                    std::string_view const source_digest,
+                    ToolFile const& tools)
+{
+  write_snapshot("tools", tool_profile, source_digest, tools);
+}
@@ -1,12 +1,17 @@
+#include <cstdlib>
 #include <filesystem>
 #include <jayson.hh>
 #include <optional>
+#include <ranges>
 #include <scl.hh>
+#include <string_view>
 
 #include "analysis.hh"
 #include "cmdline.hh"
 #include "common.hh"
+#include "config_snapshot.hh"
 #include "confs.hh"
+#include "digest.hh"
 #include "paths.hh"
 
 std::string_view
@@ -38,12 +43,50 @@ project_type_from_string(std::string_view s)
   return find->second;
 }
 
+// the abi flags of the project a package is being built from source
+// for, see build_package_from_source. separated by spaces
+static std::string_view
+inherited_abi_flags(char const* const variable)
+{
+  auto const value = std::getenv(variable);
+  return value == nullptr ? std::string_view() : std::string_view(value);
+}
+
+static void
+append_flags(std::vector<std::string>& into, std::string_view const flags)
+{
+  for (auto const flag : flags | std::views::split(' '))
+    if (not flag.empty())
+      into.emplace_back(flag.begin(), flag.end());
+}
+
 ConfigurationFile
 get_config_file(ToplevelOptions const& options,
                 std::filesystem::path path,
                 std::string_view build_profile)
 {
   std::string config_filedata = read_file(path);
+
+  // the file still has to be read to know the snapshot is of it,
+  // but digesting it is much cheaper than parsing it
+  auto const inherited_cxx = inherited_abi_flags(cxx_abi_flags_variable);
+  auto const inherited_c = inherited_abi_flags(c_abi_flags_variable);
+
+  // a snapshot taken with other inherited flags isn't this config
+  auto const source_digest =
+    inherited_cxx.empty() and inherited_c.empty()
+      ? digest_string(config_filedata)
+      : Digest()
+          .update(config_filedata)
+          .update(std::string_view("\0", 1))
+          .update(inherited_cxx)
+          .update(std::string_view("\0", 1))
+          .update(inherited_c)
+          .finish();
+
+  if (auto snapshot = read_config_snapshot(build_profile, source_digest))
+    return std::move(*snapshot);
+
   scl::file file(config_filedata);
 
   auto const cxx_bp = std::string("cxx.").append(build_profile);
@@ -53,7 +96,9 @@ get_config_file(ToplevelOptions const& options,
   ConfigurationFile conf;
   scl::deserialize(conf, file);
 
-  if (not semantically_valid(conf.meta.version, this_hewg_version)) {
+  bool const version_valid =
+    semantically_valid(conf.meta.version, this_hewg_version);
+  if (not version_valid) {
     if (not options.force)
       throw std::runtime_error(
         std::format("hewg project requests version {}, but we have {}",
@@ -98,12 +143,52 @@ get_config_file(ToplevelOptions const& options,
       conf.c.std = append.std;
   }
 
+  // last, so they win over the project's own
+  append_flags(conf.cxx.flags, inherited_cxx);
+  append_flags(conf.c.flags, inherited_c);
+
+  // the default profile's tables apply to every profile,
+  // the build profile's own table overrides them field by field
+  auto const overlay_build_type = [&](BuildTypeConf& into,
+                                      std::string_view build_type) {
+    auto const tables = { std::format("{}.default", build_type),
+                          std::format("{}.{}", build_type, build_profile) };
+
+    for (auto const& table : tables) {
+      if (not file.table_exists(table))
+        continue;
+
+      BuildTypeConf over;
+      scl::deserialize(over, file, table);
+
+      if (over.opt_level)
+        into.opt_level = over.opt_level;
+      if (over.lto)
+        into.lto = over.lto;
+      if (over.lto_mode)
+        into.lto_mode = over.lto_mode;
+      if (over.strip)
+        into.strip = over.strip;
+      if (over.split_dwarf)
+        into.split_dwarf = over.split_dwarf;
+      if (over.dwp)
+        into.dwp = over.dwp;
+    }
+  };
+
+  overlay_build_type(conf.debug, "debug");
+  overlay_build_type(conf.release, "release");
+
   if (file.table_exists(tool_bp)) {
     ToolProfile replace;
     scl::deserialize(replace, file, tool_bp);
     conf.tools = replace;
   }
 
+  // a forced config mustn't get past the version check next time
+  if (version_valid)
+    write_config_snapshot(build_profile, source_digest, conf);
+
   return conf;
 }
 
@@ -117,17 +202,43 @@ get_default_tool_profile()
 #endif
 };
 
+std::filesystem::path
+get_tool_file_path(ConfigurationFile const& config)
+{
+  auto const static tool_dir = user_hewg_directory / "tools";
+  return tool_dir / config.tools.tool_profile_name;
+}
+
 ToolFile
 get_tool_file(ConfigurationFile const& config, std::string_view)
 {
-  auto const static tool_dir = user_hewg_directory / "tools";
-  auto const tool_file = tool_dir / config.tools.tool_profile_name;
+  auto const& tool_profile = config.tools.tool_profile_name;
+  auto filedata = read_file(get_tool_file_path(config));
+
+  auto const source_digest = digest_string(filedata);
+  if (auto snapshot = read_tool_snapshot(tool_profile, source_digest))
+    return std::move(*snapshot);
 
   ToolFile into;
-  auto filedata = read_file(tool_file);
   scl::file file(filedata);
   scl::deserialize(into, file, "tools");
 
+  write_tool_snapshot(tool_profile, source_digest, into);
+  return into;
+}
+
+WorkspaceConf
+get_workspace_file(std::filesystem::path path)
+{
+  WorkspaceConf into;
+  auto filedata = read_file(path);
+  scl::file file(filedata);
+  scl::deserialize(into, file, "workspace");
+
+  if (into.members.empty())
+    throw std::runtime_error(
+      std::format("workspace <{}> has no members", path.string()));
+
   return into;
 }
 
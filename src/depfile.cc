@@ -126,5 +126,13 @@ parse_depfile(std::filesystem::path const path)
     throw std::runtime_error(
       std::format("failed to parse depfile:\n{}", out.error().what()));
 
-  return *out;
+  // the compiler ran in the project root, its
+  // paths are relative to that and not to hewg
+  auto depfile = *out;
+  depfile.obj_path = project_root() / depfile.obj_path;
+  depfile.src_path = project_root() / depfile.src_path;
+  for (auto& dependency : depfile.dependencies)
+    dependency = project_root() / dependency;
+
+  return depfile;
 }
@@ -0,0 +1,168 @@
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "digest.hh"
+
+static constexpr std::array<std::uint32_t, 64> round_constants = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+Digest::Digest()
+  : m_state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+{
+}
+
+void
+Digest::compress(unsigned char const* block)
+{
+  std::array<std::uint32_t, 64> w;
+
+  for (int i = 0; i < 16; i++)
+    w[i] = (std::uint32_t(block[i * 4]) << 24) |
+           (std::uint32_t(block[i * 4 + 1]) << 16) |
+           (std::uint32_t(block[i * 4 + 2]) << 8) |
+           std::uint32_t(block[i * 4 + 3]);
+
+  for (int i = 16; i < 64; i++) {
+    auto const s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^
+                    (w[i - 15] >> 3);
+    auto const s1 =
+      std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  auto [a, b, c, d, e, f, g, h] = m_state;
+
+  for (int i = 0; i < 64; i++) {
+    auto const s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+    auto const ch = (e & f) ^ (~e & g);
+    auto const t1 = h + s1 + ch + round_constants[i] + w[i];
+    auto const s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+    auto const maj = (a & b) ^ (a & c) ^ (b & c);
+    auto const t2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  m_state[0] += a;
+  m_state[1] += b;
+  m_state[2] += c;
+  m_state[3] += d;
+  m_state[4] += e;
+  m_state[5] += f;
+  m_state[6] += g;
+  m_state[7] += h;
+}
+
+Digest&
+Digest::update(std::span<unsigned char const> data)
+{
+  m_total_len += data.size();
+
+  // top off a partially filled block first
+  if (m_block_len != 0) {
+    auto const take = std::min(data.size(), m_block.size() - m_block_len);
+    std::memcpy(m_block.data() + m_block_len, data.data(), take);
+    m_block_len += take;
+    data = data.subspan(take);
+
+    if (m_block_len != m_block.size())
+      return *this;
+
+    compress(m_block.data());
+    m_block_len = 0;
+  }
+
+  while (data.size() >= m_block.size()) {
+    compress(data.data());
+    data = data.subspan(m_block.size());
+  }
+
+  std::memcpy(m_block.data(), data.data(), data.size());
+  m_block_len = data.size();
+
+  return *this;
+}
+
+Digest&
+Digest::update(std::string_view data)
+{
+  return update(std::span(
+    reinterpret_cast<unsigned char const*>(data.data()), data.size()));
+}
+
+std::string
+Digest::finish()
+{
+  std::uint64_t const bit_len = m_total_len * 8;
+
+  unsigned char const pad_start = 0x80;
+  update(std::span(&pad_start, 1));
+
+  unsigned char const zero = 0;
+  while (m_block_len != 56)
+    update(std::span(&zero, 1));
+
+  std::array<unsigned char, 8> len_bytes;
+  for (int i = 0; i < 8; i++)
+    len_bytes[i] = (unsigned char)(bit_len >> (56 - i * 8));
+  update(len_bytes);
+
+  constexpr auto hex = "0123456789abcdef";
+
+  std::string out;
+  out.reserve(64);
+
+  for (auto const word : m_state)
+    for (int shift = 28; shift >= 0; shift -= 4)
+      out.push_back(hex[(word >> shift) & 0xf]);
+
+  return out;
+}
+
+std::string
+digest_string(std::string_view what)
+{
+  return Digest().update(what).finish();
+}
+
+std::string
+digest_file(std::filesystem::path const& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (file.fail())
+    throw std::runtime_error("unable to open file <" + path.string() +
+                             "> for digesting");
+
+  Digest digest;
+  std::array<char, 64 * 1024> buf;
+
+  while (file) {
+    file.read(buf.data(), buf.size());
+    digest.update(std::string_view(buf.data(), file.gcount()));
+  }
+
+  return digest.finish();
+}
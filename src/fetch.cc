@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <jayson.hh>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "common.hh"
+#include "digest.hh"
+#include "fetch.hh"
+#include "http.hh"
+#include "package_index.hh"
+#include "packages.hh"
+#include "paths.hh"
+#include "store.hh"
+#include "tar.hh"
+
+// tries per request before giving up on the mirror
+constexpr int fetch_attempts = 5;
+
+// for whatever retrying won't fix,
+// like an archive that doesn't match its digest
+struct FetchFailed : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+// calls fn until it doesn't throw, waiting a little
+// longer after every failure
+static void
+with_retries(std::string_view what, auto const& fn)
+{
+  for (int attempt = 1;; attempt++) {
+    try {
+      fn();
+      return;
+    } catch (FetchFailed const&) {
+      throw;
+    } catch (std::exception const& e) {
+      if (attempt == fetch_attempts)
+        throw;
+
+      threadsafe_print(
+        std::format("retrying {} after: {}\n", what, e.what()));
+      std::this_thread::sleep_for(std::chrono::milliseconds(250 * attempt));
+    }
+  }
+}
+
+std::optional<std::string>
+package_mirror_url()
+{
+  auto const url = std::getenv("HEWG_MIRROR");
+  if (url == nullptr or *url == '\0')
+    return std::nullopt;
+  return url;
+}
+
+PackageMirror::PackageMirror(std::string_view url)
+  : m_url(parse_http_url(url))
+{
+}
+
+MirrorListing const&
+PackageMirror::listing(std::string_view name)
+{
+  if (auto const found = m_listings.find(name); found != m_listings.end())
+    return found->second;
+
+  // it ends up in the request line
+  if (not is_safe_package_name(name))
+    throw std::runtime_error(
+      std::format("<{}> can't be the name of a package", name));
+
+  MirrorListing out{ std::string(name), {} };
+
+  with_retries(std::format("listing <{}>", name), [&] {
+    std::string body;
+    auto const response = http_get(
+      m_url,
+      std::format("/{}/versions.json", name),
+      0,
+      [&](HttpResponse const&, std::string_view chunk) { body.append(chunk); });
+
+    // the mirror just doesn't have it
+    if (response.status == 404)
+      return;
+
+    if (response.status != 200)
+      throw std::runtime_error(
+        std::format("mirror responded with <{}>", response.status));
+
+    try {
+      jayson::deserialize(jayson::val::parse(std::move(body)), out);
+    } catch (std::exception const& e) {
+      throw FetchFailed(std::format(
+        "mirror sent an unreadable listing for <{}>: {}", name, e.what()));
+    }
+
+    // these get listed & fetched next
+    for (auto const& version : out.versions)
+      for (auto const& dependency : version.dependencies)
+        if (not is_safe_package_name(dependency.name))
+          throw FetchFailed(
+            std::format("mirror lists <{}> as a dependency of <{}>",
+                        dependency.name,
+                        name));
+
+    std::ranges::sort(out.versions, {}, &MirrorVersion::version);
+  });
+
+  return m_listings.insert_or_assign(std::string(name), std::move(out))
+    .first->second;
+}
+
+std::span<version_triplet const>
+PackageMirror::versions(std::string_view name)
+{
+  if (auto const found = m_versions.find(name); found != m_versions.end())
+    return found->second;
+
+  auto const installed = m_installed.versions(name);
+  std::vector<version_triplet> out(installed.begin(), installed.end());
+
+  for (auto const& version : listing(name).versions)
+    out.push_back(version.version);
+
+  std::ranges::sort(out);
+  auto const duplicates = std::ranges::unique(out);
+  out.erase(duplicates.begin(), duplicates.end());
+
+  return m_versions.insert_or_assign(std::string(name), std::move(out))
+    .first->second;
+}
+
+std::span<Dependency const>
+PackageMirror::dependencies(std::string_view name,
+                            version_triplet const version)
+{
+  // whatever is installed already is what will be used
+  if (std::ranges::binary_search(m_installed.versions(name), version))
+    return m_installed.dependencies(name, version);
+
+  auto const& versions = listing(name).versions;
+  auto const found =
+    std::ranges::find(versions, version, &MirrorVersion::version);
+
+  if (found == versions.end())
+    throw std::runtime_error(
+      std::format("package <{}> version <{}> is not on the mirror",
+                  name,
+                  version_triplet_to_string(version)));
+
+  return found->dependencies;
+}
+
+void
+PackageMirror::fetch_one(std::string const& name,
+                         version_triplet const version,
+                         std::string const& digest) const
+{
+  // everything below is written under ~/.hewg/packages/<name>
+  if (not is_safe_package_name(name))
+    throw FetchFailed(std::format("<{}> can't be the name of a package", name));
+
+  auto const version_string = version_triplet_to_string(version);
+  auto const package_directory = hewg_packages_directory / name;
+  auto const destination = package_directory / version_string;
+
+  // hidden, and never a version, so the
+  // package index doesn't pick it up
+  auto const staging =
+    package_directory / std::format(".{}.fetch-{}", version_string, getpid());
+
+  Digest archive_digest;
+  std::uint64_t received = 0;
+  std::optional<TarExtractor> extractor;
+
+  auto const restart = [&] {
+    std::filesystem::remove_all(staging);
+    std::filesystem::create_directories(staging);
+    archive_digest = Digest();
+    received = 0;
+    extractor.emplace(staging);
+  };
+
+  restart();
+
+  try {
+    with_retries(std::format("<{}> {}", name, version_string), [&] {
+      auto const response = http_get(
+        m_url,
+        std::format("/{}/{}.tar", name, version_string),
+        received,
+        [&](HttpResponse const& response, std::string_view chunk) {
+          // where this chunk is in the archive
+          auto const at = response.offset + response.received - chunk.size();
+
+          // the mirror can't resume, so it's starting over
+          if (at != received) {
+            if (at != 0)
+              throw FetchFailed("mirror resumed from the wrong place");
+            restart();
+          }
+
+          archive_digest.update(chunk);
+          received += chunk.size();
+
+          try {
+            extractor->feed(chunk);
+          } catch (std::exception const& e) {
+            throw FetchFailed(e.what());
+          }
+        });
+
+      if (response.status == 404)
+        throw FetchFailed("it's not on the mirror");
+
+      if (response.status < 200 or response.status >= 300)
+        throw std::runtime_error(
+          std::format("mirror responded with <{}>", response.status));
+    });
+
+    if (not extractor->finished())
+      throw FetchFailed("the archive was cut short");
+
+    if (archive_digest.finish() != digest)
+      throw FetchFailed("the archive doesn't match its digest");
+
+    // someone else got it in the meantime
+    if (std::filesystem::exists(destination)) {
+      std::filesystem::remove_all(staging);
+    } else {
+      std::filesystem::rename(staging, destination);
+
+      StoreWriter store(destination);
+      store.add_existing_files();
+      store.finish();
+    }
+  } catch (...) {
+    std::filesystem::remove_all(staging);
+    throw;
+  }
+
+  auto const info = read_package_info(destination);
+  index_package_version(
+    name, IndexedVersion{ version, info.meta.type, info.internal_deps });
+}
+
+void
+PackageMirror::fetch(
+  ThreadPool& threads,
+  std::span<std::pair<std::string, version_triplet> const> packages)
+{
+  std::vector<std::future<std::optional<std::string>>> pending;
+
+  for (auto const& [name, version] : packages) {
+    auto const version_string = version_triplet_to_string(version);
+
+    if (std::filesystem::exists(hewg_packages_directory / name /
+                                version_string / "info.scl"))
+      continue;
+
+    auto const& versions = listing(name).versions;
+    auto const found =
+      std::ranges::find(versions, version, &MirrorVersion::version);
+
+    if (found == versions.end())
+      throw std::runtime_error(
+        std::format("package <{}> version <{}> is neither installed "
+                    "nor on the mirror",
+                    name,
+                    version_string));
+
+    threadsafe_print(std::format("fetching <{}> {}\n", name, version_string));
+
+    pending.push_back(threads.add_job(
+      [this, name, version, version_string, digest = found->digest]()
+        -> std::optional<std::string> {
+        try {
+          fetch_one(name, version, digest);
+          threadsafe_print(
+            std::format("fetched <{}> {}\n", name, version_string));
+          return std::nullopt;
+        } catch (std::exception const& e) {
+          return std::format(
+            "unable to fetch <{}> {}: {}", name, version_string, e.what());
+        }
+      }));
+  }
+
+  std::size_t failed = 0;
+
+  for (auto& job : pending)
+    if (auto const error = job.get()) {
+      threadsafe_print(*error, '\n');
+      failed++;
+    }
+
+  if (failed > 0)
+    throw std::runtime_error(
+      std::format("{} package(s) couldn't be fetched", failed));
+}
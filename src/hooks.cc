@@ -8,6 +8,8 @@
 #include <filesystem>
 #include <fstream>
 #include <jayson.hh>
+#include <map>
+#include <mutex>
 
 struct HookCache
 {
@@ -17,27 +19,35 @@ struct HookCache
     std::tuple<jayson::obj_field<"once_hooks", &HookCache::once_hooks_ran>>;
 };
 
+// one cache per project, a workspace build runs the hooks of each member
 class HookCacheAccess
 {
 public:
   static HookCache& get_cache()
   {
-    if (not m_cache) {
-      m_cache = open_hook_cache();
-      std::atexit([]() { write_hook_cache(*m_cache); });
+    std::scoped_lock lock(m_mutex);
+
+    auto const path = hewg_hook_cache_path.get();
+    auto found = m_caches.find(path);
+
+    if (found == m_caches.end()) {
+      if (m_caches.empty())
+        std::atexit(write_hook_caches);
+
+      found = m_caches.emplace(path, open_hook_cache(path)).first;
     }
 
-    return *m_cache;
+    return found->second;
   }
 
 private:
-  static HookCache open_hook_cache()
+  static HookCache open_hook_cache(std::filesystem::path const& path)
   {
-    if (not std::filesystem::exists(hewg_hook_cache_path))
+    if (not std::filesystem::exists(path))
       return {};
 
     std::stringstream ss;
-    ss << std::ifstream(hewg_hook_cache_path).rdbuf();
+    ss << std::ifstream(path).rdbuf();
 
     jayson::val v = jayson::val::parse(std::move(ss).str());
     HookCache out;
@@ -47,13 +57,14 @@ private:
     return out;
   }
 
-  static void write_hook_cache(HookCache cache)
+  static void write_hook_caches()
   {
-    std::ofstream(hewg_hook_cache_path)
-      << (jayson::serialize(cache).serialize());
+    for (auto const& [path, cache] : m_caches)
+      std::ofstream(path) << (jayson::serialize(cache).serialize());
   }
 
-  static inline std::optional<HookCache> m_cache;
+  static inline std::mutex m_mutex;
+  static inline std::map<std::filesystem::path, HookCache> m_caches;
 };
 
 static void
@@ -0,0 +1,410 @@
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <netdb.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "common.hh"
+#include "http.hh"
+
+// headers bigger than this are someone talking nonsense
+constexpr std::size_t max_header_size = 16_kb;
+
+// closes the socket however http_get() leaves
+class Socket
+{
+  int m_fd;
+
+public:
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+
+  explicit Socket(int const fd)
+    : m_fd(fd)
+  {
+  }
+
+  ~Socket() { close(m_fd); }
+
+  int fd() const { return m_fd; }
+};
+
+static bool
+write_all(int const fd, std::string_view data)
+{
+  while (not data.empty()) {
+    auto const written = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written <= 0)
+      return false;
+    data.remove_prefix(written);
+  }
+
+  return true;
+}
+
+static std::optional<std::uint64_t>
+parse_number(std::string_view what)
+{
+  std::uint64_t out = 0;
+  auto const [end, ec] =
+    std::from_chars(what.data(), what.data() + what.size(), out);
+
+  if (ec != std::errc() or end != what.data() + what.size())
+    return std::nullopt;
+
+  return out;
+}
+
+static std::string_view
+trim(std::string_view what)
+{
+  while (what.starts_with(' ') or what.starts_with('\t'))
+    what.remove_prefix(1);
+  while (what.ends_with(' ') or what.ends_with('\t'))
+    what.remove_suffix(1);
+  return what;
+}
+
+static bool
+header_is(std::string_view header, std::string_view name)
+{
+  if (header.size() != name.size())
+    return false;
+
+  for (std::size_t i = 0; i < name.size(); i++)
+    if (std::tolower(static_cast<unsigned char>(header[i])) != name[i])
+      return false;
+
+  return true;
+}
+
+// calls on_header with each header of the header block in head,
+// which is everything up to the blank line. returns the first line
+static std::string_view
+split_headers(
+  std::string_view head,
+  std::function<void(std::string_view, std::string_view)> const& on_header)
+{
+  auto const first_end = head.find("\r\n");
+  auto const first = head.substr(0, first_end);
+
+  head.remove_prefix(std::min(first_end, head.size()));
+
+  while (not head.empty()) {
+    head.remove_prefix(std::min<std::size_t>(2, head.size()));
+
+    auto const end = head.find("\r\n");
+    auto const line = head.substr(0, end);
+    head.remove_prefix(std::min(end, head.size()));
+
+    auto const colon = line.find(':');
+    if (colon != std::string_view::npos)
+      on_header(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
+  }
+
+  return first;
+}
+
+// reads from fd until the blank line ending the headers.
+// returns the headers & whatever of the body came with them
+static std::optional<std::pair<std::string, std::string>>
+read_head(int const fd)
+{
+  std::string buffer;
+  char buf[4096];
+
+  for (;;) {
+    if (auto const end = buffer.find("\r\n\r\n"); end != std::string::npos)
+      return std::pair(buffer.substr(0, end), buffer.substr(end + 4));
+
+    if (buffer.size() > max_header_size)
+      return std::nullopt;
+
+    auto const len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      return std::nullopt;
+
+    buffer.append(buf, len);
+  }
+}
+
+HttpUrl
+parse_http_url(std::string_view url)
+{
+  constexpr auto scheme = "http://"sv;
+
+  if (not url.starts_with(scheme))
+    throw std::runtime_error(
+      std::format("url <{}> isn't an http:// url", url));
+
+  auto rest = url.substr(scheme.size());
+  auto const slash = rest.find('/');
+
+  auto const authority = rest.substr(0, slash);
+  auto path = slash == std::string_view::npos ? ""sv : rest.substr(slash);
+
+  while (path.ends_with('/'))
+    path.remove_suffix(1);
+
+  HttpUrl out{ std::string(authority), "80", std::string(path) };
+
+  if (auto const colon = authority.rfind(':');
+      colon != std::string_view::npos) {
+    out.host = authority.substr(0, colon);
+    out.port = authority.substr(colon + 1);
+  }
+
+  if (out.host.empty() or out.port.empty())
+    throw std::runtime_error(std::format("url <{}> has no host", url));
+
+  return out;
+}
+
+static int
+connect_to(HttpUrl const& url)
+{
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* found = nullptr;
+  if (auto const rc =
+        getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &found);
+      rc != 0)
+    throw std::runtime_error(std::format(
+      "unable to look up <{}>: {}", url.host, gai_strerror(rc)));
+
+  int fd = -1;
+
+  for (auto ai = found; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd == -1)
+      continue;
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(found);
+
+  if (fd == -1)
+    throw std::runtime_error(
+      std::format("unable to connect to <{}:{}>", url.host, url.port));
+
+  // a stalled mirror fails the attempt instead of hanging the build
+  timeval const timeout{ 30, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  return fd;
+}
+
+HttpResponse
+http_get(
+  HttpUrl const& url,
+  std::string_view path,
+  std::uint64_t const from,
+  std::function<void(HttpResponse const&, std::string_view)> const& on_body)
+{
+  Socket const socket(connect_to(url));
+
+  auto request = std::format("GET {}{} HTTP/1.1\r\n"
+                             "Host: {}\r\n"
+                             "Connection: close\r\n",
+                             url.path,
+                             path,
+                             url.host);
+  if (from > 0)
+    request += std::format("Range: bytes={}-\r\n", from);
+  request += "\r\n";
+
+  if (not write_all(socket.fd(), request))
+    throw std::runtime_error(std::format(
+      "unable to send a request to <{}:{}>", url.host, url.port));
+
+  auto head = read_head(socket.fd());
+  if (not head)
+    throw std::runtime_error(std::format(
+      "<{}:{}> closed the connection without a response", url.host, url.port));
+
+  HttpResponse response{ 0, 0, 0 };
+  std::optional<std::uint64_t> length;
+
+  auto const status_line =
+    split_headers(head->first, [&](auto const name, auto const value) {
+      if (header_is(name, "content-length"))
+        length = parse_number(value);
+      else if (header_is(name, "content-range") and
+               value.starts_with("bytes "))
+        response.offset =
+          parse_number(value.substr(6, value.find('-') - 6)).value_or(0);
+      else if (header_is(name, "transfer-encoding"))
+        throw std::runtime_error(std::format(
+          "<{}:{}> sent a body encoded as <{}>", url.host, url.port, value));
+    });
+
+  // "HTTP/1.1 200 OK"
+  auto const code =
+    status_line.substr(std::min<std::size_t>(9, status_line.size()), 3);
+  response.status = int(parse_number(code).value_or(0));
+
+  if (response.status != 206)
+    response.offset = 0;
+
+  // only successful bodies are worth anything to the caller
+  if (response.status < 200 or response.status >= 300)
+    return response;
+
+  auto const deliver = [&](std::string_view chunk) {
+    if (length)
+      chunk = chunk.substr(0, *length - response.received);
+
+    response.received += chunk.size();
+
+    if (not chunk.empty())
+      on_body(response, chunk);
+  };
+
+  deliver(head->second);
+
+  char buf[64_kb];
+
+  while (not length or response.received < *length) {
+    auto const len = read(socket.fd(), buf, sizeof(buf));
+
+    if (len == 0 and not length)
+      break;
+
+    if (len <= 0)
+      throw std::runtime_error(
+        std::format("connection to <{}:{}> {} after {} of {} bytes",
+                    url.host,
+                    url.port,
+                    len == 0 ? "closed" : "failed",
+                    response.received,
+                    *length));
+
+    deliver(std::string_view(buf, len));
+  }
+
+  return response;
+}
+
+std::optional<HttpRequest>
+read_http_request(int const fd)
+{
+  auto head = read_head(fd);
+  if (not head)
+    return std::nullopt;
+
+  HttpRequest out;
+
+  auto const request_line =
+    split_headers(head->first, [&](auto const name, auto const value) {
+      // anything but an open ended range just gets the whole thing
+      if (header_is(name, "range") and value.starts_with("bytes=") and
+          value.ends_with('-'))
+        out.range_start =
+          parse_number(value.substr(6, value.size() - 7));
+    });
+
+  // "GET /path HTTP/1.1"
+  auto const method_end = request_line.find(' ');
+  auto const path_end = request_line.rfind(' ');
+
+  if (method_end == std::string_view::npos or path_end <= method_end)
+    return std::nullopt;
+
+  out.method = request_line.substr(0, method_end);
+
+  auto const path =
+    request_line.substr(method_end + 1, path_end - method_end - 1);
+  out.path = path.substr(0, path.find('?'));
+
+  return out;
+}
+
+static std::string_view
+status_reason(int const status)
+{
+  switch (status) {
+    case 200:
+      return "OK";
+    case 206:
+      return "Partial Content";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 416:
+      return "Range Not Satisfiable";
+    default:
+      return "Internal Server Error";
+  }
+}
+
+void
+write_http_response(int const fd,
+                    HttpRequest const& request,
+                    std::string_view const content_type,
+                    std::string_view const resource)
+{
+  auto const start = request.range_start.value_or(0);
+
+  if (start > 0 and start >= resource.size()) {
+    write_all(fd,
+              std::format("HTTP/1.1 416 {}\r\n"
+                          "Content-Range: bytes */{}\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n\r\n",
+                          status_reason(416),
+                          resource.size()));
+    return;
+  }
+
+  auto const status = start > 0 ? 206 : 200;
+  auto const body = resource.substr(start);
+
+  auto head = std::format("HTTP/1.1 {} {}\r\n"
+                          "Content-Type: {}\r\n"
+                          "Content-Length: {}\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "Connection: close\r\n",
+                          status,
+                          status_reason(status),
+                          content_type,
+                          body.size());
+  if (status == 206)
+    head += std::format("Content-Range: bytes {}-{}/{}\r\n",
+                        start,
+                        resource.size() - 1,
+                        resource.size());
+  head += "\r\n";
+
+  if (write_all(fd, head) and request.method != "HEAD")
+    write_all(fd, body);
+}
+
+void
+write_http_error(int const fd, int const status)
+{
+  write_all(fd,
+            std::format("HTTP/1.1 {} {}\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n\r\n",
+                        status,
+                        status_reason(status)));
+}
@@ -2,18 +2,29 @@
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <future>
 #include <jayson.hh>
+#include <optional>
 #include <ostream>
 #include <scl.hh>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <unistd.h>
 #include <vector>
 
 #include "analysis.hh"
+#include "build_cache.hh"
 #include "common.hh"
 #include "confs.hh"
 #include "install.hh"
+#include "link.hh"
+#include "package_index.hh"
 #include "packages.hh"
 #include "paths.hh"
+#include "prebuilt.hh"
+#include "store.hh"
+#include "thread_pool.hh"
 
 /*
 
@@ -39,35 +50,10 @@ ensure_user_hewg_directory()
   return user_hewg_directory;
 }
 
-static jayson::val
-skel_manifest(std::string_view package_name)
-{
-  jayson::obj obj;
-  obj.insert_or_assign("name", jayson::val(std::string(package_name)));
-  obj.insert_or_assign("versions", jayson::array{});
-  return obj;
-}
-
-static void
-ensure_package(std::string_view package_name)
-{
-  auto const package_dir = hewg_packages_directory / package_name;
-
-  std::filesystem::create_directories(package_dir);
-
-  if (not std::filesystem::exists(package_dir / "manifest.json")) {
-    std::ofstream(package_dir / "manifest.json")
-      << skel_manifest(package_name).serialize(false);
-  }
-}
-
 static void
 select_executable(std::string_view name, version_triplet const trip)
 {
-  VersionManifest manifest = open_version_manifest(name);
-
-  auto const version = std::ranges::find(manifest.versions, trip);
-  if (version == manifest.versions.end())
+  if (not PackageIndex().contains(name, trip))
     throw std::runtime_error(
       std::format("unable to select executable version {} for package {}, as "
                   "it is not available",
@@ -78,100 +64,209 @@ select_executable(std::string_view name, version_triplet const trip)
     hewg_packages_directory / name / version_triplet_to_string(trip);
   auto const exec_path = package_dir / name;
 
-  if (std::filesystem::exists(hewg_bin_directory / name)) {
-    if (not std::filesystem::is_symlink(hewg_bin_directory / name))
-      throw std::runtime_error(
-        std::format("{} exists, but isn't a symlink??? try deleting it.",
-                    (hewg_bin_directory / name).string()));
+  auto const link_path = hewg_bin_directory / name;
 
-    threadsafe_print(std::format("deleting symlink {}...\n",
-                                 (hewg_bin_directory / name).string()));
-    do_terminal_countdown(3);
+  if (std::filesystem::is_symlink(link_path)) {
+    if (std::filesystem::read_symlink(link_path) == exec_path)
+      return;
+  } else if (std::filesystem::exists(link_path))
+    throw std::runtime_error(
+      std::format("{} exists, but isn't a symlink??? try deleting it.",
+                  link_path.string()));
 
-    std::filesystem::remove(hewg_bin_directory / name);
-  }
+  // renamed over the old one, so there's never a moment
+  // where the executable isn't there
+  auto const temporary =
+    hewg_bin_directory / std::format(".{}.tmp-{}", name, getpid());
 
-  std::filesystem::create_symlink(exec_path, hewg_bin_directory / name);
+  std::filesystem::remove(temporary);
+  std::filesystem::create_symlink(exec_path, temporary);
+  std::filesystem::rename(temporary, link_path);
+
+  threadsafe_print(std::format("{} now points to {}\n",
+                               link_path.string(),
+                               version_triplet_to_string(trip)));
 }
 
+struct InstalledFile
+{
+  std::filesystem::path source;
+
+  // relative to the version directory
+  std::filesystem::path relative;
+};
+
 static void
 install_executable(ConfigurationFile const& config,
                    std::string_view profile,
-                   std::filesystem::path const& install_dir)
+                   std::vector<InstalledFile>& files)
 {
   auto const executable_name = config.project.name;
   auto const executable_path =
     get_target_folder_for_build_profile(profile) / executable_name;
 
-  std::filesystem::copy_file(executable_path,
-                             install_dir / executable_name,
-                             std::filesystem::copy_options::update_existing);
+  files.emplace_back(executable_path, executable_name);
+}
 
-  select_executable(executable_name, config.project.version);
+// every regular file under directory, added under relative
+static void
+install_directory(std::filesystem::path const& directory,
+                  std::filesystem::path const& relative,
+                  std::vector<InstalledFile>& files)
+{
+  if (not std::filesystem::is_directory(directory))
+    return;
+
+  for (auto const& entry :
+       std::filesystem::recursive_directory_iterator(directory))
+    if (entry.is_regular_file())
+      files.emplace_back(entry.path(),
+                         relative / entry.path().lexically_relative(directory));
 }
 
 static void
 install_headers(ConfigurationFile const& config,
                 std::string_view,
-                std::filesystem::path const& install_dir)
+                std::vector<InstalledFile>& files)
 {
-  auto const include_header_dir = install_dir / "include" / config.project.name;
-  std::filesystem::create_directories(install_dir / "include");
-  std::filesystem::copy(hewg_public_header_directory_path,
-                        include_header_dir,
-                        std::filesystem::copy_options::recursive |
-                          std::filesystem::copy_options::update_existing);
+  install_directory(hewg_public_header_directory_path,
+                    std::filesystem::path("include") / config.project.name,
+                    files);
+}
+
+// what a project needs to build the library itself,
+// when none of the prebuilt archives were built like it
+static void
+install_sources(std::vector<InstalledFile>& files)
+{
+  auto const source = std::filesystem::path("source");
+
+  files.emplace_back(hewg_config_path, source / "hewg.scl");
+
+  for (std::filesystem::path const directory :
+       { hewg_cxx_src_directory_path,
+         hewg_c_src_directory_path,
+         hewg_public_header_directory_path,
+         hewg_private_header_directory_path,
+         hewg_hook_path })
+    install_directory(directory, source / directory.filename(), files);
 }
 
 static void
 install_library(ConfigurationFile const& config,
                 std::string_view profile,
-                std::filesystem::path const& install_dir)
+                std::vector<InstalledFile>& files)
 {
-  install_headers(config, profile, install_dir);
-
-  auto const lib_filename = static_library_name_for_project(config, false);
-  auto const lib_pie_filename = static_library_name_for_project(config, true);
+  install_headers(config, profile, files);
+  install_sources(files);
+
+  auto const tools = get_tool_file(config, profile);
+  auto const target = get_target_folder_for_build_profile(profile);
+
+  // the target archives are thin, the real ones are kept
+  // up to date in the cache and stored from there
+  auto const install_cache = hewg_cache_path / "install";
+  create_directory_checked(install_cache);
+  BuildCache build_cache(install_cache);
+
+  auto const materialize = [&](bool const PIC) {
+    auto const filename = static_library_name_for_project(config, PIC);
+    materialize_static_library(
+      tools, build_cache, target / filename, install_cache / filename);
+    return install_cache / filename;
+  };
+
+  // both archives hold the same objects,
+  // so they end up as the same blob
+  auto const pic = materialize(true);
+  auto const plain = config.meta.pic_only ? pic : materialize(false);
+
+  files.emplace_back(pic, static_library_name_for_project(config, true));
+  files.emplace_back(plain, static_library_name_for_project(config, false));
+
+  // the same archives again, under the key they were
+  // built with, for dependents to link without building
+  for (auto const& [filename, key] : read_built_artifacts(target)) {
+    auto const digest = digest_artifact_key(key);
+    auto const key_path = install_cache / std::format("{}.json", digest);
+
+    std::ofstream(key_path) << jayson::serialize(key).serialize();
+
+    files.emplace_back(key.pic ? pic : plain,
+                       std::filesystem::path("prebuilt") / digest / filename);
+    files.emplace_back(key_path,
+                       std::filesystem::path("prebuilt") / digest / "key.json");
+  }
 
-  std::filesystem::copy(get_target_folder_for_build_profile(profile) /
-                          lib_filename,
-                        install_dir / lib_filename,
-                        std::filesystem::copy_options::update_existing);
+  build_cache.write();
+}
 
-  std::filesystem::copy(get_target_folder_for_build_profile(profile) /
-                          lib_pie_filename,
-                        install_dir / lib_pie_filename,
-                        std::filesystem::copy_options::update_existing);
+// adds every file on the pool, hashing and copying them is
+// most of an install. the store takes them from any thread
+static void
+store_files(ThreadPool& threads,
+            StoreWriter& store,
+            std::span<InstalledFile const> files)
+{
+  std::vector<std::future<std::optional<std::string>>> pending;
+
+  for (auto const& file : files)
+    pending.push_back(
+      threads.add_job([&store, &file]() -> std::optional<std::string> {
+        try {
+          store.add(file.source, file.relative);
+          return std::nullopt;
+        } catch (std::exception const& e) {
+          return std::format(
+            "unable to install <{}>: {}", file.source.string(), e.what());
+        }
+      }));
+
+  std::size_t failed = 0;
+
+  for (auto& job : pending)
+    if (auto const error = job.get()) {
+      threadsafe_print(*error, '\n');
+      failed++;
+    }
+
+  if (failed > 0)
+    throw std::runtime_error(
+      std::format("{} file(s) couldn't be installed", failed));
 }
 
 void
-install(ConfigurationFile const& config,
+install(ThreadPool& threads,
+        ConfigurationFile const& config,
         InstallOptions const&,
         std::string_view profile)
 {
   ensure_user_hewg_directory();
-  ensure_package(config.project.name);
   auto const install_directory =
     add_version_to_package(config.project.name, config.project.version);
 
   {
     auto const info_path = install_directory / "info.scl";
 
-    // we want just the meta & project information
+    // we want just the meta & project information,
+    // and what it depends on for resolving dependents
     scl::file file;
     scl::serialize(config.meta, file, "hewg");
     scl::serialize(config.project, file, "project");
+    scl::serialize(config.internal_deps, file, "internal");
 
     std::ofstream(info_path) << file.serialize();
   }
 
+  std::vector<InstalledFile> files;
+
   switch (config.meta.type) {
     case ProjectType::Executable:
-      install_executable(config, profile, install_directory);
+      install_executable(config, profile, files);
       break;
 
     case ProjectType::StaticLibrary:
-      install_library(config, profile, install_directory);
+      install_library(config, profile, files);
       break;
 
     case ProjectType::SharedLibrary:
@@ -180,7 +275,27 @@ install(ConfigurationFile const& config,
       break;
 
     case ProjectType::Headers:
-      install_headers(config, profile, install_directory);
+      install_headers(config, profile, files);
       break;
   }
+
+  StoreWriter store(install_directory);
+  store_files(threads, store, files);
+  auto const [updated, removed] = store.finish();
+
+  threadsafe_print(
+    std::format("installed <{}> {}, {} of {} file(s) changed, {} removed\n",
+                config.project.name,
+                version_triplet_to_string(config.project.version),
+                updated,
+                files.size(),
+                removed));
+
+  index_package_version(
+    config.project.name,
+    IndexedVersion{
+      config.project.version, config.meta.type, config.internal_deps });
+
+  if (config.meta.type == ProjectType::Executable)
+    select_executable(config.project.name, config.project.version);
 }
@@ -1,12 +1,30 @@
 
+#include <ranges>
+#include <set>
+
+#include "analysis.hh"
+#include "build_cache.hh"
 #include "cmdline.hh"
 #include "common.hh"
+#include "compile.hh"
 #include "confs.hh"
+#include "digest.hh"
+#include "link.hh"
+#include "paths.hh"
+#include "pgo.hh"
+#include "toolchain.hh"
+
+// bfd can't build a gdb index, everything else can
+static bool
+linker_supports_gdb_index(ToolFile const& tools)
+{
+  return tools.ld != "ld" and tools.ld != "bfd";
+}
 
 static auto
-generate_link_flags(ConfigurationFile const&,
+generate_link_flags(ConfigurationFile const& config,
                     ToolFile const& tools,
-                    bool const,
+                    bool const is_release,
                     std::span<std::filesystem::path const> object_files,
                     std::filesystem::path const output_filepath)
 {
@@ -14,7 +32,7 @@ generate_link_flags(ConfigurationFile const&,
 
   args.insert(args.end(), object_files.begin(), object_files.end());
   std::ranges::transform(args, args.begin(), [](auto const& file) {
-    return std::filesystem::relative(file);
+    return project_relative(file);
   });
 
   args.push_back("-o");
@@ -23,64 +41,298 @@ generate_link_flags(ConfigurationFile const&,
   if (tools.ld != "ld")
     args.push_back(std::format("-fuse-ld={}", tools.ld));
 
-  // if (is_release)
-  //   args.push_back("-flto");
+  append_vec(args, lto_flags(config, tools.cxx, is_release));
+
+  // with split dwarf, gdb would otherwise have to open
+  // every .dwo just to start up
+  if (uses_split_dwarf(config, is_release) and linker_supports_gdb_index(tools))
+    args.push_back("-Wl,--gdb-index");
 
   // TODO: add options for libraries
 
   return args;
 }
 
-// TODO: link libraries from packages
-// this requires dependency resolvement...
+// package archives come first, so their own
+// native libraries are found after them
 static auto
 get_library_flags(ConfigurationFile const& config,
-                  bool const ignore_static_libraries)
+                  std::span<std::filesystem::path const> package_archives)
 {
-  (void)ignore_static_libraries;
-
   std::vector<std::string> args;
+
+  for (auto const& archive : package_archives)
+    args.push_back(archive.string());
+
   args.push_back("-L/usr/local/lib");
 
   for (auto const& native_library : config.libs.native)
     args.push_back(std::format("-l{}", native_library));
 
-  // for (auto const& packaged_library : config.libs.packages) {
-  //   (void)packaged_library;
-  // }
-
   return args;
 }
 
-void
+// describes everything that should cause a relink
+// when changed, besides the contents of the inputs
+static std::vector<std::string>
+describe_link_step(ConfigurationFile const& config,
+                   std::string const& tool,
+                   std::span<std::string const> args)
+{
+  std::vector<std::string> out;
+  out.push_back(tool);
+
+  // the version is baked into the hewgsym object,
+  // which is only looked at when a link actually happens
+  out.push_back(version_triplet_to_string(config.project.version));
+
+  append_vec(out, args);
+  return out;
+}
+
+// runs step() unless output is already up to date
+// returns true if step() ran
+static bool
+run_link_step(BuildCache& build_cache,
+              std::filesystem::path const& output,
+              std::span<std::string const> description,
+              std::span<std::filesystem::path const> inputs,
+              auto step)
+{
+  if (build_cache.link_up_to_date(output, description, inputs)) {
+    threadsafe_print(std::format("<{}> is up to date\n",
+                                 project_relative(output).string()));
+    return false;
+  }
+
+  // pending until the step succeeds, so whatever a failed
+  // step leaves behind is never taken as up to date
+  build_cache.forget_link(output);
+  build_cache.write();
+
+  step();
+
+  build_cache.record_link(output, description, inputs);
+  return true;
+}
+
+static void
+run_command_checked(std::string const& what,
+                    std::string const& tool,
+                    std::span<std::string const> args)
+{
+  auto const [exit_code, _] = run_command(tool, args);
+
+  if (exit_code != 0)
+    throw std::runtime_error(
+      std::format("{} failed with exit code <{}>", what, exit_code));
+}
+
+std::optional<LayoutConf>
+get_layout_conf(BuildOptions const& options)
+{
+  if (not options.layout_profile)
+    return std::nullopt;
+
+  std::filesystem::path const profile = *options.layout_profile;
+
+  if (not std::filesystem::exists(profile))
+    throw std::runtime_error(
+      std::format("layout profile <{}> doesn't exist", profile.string()));
+
+  auto const extension = profile.extension();
+
+  if (extension == ".fdata" or extension == ".data")
+    return LayoutConf{ LayoutMethod::Bolt, profile };
+
+  if (extension == ".order" or extension == ".txt")
+    return LayoutConf{ LayoutMethod::SymbolOrdering, profile };
+
+  throw std::runtime_error(
+    std::format("layout profile <{}> must be a perf .data, bolt .fdata, or a "
+                "symbol ordering .order/.txt file",
+                profile.string()));
+}
+
+// runs bolt on input, writing the optimized binary to output.
+// results are kept per input & profile, so going back
+// to an older binary or profile doesn't rerun bolt
+static bool
+optimize_layout(ConfigurationFile const& config,
+                ToolFile const& tools,
+                BuildCache& build_cache,
+                LayoutConf const& layout,
+                bool const strip,
+                std::filesystem::path const& input,
+                std::filesystem::path const& output)
+{
+  auto const bolt = tools.bolt.value_or("llvm-bolt");
+
+  std::vector<std::string> args = {
+    "-reorder-blocks=ext-tsp", "-reorder-functions=hfsort",
+    "-split-functions",        "-split-all-cold",
+    "-icf=1",                  "-use-gnu-stack",
+  };
+
+  // .fdata is already aggregated, perf.data gets aggregated by bolt
+  args.push_back(layout.profile.extension() == ".fdata" ? "-data" : "-p");
+  args.push_back(project_relative(layout.profile));
+
+  auto description = describe_link_step(config, bolt, args);
+  if (strip)
+    description.push_back("strip -s");
+
+  // the linked binary is rewritten whenever it's relinked,
+  // and the profile whenever it's recorded again
+  std::array const inputs{ input, layout.profile };
+  build_cache.restat_files(inputs);
+
+  return run_link_step(build_cache, output, description, inputs, [&] {
+    Digest key;
+    key.update(digest_file(input)).update(digest_file(layout.profile));
+    for (auto const& part : description)
+      key.update(part).update(std::string_view("\0", 1));
+
+    auto const layout_cache = build_cache.cache_folder() / "layout";
+    auto const cached = layout_cache / key.finish();
+
+    if (std::filesystem::exists(cached)) {
+      threadsafe_print("reusing previously optimized layout...\n");
+    } else {
+      threadsafe_print("optimizing layout...\n");
+
+      auto const partial = std::filesystem::path(cached).concat(".partial");
+
+      std::vector<std::string> bolt_args;
+      bolt_args.push_back(project_relative(input));
+      bolt_args.push_back("-o");
+      bolt_args.push_back(project_relative(partial));
+      append_vec(bolt_args, args);
+
+      run_command_checked("optimizing layout", bolt, bolt_args);
+
+      if (strip)
+        run_command_checked("stripping",
+                            "strip",
+                            make_array<std::string>("-s", partial.string()));
+
+      std::filesystem::rename(partial, cached);
+    }
+
+    std::filesystem::remove(output);
+    std::filesystem::copy_file(cached, output);
+  });
+}
+
+bool
 link_executable(ConfigurationFile const& config,
                 ToolFile const& tools,
                 BuildOptions const& options,
+                BuildCache& build_cache,
+                unsigned const jobs,
+                std::optional<PGOConf> const& pgo,
+                std::optional<LayoutConf> const& layout,
                 std::span<std::filesystem::path const> object_files,
+                std::span<std::filesystem::path const> package_archives,
                 std::filesystem::path output_directory)
 {
   if (not std::filesystem::is_directory(output_directory))
     throw std::runtime_error("output_directory in link() isn't a directory");
 
-  auto const output_filepath = output_directory / config.project.name;
+  bool const bolt = layout and layout->method == LayoutMethod::Bolt;
+
+  // bolt wants the plain linked binary as its input,
+  // the optimized one is what ends up in the output directory
+  auto const final_filepath = output_directory / config.project.name;
+  auto const output_filepath =
+    bolt ? build_cache.cache_folder() / "layout" / config.project.name
+         : final_filepath;
+
+  if (bolt)
+    std::filesystem::create_directories(output_filepath.parent_path());
 
   auto args = generate_link_flags(
     config, tools, options.release, object_files, output_filepath);
-  threadsafe_print("now lets get linking...\n");
-  append_vec(args, get_library_flags(config, false));
+  append_vec(args, get_library_flags(config, package_archives));
+  if (pgo)
+    append_vec(args, pgo_flags(tools.cxx, *pgo, build_cache.cache_folder()));
+
+  std::vector<std::filesystem::path> inputs(object_files.begin(),
+                                            object_files.end());
+  inputs.insert(inputs.end(), package_archives.begin(), package_archives.end());
+
+  // reinstalling the same version, or rebuilding a package from
+  // source, rewrites its archive in place
+  build_cache.restat_files(package_archives);
+
+  if (bolt) {
+    // keeps the relocations bolt needs to move functions around
+    args.push_back("-Wl,--emit-relocs");
+  } else if (layout) {
+    if (tools.ld != "lld")
+      throw std::runtime_error(
+        "linking with a symbol ordering file needs the lld linker");
 
-  run_command(tools.cxx, args);
+    auto const order_file = project_relative(layout->profile);
+    args.push_back(
+      std::format("-Wl,--symbol-ordering-file={}", order_file.string()));
+    inputs.push_back(layout->profile);
 
-  // we also want to strip the executable if we're
-  // creating a release executable
-  if (options.release) {
-    run_command("strip", "-s", output_filepath.string());
+    // rewritten in place whenever it's recorded again
+    build_cache.restat_files(std::span(&layout->profile, 1));
   }
+
+  bool const strip = get_build_type_conf(config, options.release)
+                       .strip.value_or(options.release);
+
+  // stripping a binary before bolt would throw away its symbols
+  bool const strip_after_link = strip and not bolt;
+
+  auto description = describe_link_step(config, tools.cxx, args);
+  if (strip_after_link)
+    description.push_back("strip -s");
+
+  bool const linked = run_link_step(
+    build_cache, output_filepath, description, inputs, [&] {
+      threadsafe_print("now lets get linking...\n");
+
+      args.push_back(project_relative(
+        compile_hewgsym(config, tools, false, options.release)));
+      append_vec(args, hewgsym_link_flags(config, options.release));
+      append_vec(args,
+                 lto_parallel_flags(config,
+                                    tools,
+                                    options.release,
+                                    jobs,
+                                    build_cache.cache_folder()));
+
+      run_command_checked("linking", tools.cxx, args);
+
+      // release executables are stripped by default
+      if (strip_after_link)
+        run_command_checked(
+          "stripping",
+          "strip",
+          make_array<std::string>("-s", output_filepath.string()));
+    });
+
+  if (not bolt)
+    return linked;
+
+  return optimize_layout(config,
+                         tools,
+                         build_cache,
+                         *layout,
+                         strip,
+                         output_filepath,
+                         final_filepath) or
+         linked;
 }
 
-void
+bool
 pack_static_library(ConfigurationFile const& config,
                     ToolFile const& tools,
+                    BuildCache& build_cache,
                     std::span<std::filesystem::path const> object_files,
                     std::filesystem::path output_directory,
                     bool const PIC)
@@ -90,21 +342,170 @@ pack_static_library(ConfigurationFile const& config,
       "output_directory in pack_static_library() isn't a directory");
 
   std::filesystem::path const outfile =
-    (PIC ? output_directory / std::format("lib{}.a", config.project.name)
-         : output_directory / std::format("PIClib{}.a", config.project.name));
+    output_directory / static_library_name_for_project(config, PIC);
 
+  // a thin archive only references the objects,
+  // nothing gets copied until it's installed
   std::vector<std::string> commands;
-  commands.push_back("rcs");
+  commands.push_back("rcsT");
   commands.push_back(outfile.string());
   for (auto const& objects : object_files)
-    commands.push_back(objects.string());
-  run_command(tools.ar, commands);
+    commands.push_back(project_relative(objects).string());
+
+  auto const description = describe_link_step(config, tools.ar, commands);
+
+  return run_link_step(build_cache, outfile, description, object_files, [&] {
+    // ar only ever adds to an existing archive,
+    // start fresh so removed sources don't linger
+    std::filesystem::remove(outfile);
+    run_command_checked("archiving", tools.ar, commands);
+  });
+}
+
+static std::vector<std::filesystem::path>
+thin_archive_members(ToolFile const& tools,
+                     std::filesystem::path const& thin_archive)
+{
+  auto const [exit_code, listing] =
+    run_command(tools.ar, "t", thin_archive.string());
+
+  if (exit_code != 0)
+    throw std::runtime_error(std::format(
+      "unable to list the members of <{}>", thin_archive.string()));
+
+  // members are listed relative to where we are
+  std::vector<std::filesystem::path> out;
+  for (auto const line : std::views::split(listing, '\n'))
+    if (not line.empty())
+      out.emplace_back(std::string(line.begin(), line.end()));
+
+  return out;
+}
+
+// ar matches members by their file name alone,
+// so replacing just one of two "util.o"s isn't possible
+static bool
+member_names_unique(std::span<std::filesystem::path const> members)
+{
+  std::set<std::filesystem::path> names;
+
+  for (auto const& member : members)
+    if (not names.insert(member.filename()).second)
+      return false;
+
+  return true;
+}
+
+bool
+materialize_static_library(ToolFile const& tools,
+                           BuildCache& build_cache,
+                           std::filesystem::path const& thin_archive,
+                           std::filesystem::path const& output)
+{
+  auto const members = thin_archive_members(tools, thin_archive);
+
+  std::vector<ObjectDigest> digests;
+  for (auto const& member : members)
+    digests.push_back(ObjectDigest{ member.string(), digest_file(member) });
+
+  auto const previous = build_cache.archive_members(output);
+
+  if (previous and *previous == digests)
+    return false;
+
+  auto const write_whole_archive = [&] {
+    std::filesystem::remove(output);
+
+    std::vector<std::string> args;
+    args.push_back("rcs");
+    args.push_back(output.string());
+    for (auto const& member : members)
+      args.push_back(member.string());
+
+    run_command_checked("archiving", tools.ar, args);
+  };
+
+  if (not previous or not member_names_unique(members)) {
+    write_whole_archive();
+    build_cache.record_archive(output, std::move(digests));
+    return true;
+  }
+
+  std::vector<std::filesystem::path> previous_members;
+  for (auto const& member : *previous)
+    previous_members.push_back(member.object);
+
+  if (not member_names_unique(previous_members)) {
+    write_whole_archive();
+    build_cache.record_archive(output, std::move(digests));
+    return true;
+  }
+
+  std::vector<std::string> removed, changed;
+
+  for (auto const& member : *previous)
+    if (std::ranges::find(digests, member.object, &ObjectDigest::object) ==
+        digests.end())
+      removed.push_back(
+        std::filesystem::path(member.object).filename().string());
+
+  for (auto const& member : digests)
+    if (std::ranges::find(*previous, member) == previous->end())
+      changed.push_back(member.object);
+
+  if (not removed.empty())
+    run_command_checked("archiving",
+                        tools.ar,
+                        std::vector<std::string>{ "d", output.string() } +
+                          removed);
+
+  // s rebuilds the symbol index, which the delete left stale
+  run_command_checked("archiving",
+                      tools.ar,
+                      std::vector<std::string>{ "rs", output.string() } +
+                        changed);
+
+  threadsafe_print_verbose(
+    std::format("replaced {} and removed {} member(s) of <{}>\n",
+                changed.size(),
+                removed.size(),
+                output.string()));
+
+  build_cache.record_archive(output, std::move(digests));
+  return true;
 }
 
 void
+link_static_library_variants(ConfigurationFile const& config,
+                             std::filesystem::path const& directory)
+{
+  auto const pic = directory / static_library_name_for_project(config, true);
+  auto const non_pic =
+    directory / static_library_name_for_project(config, false);
+
+  // the archive is repacked into a new file,
+  // so an old link would still point at the previous one
+  if (std::filesystem::exists(non_pic) and
+      std::filesystem::equivalent(pic, non_pic))
+    return;
+
+  std::filesystem::remove(non_pic);
+
+  std::error_code ec;
+  std::filesystem::create_hard_link(pic, non_pic, ec);
+
+  // e.g. a filesystem without hardlinks
+  if (ec)
+    std::filesystem::copy_file(pic, non_pic);
+}
+
+bool
 shared_link(ConfigurationFile const& config,
             ToolFile const& tools,
             BuildOptions const& options,
+            BuildCache& build_cache,
+            unsigned const jobs,
+            std::optional<PGOConf> const& pgo,
             std::span<std::filesystem::path const> object_files,
             std::filesystem::path output_directory)
 {
@@ -121,9 +522,62 @@ shared_link(ConfigurationFile const& config,
   // ignore static libraries here
   // and defer their linking by adding them to the
   // descriptor of the package file
-  append_vec(args, get_library_flags(config, true));
+  append_vec(args, get_library_flags(config, {}));
 
   args.push_back("-shared");
 
-  run_command(tools.cxx, args);
+  if (pgo)
+    append_vec(args, pgo_flags(tools.cxx, *pgo, build_cache.cache_folder()));
+
+  auto const description = describe_link_step(config, tools.cxx, args);
+
+  return run_link_step(build_cache, outfile, description, object_files, [&] {
+    args.push_back(project_relative(
+      compile_hewgsym(config, tools, true, options.release)));
+    append_vec(args, hewgsym_link_flags(config, options.release));
+    append_vec(args,
+               lto_parallel_flags(config,
+                                  tools,
+                                  options.release,
+                                  jobs,
+                                  build_cache.cache_folder()));
+
+    run_command_checked("linking", tools.cxx, args);
+  });
+}
+
+bool
+package_dwarf(ConfigurationFile const& config,
+              ToolFile const& tools,
+              BuildOptions const& options,
+              BuildCache& build_cache,
+              std::span<std::filesystem::path const> object_files,
+              std::filesystem::path output_directory)
+{
+  if (not uses_split_dwarf(config, options.release) or
+      not config.debug.dwp.value_or(false))
+    return false;
+
+  auto const linked_name = config.meta.type == ProjectType::SharedLibrary
+                             ? std::format("lib{}.so", config.project.name)
+                             : config.project.name;
+  auto const outfile = output_directory / (linked_name + ".dwp");
+  auto const dwp = tools.dwp.value_or("dwp");
+
+  std::vector<std::filesystem::path> dwo_files;
+  for (auto const& object : object_files)
+    dwo_files.push_back(dwo_file_for_object(object));
+
+  std::vector<std::string> args;
+  args.push_back("-o");
+  args.push_back(project_relative(outfile));
+  for (auto const& dwo : dwo_files)
+    args.push_back(project_relative(dwo));
+
+  auto const description = describe_link_step(config, dwp, args);
+
+  return run_link_step(build_cache, outfile, description, dwo_files, [&] {
+    threadsafe_print("packaging debug info...\n");
+    run_command_checked("packaging debug info", dwp, args);
+  });
 }
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <jayson.hh>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.hh"
+#include "confs.hh"
+#include "digest.hh"
+#include "fetch.hh"
+#include "lock.hh"
+#include "packages.hh"
+#include "paths.hh"
+#include "resolve.hh"
+#include "thread_pool.hh"
+
+static std::string
+digest_requirements(std::span<Dependency const> requirements)
+{
+  Digest digest;
+
+  for (auto const& [name, version, exact] : requirements) {
+    digest.update(name).update(std::string_view("\0", 1));
+    digest.update(version_triplet_to_string(version));
+    digest.update(exact ? "=" : "^").update(std::string_view("\0", 1));
+  }
+
+  return digest.finish();
+}
+
+std::string
+digest_package(std::string_view name, version_triplet const version)
+{
+  auto const directory =
+    hewg_packages_directory / name / version_triplet_to_string(version);
+
+  std::vector<std::filesystem::path> files;
+  for (auto const& entry :
+       std::filesystem::recursive_directory_iterator(directory))
+    if (entry.is_regular_file())
+      files.push_back(entry.path());
+
+  // directory order isn't stable
+  std::ranges::sort(files);
+
+  Digest digest;
+  for (auto const& file : files) {
+    digest.update(std::filesystem::relative(file, directory).string());
+    digest.update(std::string_view("\0", 1));
+    digest.update(digest_file(file)).update(std::string_view("\0", 1));
+  }
+
+  return digest.finish();
+}
+
+static std::optional<LockFile>
+read_lock_file()
+{
+  if (not std::filesystem::exists(hewg_lock_path))
+    return std::nullopt;
+
+  // a lockfile from an older hewg just means resolving again
+  try {
+    LockFile out;
+    jayson::deserialize(jayson::val::parse(read_file(hewg_lock_path)), out);
+    return out;
+  } catch (std::exception const&) {
+    threadsafe_print_verbose("ignoring unreadable hewg.lock\n");
+    return std::nullopt;
+  }
+}
+
+static LockFile
+write_lock_file(ConfigurationFile const& config,
+                std::vector<ResolvedPackage> resolved)
+{
+  LockFile out;
+  out.requirements = digest_requirements(config.internal_deps);
+
+  for (auto& package : resolved)
+    out.packages.push_back(LockedPackage{
+      package.name,
+      package.version,
+      digest_package(package.name, package.version),
+      std::move(package.dependencies),
+    });
+
+  std::ofstream(hewg_lock_path.get()) << jayson::serialize(out).serialize();
+
+  return out;
+}
+
+// resolves against the mirror when there's one and a pool
+// to fetch on, fetching whatever was picked that isn't installed
+static LockFile
+resolve_lock_file(ThreadPool* threads, ConfigurationFile const& config)
+{
+  auto const mirror_url = package_mirror_url();
+
+  if (not mirror_url or threads == nullptr) {
+    InstalledPackages installed;
+    return write_lock_file(
+      config, resolve_dependencies(installed, config.internal_deps));
+  }
+
+  PackageMirror mirror(*mirror_url);
+  auto resolved = resolve_dependencies(mirror, config.internal_deps);
+
+  std::vector<std::pair<std::string, version_triplet>> picked;
+  for (auto const& package : resolved)
+    picked.emplace_back(package.name, package.version);
+
+  // they have to be installed to be digested
+  mirror.fetch(*threads, picked);
+
+  return write_lock_file(config, std::move(resolved));
+}
+
+// the lock still describes what's installed,
+// only checks what can be checked without hashing
+static bool
+lock_is_current(ConfigurationFile const& config, LockFile const& lock)
+{
+  if (lock.requirements != digest_requirements(config.internal_deps))
+    return false;
+
+  return std::ranges::all_of(lock.packages, [](auto const& package) {
+    return std::filesystem::exists(hewg_packages_directory / package.name /
+                                   version_triplet_to_string(package.version));
+  });
+}
+
+std::vector<LockedPackage>
+get_locked_packages(ConfigurationFile const& config)
+{
+  if (config.internal_deps.empty())
+    return {};
+
+  if (auto lock = read_lock_file();
+      lock and lock_is_current(config, *lock))
+    return std::move(lock->packages);
+
+  threadsafe_print("dependencies changed, resolving them again\n");
+  return resolve_lock_file(nullptr, config).packages;
+}
+
+void
+fetch_locked_packages(ThreadPool& threads, ConfigurationFile const& config)
+{
+  auto const mirror_url = package_mirror_url();
+  if (config.internal_deps.empty() or not mirror_url)
+    return;
+
+  auto const lock = read_lock_file();
+
+  if (not lock or
+      lock->requirements != digest_requirements(config.internal_deps)) {
+    threadsafe_print("dependencies changed, resolving them again\n");
+    resolve_lock_file(&threads, config);
+    return;
+  }
+
+  std::vector<std::pair<std::string, version_triplet>> missing;
+  for (auto const& package : lock->packages)
+    if (not std::filesystem::exists(hewg_packages_directory / package.name /
+                                    version_triplet_to_string(package.version)))
+      missing.emplace_back(package.name, package.version);
+
+  if (missing.empty())
+    return;
+
+  PackageMirror mirror(*mirror_url);
+  mirror.fetch(threads, missing);
+
+  // the mirror's digest only says the download wasn't damaged,
+  // this says it's what the project was locked against
+  for (auto const& [name, version] : missing) {
+    auto const locked =
+      std::ranges::find(lock->packages, name, &LockedPackage::name);
+
+    if (digest_package(name, version) != locked->digest)
+      throw std::runtime_error(
+        std::format("package <{}> {} from the mirror doesn't match hewg.lock, "
+                    "run hewg update if that's expected",
+                    name,
+                    version_triplet_to_string(version)));
+  }
+}
+
+void
+update_lock_file(ThreadPool& threads, ConfigurationFile const& config)
+{
+  auto const previous = read_lock_file().value_or(LockFile{});
+  auto const updated = resolve_lock_file(&threads, config);
+
+  for (auto const& package : updated.packages) {
+    auto const version = version_triplet_to_string(package.version);
+    auto const old = std::ranges::find(
+      previous.packages, package.name, &LockedPackage::name);
+
+    if (old == previous.packages.end())
+      threadsafe_print(std::format("locked <{}> {}\n", package.name, version));
+    else if (old->version != package.version)
+      threadsafe_print(std::format("updated <{}> {} -> {}\n",
+                                   package.name,
+                                   version_triplet_to_string(old->version),
+                                   version));
+    else if (old->digest != package.digest)
+      threadsafe_print(std::format(
+        "<{}> {} changed since it was locked\n", package.name, version));
+  }
+
+  for (auto const& package : previous.packages)
+    if (std::ranges::find(updated.packages,
+                          package.name,
+                          &LockedPackage::name) == updated.packages.end())
+      threadsafe_print(std::format("removed <{}>\n", package.name));
+}
@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <terse.hh>
+#include <thread>
 #include <unistd.h>
 #include <utility>
 #include <variant>
@@ -27,8 +28,17 @@
 #include "confs.hh"
 #include "init.hh"
 #include "install.hh"
+#include "lock.hh"
+#include "pack.hh"
+#include "package_index.hh"
+#include "package_server.hh"
 #include "paths.hh"
+#include "server.hh"
+#include "store.hh"
 #include "thread_pool.hh"
+#include "trash.hh"
+#include "watch.hh"
+#include "workspace.hh"
 
 /* generated by c++gen */
 
@@ -49,27 +59,47 @@ get_build_profile(std::span<std::string const> bares)
 }
 
 static void
-clean(ThreadPool&,
-      ConfigurationFile const&,
-      CleanOptions const&,
+clean(ThreadPool& threads,
+      CleanOptions const& options,
       std::span<std::string const> bares)
 {
-  if (bares.size() > 0)
+  if (bares.empty() and (options.release or options.pic))
     throw std::runtime_error(
-      "clean subcommand does not take any bare arguments!");
+      "--release and --pic only apply when cleaning a build profile!");
 
-  if (not std::filesystem::exists(hewg_cache_path))
+  if (not std::filesystem::exists(hewg_cache_path)) {
+    threadsafe_print("nothing to clean!\n");
     return;
+  }
 
   std::vector<std::filesystem::path> to_clean;
 
-  auto const delete_if_exists = [&](std::filesystem::path what) {
-    if (not std::filesystem::exists(what))
-      return;
-    to_clean.push_back(what);
-  };
-
-  delete_if_exists(hewg_cache_path);
+  if (bares.empty()) {
+    // the trash is emptied either way, and a running
+    // server keeps its socket
+    for (auto const& entry :
+         std::filesystem::directory_iterator(hewg_cache_path))
+      if (entry.path() != hewg_trash_path and
+          entry.path() != hewg_server_socket_path)
+        to_clean.push_back(entry.path());
+  } else {
+    if (bares[0].find('/') != std::string::npos)
+      throw std::runtime_error(
+        std::format("<{}> isn't a build profile", bares[0]));
+
+    auto const folder =
+      cache_folder_path(bares[0], options.release, options.pic);
+    auto const name = folder.filename().string();
+
+    // along with the pgo builds of the same kind
+    if (std::filesystem::exists(folder.parent_path()))
+      for (auto const& entry :
+           std::filesystem::directory_iterator(folder.parent_path())) {
+        auto const entry_name = entry.path().filename().string();
+        if (entry_name == name or entry_name.starts_with(name + "-pgo"))
+          to_clean.push_back(entry.path());
+      }
+  }
 
   if (to_clean.empty()) {
     threadsafe_print("nothing to clean!\n");
@@ -79,10 +109,20 @@ clean(ThreadPool&,
   for (auto const& sf : to_clean)
     threadsafe_print(std::format("deleting: {}\n", sf.string()));
 
-  do_terminal_countdown(5);
+  // only everything at once is worth thinking twice about,
+  // config snapshots are just read again next time
+  bool const only_snapshots =
+    std::ranges::all_of(to_clean, [](auto const& path) {
+      return path == hewg_config_snapshot_path;
+    });
+
+  if (bares.empty() and not only_snapshots)
+    do_terminal_countdown(5);
 
   for (auto const& sf : to_clean)
-    std::filesystem::remove_all(sf);
+    move_to_trash(sf);
+
+  empty_trash_in_background(threads.size());
 }
 
 int
@@ -97,11 +137,6 @@ try {
 
   auto const config_path = tl_options.config_file_path.value_or("./hewg.scl");
 
-  // TODO: change this with an argument
-  threadsafe_print_verbose(
-    std::format("using <{}> tasks\n", tl_options.num_tasks));
-  ThreadPool thread_pool(tl_options.num_tasks);
-
   if (tl_options.print_version) {
     using namespace std::chrono;
     auto const dur = duration<long>(__hewg_build_date_package_hewg);
@@ -114,6 +149,11 @@ try {
     return 0;
   }
 
+  // doesn't start its threads until something's given to it to do
+  threadsafe_print_verbose(
+    std::format("using <{}> tasks\n", tl_options.num_tasks));
+  ThreadPool thread_pool(tl_options.num_tasks);
+
   if (std::holds_alternative<std::monostate>(scmds)) {
     std::cout << terse::print_usage<ToplevelOptions>() << std::endl;
   } else if (std::holds_alternative<BuildOptions>(scmds)) {
@@ -124,6 +164,24 @@ try {
         std::exit(0);
 
     auto const profile = get_build_profile(bares);
+
+    if (options.workspace) {
+      build_workspace(thread_pool, tl_options, options, profile);
+      return 0;
+    }
+
+    // the server only knows about its own hewg.scl,
+    // and runs with the tasks & countdowns it was started with
+    bool const can_forward =
+      not options.generate_compile_commands and not options.pgo and
+      not options.layout_profile and not tl_options.config_file_path and
+      not tl_options.force and not tl_options.skip_pause and
+      tl_options.num_tasks == std::thread::hardware_concurrency();
+
+    if (can_forward)
+      if (auto const exit_code = forward_build_to_server(options, profile))
+        return *exit_code;
+
     ConfigurationFile const config =
       get_config_file(tl_options, config_path, profile);
 
@@ -135,11 +193,10 @@ try {
       std::cout << terse::print_usage<CleanOptions>() << std::endl,
         std::exit(0);
 
-    auto const profile = get_build_profile(bares);
-    ConfigurationFile const config =
-      get_config_file(tl_options, config_path, profile);
-
-    clean(thread_pool, config, options, bares);
+    // a profile is just the name of its folders, and
+    // reading hewg.scl would only snapshot it into .hcache
+    get_build_profile(bares);
+    clean(thread_pool, options, bares);
   } else if (std::holds_alternative<InitOptions>(scmds)) {
     auto options = std::get<InitOptions>(scmds);
 
@@ -157,7 +214,107 @@ try {
     auto const profile = get_build_profile(bares);
     ConfigurationFile const config =
       get_config_file(tl_options, config_path, profile);
-    install(config, options, profile);
+    install(thread_pool, config, options, profile);
+  } else if (std::holds_alternative<WatchOptions>(scmds)) {
+    auto options = std::get<WatchOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<WatchOptions>() << std::endl,
+        std::exit(0);
+
+    auto const profile = get_build_profile(bares);
+    ConfigurationFile const config =
+      get_config_file(tl_options, config_path, profile);
+    watch(thread_pool, config, options, profile);
+  } else if (std::holds_alternative<UpdateOptions>(scmds)) {
+    auto options = std::get<UpdateOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<UpdateOptions>() << std::endl,
+        std::exit(0);
+
+    if (bares.size() > 0)
+      throw std::runtime_error(
+        "update subcommand does not take any bare arguments!");
+
+    ConfigurationFile const config =
+      get_config_file(tl_options, config_path, "default");
+    update_lock_file(thread_pool, config);
+  } else if (std::holds_alternative<ServePackagesOptions>(scmds)) {
+    auto options = std::get<ServePackagesOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<ServePackagesOptions>() << std::endl,
+        std::exit(0);
+
+    if (bares.size() > 1)
+      throw std::runtime_error(
+        "serve-packages subcommand takes at most one directory!");
+
+    auto const directory = bares.empty()
+                             ? hewg_packages_directory
+                             : std::filesystem::path(bares[0]);
+    serve_packages(thread_pool, directory, options.port);
+  } else if (std::holds_alternative<GcOptions>(scmds)) {
+    auto options = std::get<GcOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<GcOptions>() << std::endl, std::exit(0);
+
+    if (bares.size() > 0)
+      throw std::runtime_error(
+        "gc subcommand does not take any bare arguments!");
+
+    auto const [blobs, bytes] = collect_store_garbage(options.dry_run);
+    threadsafe_print(std::format("{} {} unused file(s), {:.1f} MiB\n",
+                                 options.dry_run ? "would delete" : "deleted",
+                                 blobs,
+                                 double(bytes) / 1_mb));
+  } else if (std::holds_alternative<PackOptions>(scmds)) {
+    auto options = std::get<PackOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<PackOptions>() << std::endl, std::exit(0);
+
+    if (bares.size() != 2)
+      throw std::runtime_error(
+        "pack subcommand takes a package name and a version!");
+
+    auto const version = parse_version_directory(bares[1]);
+    if (not version)
+      throw std::runtime_error(
+        std::format("<{}> isn't a version like 1.2.3", bares[1]));
+
+    auto const output =
+      options.output.value_or(std::format("{}-{}.hpk", bares[0], bares[1]));
+    pack_package(bares[0], *version, output);
+  } else if (std::holds_alternative<UnpackOptions>(scmds)) {
+    auto options = std::get<UnpackOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<UnpackOptions>() << std::endl,
+        std::exit(0);
+
+    if (bares.empty())
+      throw std::runtime_error("unpack subcommand needs a pack file!");
+
+    unpack_package(thread_pool, options, bares[0], std::span(bares).subspan(1));
+  } else if (std::holds_alternative<ServerOptions>(scmds)) {
+    auto options = std::get<ServerOptions>(scmds);
+
+    if (options.help)
+      std::cout << terse::print_usage<ServerOptions>() << std::endl,
+        std::exit(0);
+
+    if (bares.size() > 0)
+      throw std::runtime_error(
+        "server subcommand does not take any bare arguments!");
+
+    if (options.stop) {
+      if (not stop_server())
+        threadsafe_print("no server is running\n");
+    } else
+      serve(thread_pool, tl_options, config_path);
   }
 } catch (std::exception const& e) {
   threadsafe_print("ERROR: ", e.what(), '\n');
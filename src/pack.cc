@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+#include <zstd.h>
+
+#include "common.hh"
+#include "confs.hh"
+#include "digest.hh"
+#include "pack.hh"
+#include "package_index.hh"
+#include "packages.hh"
+#include "paths.hh"
+#include "store.hh"
+
+// bumped whenever the layout changes
+static constexpr char pack_magic[8] = { 'h', 'e', 'w', 'g',
+                                        'p', 'a', 'k', '1' };
+
+// packs are made once and unpacked many times,
+// so it's worth spending longer on them
+constexpr int compression_level = 19;
+
+// regenerated by whoever unpacks it
+constexpr auto manifest_name = "files.json";
+constexpr auto info_name = "info.scl";
+
+static bool
+is_executable(std::filesystem::path const& path)
+{
+  auto const perms = std::filesystem::status(path).permissions();
+  return (perms & std::filesystem::perms::owner_exec) !=
+         std::filesystem::perms::none;
+}
+
+// compresses the file at from into a single frame written to out,
+// returning its digest and how many bytes the frame took
+static std::pair<std::string, std::uint64_t>
+compress_member(ZSTD_CCtx* context,
+                std::filesystem::path const& from,
+                std::ofstream& out)
+{
+  std::ifstream in(from, std::ios::binary);
+  if (in.fail())
+    throw std::runtime_error(
+      std::format("unable to open <{}> for packing", from.string()));
+
+  auto remaining = std::filesystem::file_size(from);
+
+  ZSTD_CCtx_reset(context, ZSTD_reset_session_only);
+  ZSTD_CCtx_setPledgedSrcSize(context, remaining);
+
+  std::string input(ZSTD_CStreamInSize(), '\0');
+  std::string output(ZSTD_CStreamOutSize(), '\0');
+
+  Digest digest;
+  std::uint64_t written = 0;
+
+  for (;;) {
+    auto const chunk = std::min<std::uint64_t>(remaining, input.size());
+    in.read(input.data(), chunk);
+    if (static_cast<std::uint64_t>(in.gcount()) != chunk)
+      throw std::runtime_error(
+        std::format("<{}> changed while packing it", from.string()));
+
+    remaining -= chunk;
+    digest.update(std::string_view(input.data(), chunk));
+
+    auto const mode = remaining == 0 ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_inBuffer in_buffer{ input.data(), chunk, 0 };
+
+    // the end of a frame may need several rounds to flush out
+    for (bool done = false; not done;) {
+      ZSTD_outBuffer out_buffer{ output.data(), output.size(), 0 };
+      auto const left =
+        ZSTD_compressStream2(context, &out_buffer, &in_buffer, mode);
+
+      if (ZSTD_isError(left))
+        throw std::runtime_error(std::format("unable to compress <{}>: {}",
+                                             from.string(),
+                                             ZSTD_getErrorName(left)));
+
+      out.write(output.data(), out_buffer.pos);
+      written += out_buffer.pos;
+
+      done = mode == ZSTD_e_end ? left == 0 : in_buffer.pos == in_buffer.size;
+    }
+
+    if (remaining == 0)
+      break;
+  }
+
+  return { digest.finish(), written };
+}
+
+void
+pack_package(std::string_view const name,
+             version_triplet const version,
+             std::filesystem::path const& output)
+{
+  auto const directory =
+    hewg_packages_directory / name / version_triplet_to_string(version);
+
+  if (not std::filesystem::exists(directory / info_name))
+    throw std::runtime_error(
+      std::format("package <{}> {} isn't installed",
+                  name,
+                  version_triplet_to_string(version)));
+
+  std::vector<std::string> paths;
+  for (auto const& entry :
+       std::filesystem::recursive_directory_iterator(directory))
+    if (entry.is_regular_file() and
+        entry.path().filename() != manifest_name)
+      paths.push_back(
+        entry.path().lexically_relative(directory).generic_string());
+
+  // the same package always packs the same way
+  std::ranges::sort(paths);
+
+  std::string strings(name);
+  std::vector<pack_format::Member> members(paths.size());
+
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    members[i].path = strings.size();
+    members[i].path_length = paths[i].size();
+    members[i].executable = is_executable(directory / paths[i]);
+    strings += paths[i];
+  }
+
+  pack_format::Header header{};
+  std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+  std::tie(header.major, header.minor, header.patch) = version;
+  header.name = 0;
+  header.name_length = name.size();
+  header.members = members.size();
+  header.strings = strings.size();
+
+  std::uint64_t end = sizeof(header) +
+                      members.size() * sizeof(pack_format::Member) +
+                      strings.size();
+
+  auto const temporary =
+    output.parent_path() /
+    std::format(".{}.tmp-{}", output.filename().string(), getpid());
+
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(
+    ZSTD_createCCtx(), ZSTD_freeCCtx);
+  ZSTD_CCtx_setParameter(
+    context.get(), ZSTD_c_compressionLevel, compression_level);
+  ZSTD_CCtx_setParameter(context.get(), ZSTD_c_checksumFlag, 1);
+
+  try {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+
+    // the index is only known once every frame is written
+    out.seekp(end);
+
+    // digest -> where its frame is
+    std::map<std::string, std::pair<std::uint64_t, std::uint64_t>> frames;
+
+    for (std::size_t i = 0; i < paths.size(); i++) {
+      auto const [digest, compressed] =
+        compress_member(context.get(), directory / paths[i], out);
+
+      auto const [frame, inserted] =
+        frames.try_emplace(digest, end, compressed);
+
+      // a file packed before, the next frame goes over this one
+      if (inserted)
+        end += compressed;
+      else
+        out.seekp(end);
+
+      std::memcpy(members[i].digest, digest.data(), sizeof(members[i].digest));
+      members[i].size = std::filesystem::file_size(directory / paths[i]);
+      members[i].offset = frame->second.first;
+      members[i].compressed_size = frame->second.second;
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    out.write(reinterpret_cast<char const*>(members.data()),
+              members.size() * sizeof(pack_format::Member));
+    out << strings;
+    out.close();
+
+    if (out.fail())
+      throw std::runtime_error(
+        std::format("unable to write <{}>", temporary.string()));
+
+    // drops a duplicate frame that was written last
+    std::filesystem::resize_file(temporary, end);
+    std::filesystem::rename(temporary, output);
+  } catch (...) {
+    std::filesystem::remove(temporary);
+    throw;
+  }
+
+  threadsafe_print(
+    std::format("packed <{}> {} into <{}>, {} file(s), {:.1f} MiB\n",
+                name,
+                version_triplet_to_string(version),
+                output.string(),
+                members.size(),
+                double(end) / 1_mb));
+}
+
+// a pack file mapped into memory, checked once when opened
+class PackFile
+{
+  void* m_mapping = nullptr;
+  std::size_t m_size = 0;
+
+  pack_format::Header const* m_header = nullptr;
+  std::span<pack_format::Member const> m_members;
+  std::string_view m_strings;
+
+  // throws if the mapping isn't a whole pack file
+  void read_index(std::filesystem::path const& path);
+
+public:
+  PackFile(const PackFile&) = delete;
+  PackFile& operator=(const PackFile&) = delete;
+
+  explicit PackFile(std::filesystem::path const& path);
+  ~PackFile();
+
+  std::string_view name() const
+  {
+    return m_strings.substr(m_header->name, m_header->name_length);
+  }
+
+  version_triplet version() const
+  {
+    return { m_header->major, m_header->minor, m_header->patch };
+  }
+
+  std::span<pack_format::Member const> members() const { return m_members; }
+
+  std::string_view path_of(pack_format::Member const& member) const
+  {
+    return m_strings.substr(member.path, member.path_length);
+  }
+
+  std::string_view frame_of(pack_format::Member const& member) const
+  {
+    return { static_cast<char const*>(m_mapping) + member.offset,
+             member.compressed_size };
+  }
+};
+
+PackFile::PackFile(std::filesystem::path const& path)
+{
+  int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    throw std::runtime_error(
+      std::format("unable to open <{}>", path.string()));
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 or
+      static_cast<std::size_t>(st.st_size) < sizeof(pack_format::Header)) {
+    close(fd);
+    throw std::runtime_error(
+      std::format("<{}> isn't a hewg pack file", path.string()));
+  }
+
+  m_size = st.st_size;
+  m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (m_mapping == MAP_FAILED) {
+    m_mapping = nullptr;
+    throw std::runtime_error(
+      std::format("unable to map <{}>", path.string()));
+  }
+
+  try {
+    read_index(path);
+  } catch (...) {
+    munmap(m_mapping, m_size);
+    throw;
+  }
+}
+
+PackFile::~PackFile()
+{
+  munmap(m_mapping, m_size);
+}
+
+void
+PackFile::read_index(std::filesystem::path const& path)
+{
+  auto const bytes = static_cast<char const*>(m_mapping);
+  auto const header = reinterpret_cast<pack_format::Header const*>(bytes);
+
+  auto const broken = [&](std::string_view why) {
+    return std::runtime_error(
+      std::format("<{}> isn't a hewg pack file, {}", path.string(), why));
+  };
+
+  if (std::memcmp(header->magic, pack_magic, sizeof(pack_magic)) != 0)
+    throw broken("or one from another hewg version");
+
+  std::uint64_t const index_size =
+    sizeof(pack_format::Header) +
+    std::uint64_t(header->members) * sizeof(pack_format::Member) +
+    header->strings;
+
+  if (index_size > m_size)
+    throw broken("it was cut short");
+
+  auto const cursor = bytes + sizeof(pack_format::Header);
+
+  m_header = header;
+  m_members = { reinterpret_cast<pack_format::Member const*>(cursor),
+                header->members };
+  m_strings = { cursor + header->members * sizeof(pack_format::Member),
+                header->strings };
+
+  auto const in_strings = [&](std::uint64_t at, std::uint64_t length) {
+    return at + length <= m_strings.size();
+  };
+
+  if (not in_strings(header->name, header->name_length))
+    throw broken("its name is out of bounds");
+
+  // the name becomes a directory under ~/.hewg/packages
+  if (not is_safe_package_name(name()))
+    throw broken(std::format("it's named <{}>", name()));
+
+  for (auto const& member : m_members) {
+    if (not in_strings(member.path, member.path_length) or
+        member.offset < index_size or
+        member.offset + member.compressed_size > m_size)
+      throw broken("a member is out of bounds");
+
+    // nothing may land outside of where it's unpacked to
+    std::filesystem::path const relative(std::string(path_of(member)));
+    if (relative.empty() or relative.is_absolute() or
+        std::ranges::any_of(relative, [](auto const& part) {
+          return part == "..";
+        }))
+      throw broken(std::format("it has a member at <{}>", path_of(member)));
+
+    // the digest names the member's blob in the store
+    std::string_view const digest(member.digest, sizeof(member.digest));
+    if (not std::ranges::all_of(digest, [](char const c) {
+          return (c >= '0' and c <= '9') or (c >= 'a' and c <= 'f');
+        }))
+      throw broken(
+        std::format("the member at <{}> has a broken digest", path_of(member)));
+  }
+}
+
+// decompresses a member's frame into to, which is created
+static void
+decompress_member(PackFile const& pack,
+                  pack_format::Member const& member,
+                  std::filesystem::path const& to)
+{
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(
+    ZSTD_createDCtx(), ZSTD_freeDCtx);
+
+  auto const frame = pack.frame_of(member);
+
+  std::ofstream out(to, std::ios::binary | std::ios::trunc);
+  std::string output(ZSTD_DStreamOutSize(), '\0');
+
+  ZSTD_inBuffer in_buffer{ frame.data(), frame.size(), 0 };
+  std::uint64_t written = 0;
+  std::size_t left = 1;
+
+  while (left != 0) {
+    ZSTD_outBuffer out_buffer{ output.data(), output.size(), 0 };
+    left = ZSTD_decompressStream(context.get(), &out_buffer, &in_buffer);
+
+    if (ZSTD_isError(left))
+      throw std::runtime_error(std::format("unable to decompress <{}>: {}",
+                                           pack.path_of(member),
+                                           ZSTD_getErrorName(left)));
+
+    // the frame ran out before it was done
+    if (out_buffer.pos == 0 and in_buffer.pos == in_buffer.size and left != 0)
+      break;
+
+    out.write(output.data(), out_buffer.pos);
+    written += out_buffer.pos;
+  }
+
+  out.close();
+
+  if (left != 0 or written != member.size or out.fail())
+    throw std::runtime_error(
+      std::format("unable to unpack <{}>", pack.path_of(member)));
+}
+
+static std::string_view
+digest_of(pack_format::Member const& member)
+{
+  return { member.digest, sizeof(member.digest) };
+}
+
+static bool
+is_selected(std::string_view path, std::span<std::string const> selections)
+{
+  return selections.empty() or
+         std::ranges::any_of(selections, [&](std::string_view selection) {
+           return path == selection or
+                  (path.starts_with(selection) and
+                   path.substr(selection.size()).starts_with('/'));
+         });
+}
+
+// runs each job on the pool, throwing once all are done if any failed
+static void
+run_jobs(ThreadPool& threads,
+         std::vector<std::function<std::optional<std::string>()>> jobs)
+{
+  std::vector<std::future<std::optional<std::string>>> pending;
+  for (auto& job : jobs)
+    pending.push_back(threads.add_job(std::move(job)));
+
+  std::size_t failed = 0;
+
+  for (auto& job : pending)
+    if (auto const error = job.get()) {
+      threadsafe_print(*error, '\n');
+      failed++;
+    }
+
+  if (failed > 0)
+    throw std::runtime_error(
+      std::format("{} file(s) couldn't be unpacked", failed));
+}
+
+// a job that never throws, so the pool keeps going
+template<typename F>
+static std::function<std::optional<std::string>()>
+unpack_job(PackFile const& pack, pack_format::Member const& member, F f)
+{
+  return [&pack, &member, f]() -> std::optional<std::string> {
+    try {
+      f();
+      return std::nullopt;
+    } catch (std::exception const& e) {
+      return std::format(
+        "unable to unpack <{}>: {}", pack.path_of(member), e.what());
+    }
+  };
+}
+
+static void
+extract_members(ThreadPool& threads,
+                PackFile const& pack,
+                std::span<std::string const> selections,
+                std::filesystem::path const& output)
+{
+  std::vector<std::function<std::optional<std::string>()>> jobs;
+
+  for (auto const& member : pack.members()) {
+    if (not is_selected(pack.path_of(member), selections))
+      continue;
+
+    jobs.push_back(unpack_job(pack, member, [&pack, &member, &output] {
+      auto const destination = output / pack.path_of(member);
+      std::filesystem::create_directories(destination.parent_path());
+
+      decompress_member(pack, member, destination);
+
+      if (digest_file(destination) != digest_of(member))
+        throw std::runtime_error("it doesn't match its digest");
+
+      if (member.executable)
+        std::filesystem::permissions(destination,
+                                     std::filesystem::perms::owner_exec |
+                                       std::filesystem::perms::group_exec |
+                                       std::filesystem::perms::others_exec,
+                                     std::filesystem::perm_options::add);
+    }));
+  }
+
+  auto const count = jobs.size();
+  run_jobs(threads, std::move(jobs));
+
+  threadsafe_print(std::format("unpacked {} file(s) of <{}> {} into <{}>\n",
+                               count,
+                               pack.name(),
+                               version_triplet_to_string(pack.version()),
+                               output.string()));
+}
+
+static void
+install_members(ThreadPool& threads, PackFile const& pack)
+{
+  auto const name = std::string(pack.name());
+  auto const version = pack.version();
+  auto const version_string = version_triplet_to_string(version);
+
+  auto const destination = hewg_packages_directory / name / version_string;
+
+  if (std::filesystem::exists(destination / info_name)) {
+    threadsafe_print(
+      std::format("<{}> {} is already installed\n", name, version_string));
+    return;
+  }
+
+  // only renamed into place once it's whole
+  auto const staging =
+    hewg_packages_directory / name /
+    std::format(".{}.unpack-{}", version_string, getpid());
+  std::filesystem::create_directories(staging);
+
+  std::atomic<std::size_t> already_stored = 0;
+
+  try {
+    StoreWriter store(staging);
+    std::vector<std::function<std::optional<std::string>()>> jobs;
+
+    // members with the same blob are handled by one job,
+    // so it's only ever decompressed once
+    std::map<std::pair<std::string_view, bool>,
+             std::vector<pack_format::Member const*>>
+      blobs;
+
+    for (auto const& member : pack.members()) {
+      // info.scl isn't stored, it's what marks a version installed
+      if (pack.path_of(member) == info_name)
+        jobs.push_back(unpack_job(pack, member, [&, &member = member] {
+          decompress_member(pack, member, staging / info_name);
+        }));
+      else
+        blobs[{ digest_of(member), member.executable != 0 }].push_back(
+          &member);
+    }
+
+    for (auto const& [blob, members] : blobs)
+      jobs.push_back(unpack_job(pack, *members[0], [&, &members = members] {
+        bool written = false;
+
+        for (auto const member : members)
+          written |= store.add_blob(std::string(pack.path_of(*member)),
+                                    std::string(digest_of(*member)),
+                                    member->executable,
+                                    [&](std::filesystem::path const& to) {
+                                      decompress_member(pack, *member, to);
+                                    });
+
+        if (not written)
+          already_stored += members.size();
+      }));
+
+    run_jobs(threads, std::move(jobs));
+
+    if (not std::filesystem::exists(staging / info_name))
+      throw std::runtime_error("the pack has no info.scl");
+
+    store.finish();
+    std::filesystem::rename(staging, destination);
+
+    threadsafe_print(
+      std::format("unpacked <{}> {}, {} file(s), {} already stored\n",
+                  name,
+                  version_string,
+                  pack.members().size() - 1,
+                  already_stored.load()));
+  } catch (...) {
+    std::filesystem::remove_all(staging);
+    throw;
+  }
+
+  auto const info = read_package_info(destination);
+  index_package_version(
+    name, IndexedVersion{ version, info.meta.type, info.internal_deps });
+}
+
+void
+unpack_package(ThreadPool& threads,
+               UnpackOptions const& options,
+               std::filesystem::path const& archive,
+               std::span<std::string const> members)
+{
+  PackFile const pack(archive);
+
+  if (options.list) {
+    for (auto const& member : pack.members())
+      threadsafe_print(std::format("{} {:>10} {}\n",
+                                   digest_of(member).substr(0, 16),
+                                   member.size,
+                                   pack.path_of(member)));
+    return;
+  }
+
+  for (auto const& selection : members)
+    if (std::ranges::none_of(pack.members(), [&](auto const& member) {
+          return is_selected(pack.path_of(member),
+                             std::span(&selection, 1));
+        }))
+      throw std::runtime_error(
+        std::format("<{}> has no member <{}>", archive.string(), selection));
+
+  if (options.output)
+    return extract_members(threads, pack, members, *options.output);
+
+  // an installed version is always the whole package
+  if (not members.empty())
+    throw std::runtime_error(
+      "only whole packages can be installed, "
+      "pass --output to extract members");
+
+  install_members(threads, pack);
+}
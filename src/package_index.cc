@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common.hh"
+#include "confs.hh"
+#include "package_index.hh"
+#include "packages.hh"
+#include "paths.hh"
+
+// bumped whenever the layout changes,
+// an older index just gets rebuilt
+static constexpr char index_magic[8] = { 'h', 'e', 'w', 'g',
+                                         'i', 'd', 'x', '1' };
+
+static version_triplet
+triplet_of(index_format::Version const& version)
+{
+  return { version.major, version.minor, version.patch };
+}
+
+bool
+PackageIndex::map(std::filesystem::path const& path)
+{
+  int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 or
+      static_cast<std::size_t>(st.st_size) < sizeof(index_format::Header)) {
+    close(fd);
+    return false;
+  }
+
+  m_size = st.st_size;
+  m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (m_mapping == MAP_FAILED) {
+    m_mapping = nullptr;
+    return false;
+  }
+
+  auto const bytes = static_cast<char const*>(m_mapping);
+  auto const header = reinterpret_cast<index_format::Header const*>(bytes);
+
+  std::size_t const expected_size =
+    sizeof(index_format::Header) +
+    header->packages * sizeof(index_format::Package) +
+    header->versions * sizeof(index_format::Version) +
+    header->dependencies * sizeof(index_format::Dependency) + header->strings;
+
+  if (std::memcmp(header->magic, index_magic, sizeof(index_magic)) != 0 or
+      expected_size != m_size) {
+    unmap();
+    return false;
+  }
+
+  auto cursor = bytes + sizeof(index_format::Header);
+
+  m_packages = { reinterpret_cast<index_format::Package const*>(cursor),
+                 header->packages };
+  cursor += header->packages * sizeof(index_format::Package);
+
+  m_versions = { reinterpret_cast<index_format::Version const*>(cursor),
+                 header->versions };
+  cursor += header->versions * sizeof(index_format::Version);
+
+  m_dependencies = { reinterpret_cast<index_format::Dependency const*>(cursor),
+                     header->dependencies };
+  cursor += header->dependencies * sizeof(index_format::Dependency);
+
+  m_strings = { cursor, header->strings };
+
+  return true;
+}
+
+void
+PackageIndex::unmap()
+{
+  if (m_mapping != nullptr)
+    munmap(m_mapping, m_size);
+
+  m_mapping = nullptr;
+  m_size = 0;
+  m_packages = {};
+  m_versions = {};
+  m_dependencies = {};
+  m_strings = {};
+}
+
+PackageIndex::PackageIndex(NoRebuild)
+{
+  map(hewg_package_index_path);
+}
+
+PackageIndex::PackageIndex()
+{
+  if (map(hewg_package_index_path) or
+      not std::filesystem::exists(hewg_packages_directory))
+    return;
+
+  threadsafe_print_verbose("building the package index\n");
+  rebuild_package_index();
+
+  if (not map(hewg_package_index_path))
+    throw std::runtime_error(
+      std::format("unable to read the package index <{}>",
+                  hewg_package_index_path.string()));
+}
+
+PackageIndex::~PackageIndex()
+{
+  unmap();
+}
+
+std::string_view
+PackageIndex::string_at(std::uint32_t const offset,
+                        std::uint32_t const length) const
+{
+  if (std::size_t(offset) + length > m_strings.size())
+    throw std::runtime_error(std::format(
+      "the package index <{}> is corrupt, delete it to rebuild it",
+      hewg_package_index_path.string()));
+
+  return m_strings.substr(offset, length);
+}
+
+std::span<index_format::Version const>
+PackageIndex::versions_of(std::string_view name) const
+{
+  auto const found = std::ranges::lower_bound(
+    m_packages, name, {}, [&](index_format::Package const& package) {
+      return string_at(package.name, package.name_length);
+    });
+
+  if (found == m_packages.end() or
+      string_at(found->name, found->name_length) != name)
+    return {};
+
+  if (std::size_t(found->first_version) + found->version_count >
+      m_versions.size())
+    throw std::runtime_error(std::format(
+      "the package index <{}> is corrupt, delete it to rebuild it",
+      hewg_package_index_path.string()));
+
+  return m_versions.subspan(found->first_version, found->version_count);
+}
+
+index_format::Version const*
+PackageIndex::find(std::string_view name, version_triplet const version) const
+{
+  auto const versions = versions_of(name);
+  auto const found =
+    std::ranges::lower_bound(versions, version, {}, triplet_of);
+
+  if (found == versions.end() or not(triplet_of(*found) == version))
+    return nullptr;
+
+  return &*found;
+}
+
+IndexedVersion
+PackageIndex::decode(index_format::Version const& version) const
+{
+  IndexedVersion out{ triplet_of(version), ProjectType(version.type), {} };
+
+  if (std::size_t(version.first_dependency) + version.dependency_count >
+      m_dependencies.size())
+    throw std::runtime_error(std::format(
+      "the package index <{}> is corrupt, delete it to rebuild it",
+      hewg_package_index_path.string()));
+
+  for (auto const& dependency : m_dependencies.subspan(
+         version.first_dependency, version.dependency_count))
+    out.dependencies.push_back(Dependency{
+      std::string(string_at(dependency.name, dependency.name_length)),
+      { dependency.major, dependency.minor, dependency.patch },
+      dependency.exact != 0,
+    });
+
+  return out;
+}
+
+std::vector<version_triplet>
+PackageIndex::versions(std::string_view name) const
+{
+  std::vector<version_triplet> out;
+  for (auto const& version : versions_of(name))
+    out.push_back(triplet_of(version));
+  return out;
+}
+
+bool
+PackageIndex::contains(std::string_view name,
+                       version_triplet const version) const
+{
+  return find(name, version) != nullptr;
+}
+
+std::optional<version_triplet>
+PackageIndex::best_compatible(std::string_view name,
+                              version_triplet const requested) const
+{
+  auto const [major, minor, _patch] = requested;
+  auto const versions = versions_of(name);
+
+  // versions are sorted, so the best one is
+  // right before the first of the next major version
+  auto const next_major =
+    std::ranges::lower_bound(versions,
+                             version_triplet{ major + 1, 0, 0 },
+                             {},
+                             triplet_of);
+
+  if (next_major == versions.begin())
+    return std::nullopt;
+
+  auto const& best = *(next_major - 1);
+
+  // same rules as select_best_compatable_semver()
+  if (best.major != major or best.minor < minor)
+    return std::nullopt;
+
+  return triplet_of(best);
+}
+
+std::optional<IndexedVersion>
+PackageIndex::get(std::string_view name, version_triplet const version) const
+{
+  auto const found = find(name, version);
+  if (found == nullptr)
+    return std::nullopt;
+  return decode(*found);
+}
+
+IndexEntries
+PackageIndex::entries() const
+{
+  IndexEntries out;
+
+  for (auto const& package : m_packages) {
+    auto& versions =
+      out[std::string(string_at(package.name, package.name_length))];
+
+    for (auto const& version : m_versions.subspan(package.first_version,
+                                                  package.version_count))
+      versions.insert_or_assign(triplet_of(version), decode(version));
+  }
+
+  return out;
+}
+
+namespace {
+
+// held while the index is read, changed & written back,
+// so concurrent installs don't drop each others versions
+class IndexLock
+{
+  int m_fd;
+
+public:
+  IndexLock(const IndexLock&) = delete;
+  IndexLock& operator=(const IndexLock&) = delete;
+
+  IndexLock()
+    : m_fd(open(hewg_package_index_lock_path.get().c_str(),
+                O_RDWR | O_CREAT | O_CLOEXEC,
+                0644))
+  {
+    if (m_fd == -1 or flock(m_fd, LOCK_EX) == -1)
+      throw std::runtime_error(
+        std::format("unable to lock the package index <{}>",
+                    hewg_package_index_lock_path.string()));
+  }
+
+  ~IndexLock() { close(m_fd); }
+};
+
+}
+
+static void
+write_all(int const fd, std::string_view data)
+{
+  while (not data.empty()) {
+    auto const written = write(fd, data.data(), data.size());
+
+    if (written == -1 and errno == EINTR)
+      continue;
+
+    if (written <= 0)
+      throw std::runtime_error(
+        std::format("unable to write the package index <{}>",
+                    hewg_package_index_path.string()));
+
+    data.remove_prefix(written);
+  }
+}
+
+template<typename T>
+static void
+append_record(std::string& out, T const& record)
+{
+  out.append(reinterpret_cast<char const*>(&record), sizeof(T));
+}
+
+static void
+write_index(IndexEntries const& entries)
+{
+  std::vector<index_format::Package> packages;
+  std::vector<index_format::Version> versions;
+  std::vector<index_format::Dependency> dependencies;
+  std::string strings;
+
+  auto const intern = [&](std::string const& what) {
+    auto const offset = static_cast<std::uint32_t>(strings.size());
+    strings += what;
+    return offset;
+  };
+
+  // std::map keeps both names and versions sorted
+  for (auto const& [name, package_versions] : entries) {
+    packages.push_back(index_format::Package{
+      intern(name),
+      static_cast<std::uint32_t>(name.size()),
+      static_cast<std::uint32_t>(versions.size()),
+      static_cast<std::uint32_t>(package_versions.size()),
+    });
+
+    for (auto const& [triplet, version] : package_versions) {
+      auto const [major, minor, patch] = triplet;
+
+      versions.push_back(index_format::Version{
+        major,
+        minor,
+        patch,
+        static_cast<std::uint32_t>(version.type),
+        static_cast<std::uint32_t>(dependencies.size()),
+        static_cast<std::uint32_t>(version.dependencies.size()),
+      });
+
+      for (auto const& dependency : version.dependencies) {
+        auto const [dmajor, dminor, dpatch] = dependency.version;
+
+        dependencies.push_back(index_format::Dependency{
+          intern(dependency.name),
+          static_cast<std::uint32_t>(dependency.name.size()),
+          dmajor,
+          dminor,
+          dpatch,
+          dependency.exact,
+        });
+      }
+    }
+  }
+
+  index_format::Header header;
+  std::memcpy(header.magic, index_magic, sizeof(index_magic));
+  header.packages = packages.size();
+  header.versions = versions.size();
+  header.dependencies = dependencies.size();
+  header.strings = strings.size();
+
+  std::string out;
+  append_record(out, header);
+  for (auto const& package : packages)
+    append_record(out, package);
+  for (auto const& version : versions)
+    append_record(out, version);
+  for (auto const& dependency : dependencies)
+    append_record(out, dependency);
+  out += strings;
+
+  // readers keep whatever index they mapped,
+  // the new one only appears once it's complete
+  auto const temporary = std::filesystem::path(
+    std::format("{}.{}", hewg_package_index_path.string(), getpid()));
+
+  int const fd =
+    open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    throw std::runtime_error(std::format(
+      "unable to write the package index <{}>", temporary.string()));
+
+  try {
+    write_all(fd, out);
+
+    if (fsync(fd) == -1)
+      throw std::runtime_error(std::format(
+        "unable to write the package index <{}>", temporary.string()));
+  } catch (...) {
+    close(fd);
+    std::filesystem::remove(temporary);
+    throw;
+  }
+
+  close(fd);
+  std::filesystem::rename(temporary, hewg_package_index_path);
+}
+
+std::optional<version_triplet>
+parse_version_directory(std::string_view name)
+{
+  int parts[3];
+
+  for (int i = 0; i < 3; i++) {
+    auto const [end, ec] =
+      std::from_chars(name.data(), name.data() + name.size(), parts[i]);
+
+    if (ec != std::errc())
+      return std::nullopt;
+
+    name.remove_prefix(end - name.data());
+
+    if (i < 2) {
+      if (not name.starts_with('.'))
+        return std::nullopt;
+      name.remove_prefix(1);
+    }
+  }
+
+  if (not name.empty())
+    return std::nullopt;
+
+  return version_triplet{ parts[0], parts[1], parts[2] };
+}
+
+static IndexEntries
+entries_from_package_directories()
+{
+  IndexEntries out;
+
+  for (auto const& package :
+       std::filesystem::directory_iterator(hewg_packages_directory)) {
+    if (not package.is_directory())
+      continue;
+
+    auto const name = package.path().filename().string();
+
+    for (auto const& entry :
+         std::filesystem::directory_iterator(package.path())) {
+      auto const version =
+        parse_version_directory(entry.path().filename().string());
+
+      // versions that never finished installing
+      // have no info.scl yet
+      if (not version or
+          not std::filesystem::exists(entry.path() / "info.scl"))
+        continue;
+
+      auto const info = get_package_info(name, *version);
+      out[name].insert_or_assign(
+        *version,
+        IndexedVersion{ *version, info.meta.type, info.internal_deps });
+    }
+  }
+
+  return out;
+}
+
+void
+index_package_version(std::string_view name, IndexedVersion version)
+{
+  std::filesystem::create_directories(hewg_packages_directory);
+  IndexLock lock;
+
+  IndexEntries entries;
+  {
+    PackageIndex current{ PackageIndex::NoRebuild{} };
+    entries = current.m_mapping != nullptr ? current.entries()
+                                           : entries_from_package_directories();
+  }
+
+  auto const triplet = version.version;
+  entries[std::string(name)].insert_or_assign(triplet, std::move(version));
+
+  write_index(entries);
+}
+
+void
+rebuild_package_index()
+{
+  std::filesystem::create_directories(hewg_packages_directory);
+  IndexLock lock;
+
+  write_index(entries_from_package_directories());
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <filesystem>
+#include <format>
+#include <jayson.hh>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.hh"
+#include "digest.hh"
+#include "fetch.hh"
+#include "http.hh"
+#include "package_index.hh"
+#include "package_server.hh"
+#include "packages.hh"
+#include "tar.hh"
+
+/*
+  a stand-in for a real package mirror, so fetching can be
+  tried out without one. it's plain http on localhost,
+  one request per connection, each handled on the pool
+*/
+
+struct ServedArchive
+{
+  std::string archive;
+  std::string digest;
+};
+
+class PackageServer
+{
+  std::filesystem::path m_directory;
+
+  // installed versions never change,
+  // so their archives are only built once
+  std::mutex m_mutex;
+  std::map<std::filesystem::path, std::shared_ptr<ServedArchive const>>
+    m_archives;
+
+  std::shared_ptr<ServedArchive const> archive_of(
+    std::filesystem::path const& version_directory);
+
+  std::optional<std::string> listing_of(std::string const& name);
+
+public:
+  explicit PackageServer(std::filesystem::path directory)
+    : m_directory(std::move(directory))
+  {
+  }
+
+  void handle(int fd);
+};
+
+std::shared_ptr<ServedArchive const>
+PackageServer::archive_of(std::filesystem::path const& version_directory)
+{
+  {
+    std::scoped_lock lock(m_mutex);
+    if (auto const found = m_archives.find(version_directory);
+        found != m_archives.end())
+      return found->second;
+  }
+
+  auto archive = archive_directory(version_directory);
+  auto digest = digest_string(archive);
+
+  auto const served = std::make_shared<ServedArchive const>(
+    ServedArchive{ std::move(archive), std::move(digest) });
+
+  std::scoped_lock lock(m_mutex);
+  return m_archives.try_emplace(version_directory, served).first->second;
+}
+
+std::optional<std::string>
+PackageServer::listing_of(std::string const& name)
+{
+  auto const package_directory = m_directory / name;
+  if (not std::filesystem::is_directory(package_directory))
+    return std::nullopt;
+
+  MirrorListing out{ name, {} };
+
+  for (auto const& entry :
+       std::filesystem::directory_iterator(package_directory)) {
+    auto const version =
+      parse_version_directory(entry.path().filename().string());
+
+    // versions that never finished installing
+    // have no info.scl yet
+    if (not version or
+        not std::filesystem::exists(entry.path() / "info.scl"))
+      continue;
+
+    out.versions.push_back(MirrorVersion{
+      *version,
+      archive_of(entry.path())->digest,
+      read_package_info(entry.path()).internal_deps,
+    });
+  }
+
+  std::ranges::sort(out.versions, {}, &MirrorVersion::version);
+
+  return jayson::serialize(out).serialize();
+}
+
+// "/name/versions.json" -> { "name", "versions.json" }
+static std::optional<std::pair<std::string, std::string>>
+split_request_path(std::string_view path)
+{
+  if (not path.starts_with('/'))
+    return std::nullopt;
+  path.remove_prefix(1);
+
+  auto const slash = path.find('/');
+  if (slash == std::string_view::npos)
+    return std::nullopt;
+
+  auto const name = path.substr(0, slash);
+  auto const file = path.substr(slash + 1);
+
+  // nothing is served from outside the directory
+  if (not is_safe_package_name(name) or
+      file.find('/') != std::string_view::npos)
+    return std::nullopt;
+
+  return std::pair(std::string(name), std::string(file));
+}
+
+void
+PackageServer::handle(int const fd)
+{
+  auto const request = read_http_request(fd);
+  if (not request)
+    return write_http_error(fd, 400);
+
+  if (request->method != "GET" and request->method != "HEAD")
+    return write_http_error(fd, 405);
+
+  auto const split = split_request_path(request->path);
+  if (not split)
+    return write_http_error(fd, 404);
+
+  auto const& [name, file] = *split;
+
+  if (file == "versions.json") {
+    auto const listing = listing_of(name);
+    if (not listing)
+      return write_http_error(fd, 404);
+
+    threadsafe_print(std::format("listing <{}>\n", name));
+    return write_http_response(fd, *request, "application/json", *listing);
+  }
+
+  std::string_view const archive_name = file;
+  auto const version =
+    archive_name.ends_with(".tar")
+      ? parse_version_directory(archive_name.substr(0, file.size() - 4))
+      : std::nullopt;
+
+  auto const version_directory =
+    m_directory / name / (version ? version_triplet_to_string(*version) : "");
+
+  if (not version or
+      not std::filesystem::exists(version_directory / "info.scl"))
+    return write_http_error(fd, 404);
+
+  auto const archive = archive_of(version_directory);
+
+  threadsafe_print(std::format("sending <{}> {}{}\n",
+                               name,
+                               version_triplet_to_string(*version),
+                               request->range_start
+                                 ? std::format(" from byte {}",
+                                               *request->range_start)
+                                 : ""));
+
+  write_http_response(fd, *request, "application/x-tar", archive->archive);
+}
+
+void
+serve_packages(ThreadPool& threads,
+               std::filesystem::path const& directory,
+               unsigned const port)
+{
+  if (not std::filesystem::is_directory(directory))
+    throw std::runtime_error(
+      std::format("<{}> is not a directory", directory.string()));
+
+  int const listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener == -1)
+    throw std::runtime_error("unable to create a socket");
+
+  int const reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // only ever a stand-in, so it's not reachable from elsewhere
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(listener, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) ==
+        -1 or
+      listen(listener, 64) == -1) {
+    close(listener);
+    throw std::runtime_error(
+      std::format("unable to listen on port <{}>", port));
+  }
+
+  PackageServer server(directory);
+
+  threadsafe_print(std::format("serving <{}> on http://127.0.0.1:{}\n",
+                               directory.string(),
+                               port));
+
+  for (;;) {
+    int const fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+      if (errno == EINTR or errno == ECONNABORTED)
+        continue;
+      close(listener);
+      throw std::runtime_error("unable to accept a connection");
+    }
+
+    threads.add_job([&server, fd] {
+      try {
+        server.handle(fd);
+      } catch (std::exception const& e) {
+        threadsafe_print(std::format("ERROR: {}\n", e.what()));
+        write_http_error(fd, 500);
+      }
+
+      close(fd);
+      return true;
+    });
+  }
+}
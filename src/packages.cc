@@ -1,9 +1,14 @@
 #include "analysis.hh"
+#include "common.hh"
 #include "confs.hh"
+#include "lock.hh"
 #include "packages.hh"
 #include "paths.hh"
+#include "resolve.hh"
 #include <algorithm>
 #include <format>
+#include <map>
+#include <memory>
 #include <scl.hh>
 #include <stdexcept>
 
@@ -13,10 +18,9 @@
   directional graph.
 
   packages are differentiated by both name and version,
-  so multiple packages of the same name may show up in
-  a graph, but differ by version.
-
-
+  but only one version of a package may show up in a
+  graph. two static libraries of the same package
+  would only clash at link time anyway
 
   random thoughts:
     internal dependencies must only be publicly enumerated
@@ -26,63 +30,116 @@
 
 */
 
-// std::shared_ptr<Package>
-// construct_dependency_graph(std::string_view package_name,
-//                            version_triplet version)
-// {
-//   std::map<PackageIdentifier, std::shared_ptr<Package>> package_cache;
+std::span<version_triplet const>
+InstalledPackages::versions(std::string_view name)
+{
+  if (auto const found = m_versions.find(name); found != m_versions.end())
+    return found->second;
+
+  return m_versions.insert_or_assign(std::string(name), m_index.versions(name))
+    .first->second;
+}
+
+std::span<Dependency const>
+InstalledPackages::dependencies(std::string_view name,
+                                version_triplet const version)
+{
+  auto key = std::pair(std::string(name), version);
+
+  if (auto const found = m_dependencies.find(key);
+      found != m_dependencies.end())
+    return found->second;
 
-//   auto const add_to_cache = [&](PackageIdentifier const what) {
-//     std::shared_ptr<Package> pck(new Package());
-//     package_cache.insert_or_assign(what, pck);
-//     return pck;
-//   };
+  auto indexed = m_index.get(name, version);
 
-//   auto const insert_recurse = [&](PackageIdentifier const ident) {
-//     auto this_package = add_to_cache(ident);
+  if (not indexed)
+    throw std::runtime_error(
+      std::format("package <{}> version <{}> is not installed",
+                  name,
+                  version_triplet_to_string(version)));
 
-//     VersionManifest const manifest = open_version_manifest(package_name);
-//     if (not std::ranges::contains(manifest.versions, version))
-//       throw std::runtime_error(
-//         "version not found in package while constructing dependency");
+  return m_dependencies
+    .insert_or_assign(std::move(key), std::move(indexed->dependencies))
+    .first->second;
+}
 
-//     auto const versioned_package_dir = hewg_packages_directory / package_name
-//     /
-//                                        version_triplet_to_string(version);
+std::shared_ptr<Package>
+construct_dependency_graph(std::string_view package_name,
+                           version_triplet version)
+{
+  InstalledPackages installed;
+  std::vector<Dependency> const root = {
+    Dependency{ std::string(package_name), version, true },
+  };
 
-//     auto const info = get_package_info(package_name, version);
-//     for (auto const& dep : info.internal_deps) {
-//       if (not package_cache.contains(PackageIdentifier(dep)))
-//       // this_package->internal_dependencies.push_back(insert_recurse(dep));
-//     }
-//   };
+  // dependencies come first, so every
+  // package's dependencies already exist
+  std::map<std::string, std::shared_ptr<Package>> packages;
 
-//   // insert_recurse
-// }
+  for (auto const& resolved : resolve_dependencies(installed, root)) {
+    auto package = std::make_shared<Package>();
+    package->name = resolved.name;
+    package->version = resolved.version;
+
+    for (auto const& dependency : resolved.dependencies)
+      package->internal_dependencies.push_back(packages.at(dependency));
+
+    packages.insert_or_assign(resolved.name, std::move(package));
+  }
+
+  return packages.at(std::string(package_name));
+}
+
+std::vector<std::filesystem::path>
+get_package_include_directories(ConfigurationFile const& config)
+{
+  std::vector<std::filesystem::path> out;
+
+  for (auto const& package : get_locked_packages(config))
+    out.push_back(hewg_packages_directory / package.name /
+                  version_triplet_to_string(package.version) / "include");
+
+  return out;
+}
+
+bool
+is_safe_package_name(std::string_view const name)
+{
+  return not name.empty() and not name.starts_with('.') and
+         std::ranges::none_of(name, [](unsigned char const c) {
+           return c == '/' or c < 0x20 or c == 0x7f;
+         });
+}
 
 PackageInfo
-get_package_info(std::string_view name, version_triplet requested_version)
+read_package_info(std::filesystem::path const& version_directory)
 {
-  // auto const version_manifest = open_version_manifest(name);
-  auto const versioned_package_dir =
-    hewg_packages_directory / name /
-    version_triplet_to_string(requested_version);
-  auto const info_conf = versioned_package_dir / "info.scl";
+  auto const info_conf = version_directory / "info.scl";
+
+  if (not std::filesystem::exists(info_conf))
+    throw std::runtime_error(std::format("package <{}> has no info.scl",
+                                         version_directory.string()));
 
-  scl::file package_info_scl;
+  scl::file package_info_scl(read_file(info_conf));
   PackageInfo package_info;
   scl::deserialize(package_info, package_info_scl);
 
   return package_info;
 }
 
+PackageInfo
+get_package_info(std::string_view name, version_triplet requested_version)
+{
+  return read_package_info(hewg_packages_directory / name /
+                           version_triplet_to_string(requested_version));
+}
+
 std::optional<std::filesystem::path>
 try_get_compatable_package(std::string_view name,
                            version_triplet requested_version)
 {
-  auto const version_manifest = open_version_manifest(name);
-  auto const best_version =
-    select_best_compatable_semver(version_manifest.versions, requested_version);
+  PackageIndex const index;
+  auto const best_version = index.best_compatible(name, requested_version);
 
   if (not best_version)
     throw std::runtime_error(
@@ -95,35 +152,6 @@ try_get_compatable_package(std::string_view name,
          version_triplet_to_string(*best_version);
 }
 
-VersionManifest
-open_version_manifest(std::string_view package_name)
-{
-  auto const dir = hewg_packages_directory / package_name;
-  auto const version_manifest_file_path = dir / "manifest.json";
-
-  if (not std::filesystem::exists(dir))
-    throw std::runtime_error("attempting to open a version manifest in a "
-                             "package directory that doesn't exist");
-
-  std::stringstream ss;
-  ss << std::ifstream(version_manifest_file_path).rdbuf();
-  jayson::val v = jayson::val::parse(std::move(ss).str());
-  VersionManifest out;
-  jayson::deserialize(v, out);
-  return out;
-}
-
-void
-write_version_manifest(std::string_view package_name,
-                       VersionManifest const& manifest)
-{
-  auto const dir = hewg_packages_directory / package_name;
-  auto const version_manifest_file_path = dir / "manifest.json";
-
-  jayson::val v = jayson::serialize(manifest);
-  std::ofstream(version_manifest_file_path) << v.serialize();
-}
-
 std::filesystem::path
 add_version_to_package(std::string_view package_name,
                        version_triplet const version_triplet)
@@ -131,19 +159,9 @@ add_version_to_package(std::string_view package_name,
   auto const version_path = hewg_packages_directory / package_name /
                             version_triplet_to_string(version_triplet);
 
-  VersionManifest manifest = open_version_manifest(package_name);
-
-  auto const found =
-    std::find_if(manifest.versions.begin(),
-                 manifest.versions.end(),
-                 [=](auto const v) { return v == version_triplet; });
-
-  if (found == manifest.versions.end()) {
-    manifest.versions.push_back(version_triplet);
-    std::filesystem::create_directory(version_path);
-  }
-
-  write_version_manifest(package_name, manifest);
+  // only shows up in the package index
+  // once the install is finished
+  std::filesystem::create_directories(version_path);
 
   return version_path;
 }
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "digest.hh"
+#include "paths.hh"
+#include "pgo.hh"
+#include "thread_pool.hh"
+#include "toolchain.hh"
+
+/*
+  gcc writes a .gcda per object, named after the objects path.
+  the generate & use builds have separate cache folders, so the
+  cache folder gets stripped off with -fprofile-prefix-path
+
+  clang writes .profraw files, which have to be merged
+  into a single .profdata before a use build can read them
+*/
+
+auto constexpr merged_profile_name = "merged.profdata";
+
+std::string_view
+pgo_mode_to_string(PGOMode const mode)
+{
+  switch (mode) {
+    case PGOMode::Generate:
+      return "generate";
+    case PGOMode::Use:
+      return "use";
+  }
+
+  std::unreachable();
+}
+
+std::optional<PGOConf>
+get_pgo_conf(BuildOptions const& options,
+             std::string_view build_profile,
+             bool const pic)
+{
+  if (not options.pgo)
+    return std::nullopt;
+
+  PGOConf conf;
+
+  if (*options.pgo == "generate")
+    conf.mode = PGOMode::Generate;
+  else if (*options.pgo == "use")
+    conf.mode = PGOMode::Use;
+  else
+    throw std::runtime_error(std::format(
+      "pgo mode <{}> is invalid; it must be generate or use", *options.pgo));
+
+  conf.profile_folder = hewg_cache_path / "pgo" /
+                        std::format("{}{}{}",
+                                    build_profile,
+                                    pic ? "-pic" : "",
+                                    options.release ? "-rel" : "");
+
+  std::filesystem::create_directories(conf.profile_folder);
+
+  return conf;
+}
+
+static std::vector<std::filesystem::path>
+profile_files_with_extension(std::filesystem::path const& folder,
+                             std::string_view extension)
+{
+  std::vector<std::filesystem::path> out;
+
+  for (auto const& entry : std::filesystem::directory_iterator(folder))
+    if (entry.is_regular_file() and entry.path().extension() == extension)
+      out.push_back(entry.path());
+
+  // sorted, so the digest doesn't depend on directory order
+  std::ranges::sort(out);
+  return out;
+}
+
+void
+prepare_pgo_profile(ToolFile const& tools, PGOConf const& pgo)
+{
+  if (pgo.mode != PGOMode::Use)
+    return;
+
+  auto const no_profile_data = [&] {
+    return std::runtime_error(
+      std::format("no profile data in <{}>, build with --pgo=generate and "
+                  "run the result first",
+                  pgo.profile_folder.string()));
+  };
+
+  if (detect_toolchain(tools.cxx).family == CompilerFamily::GCC) {
+    if (profile_files_with_extension(pgo.profile_folder, ".gcda").empty())
+      throw no_profile_data();
+    return;
+  }
+
+  auto const merged = pgo.profile_folder / merged_profile_name;
+  auto const raw_profiles =
+    profile_files_with_extension(pgo.profile_folder, ".profraw");
+
+  if (raw_profiles.empty()) {
+    if (not std::filesystem::exists(merged))
+      throw no_profile_data();
+    return;
+  }
+
+  bool const stale =
+    not std::filesystem::exists(merged) or
+    std::ranges::any_of(raw_profiles, [&](auto const& raw) {
+      return std::filesystem::last_write_time(raw) >
+             std::filesystem::last_write_time(merged);
+    });
+
+  if (not stale)
+    return;
+
+  threadsafe_print("merging profile data...\n");
+
+  std::vector<std::string> args;
+  args.push_back("merge");
+  args.push_back("-o");
+  args.push_back(merged);
+  append_vec(args, raw_profiles);
+
+  auto const [exit_code, what] =
+    run_command(tools.profdata.value_or("llvm-profdata"), args);
+
+  if (exit_code != 0)
+    throw std::runtime_error(
+      std::format("merging profile data failed:\n{}", what));
+}
+
+std::vector<std::string>
+pgo_flags(std::string const& compiler,
+          PGOConf const& pgo,
+          std::filesystem::path const& cache_folder)
+{
+  auto const folder = std::filesystem::absolute(pgo.profile_folder);
+
+  if (detect_toolchain(compiler).family == CompilerFamily::Clang) {
+    if (pgo.mode == PGOMode::Generate)
+      return { std::format("-fprofile-generate={}", folder.string()) };
+
+    return {
+      std::format("-fprofile-use={}", (folder / merged_profile_name).string()),
+      // new or edited functions just don't get optimized
+      "-Wno-profile-instr-unprofiled",
+      "-Wno-profile-instr-out-of-date",
+    };
+  }
+
+  auto const prefix =
+    std::format("-fprofile-prefix-path={}",
+                std::filesystem::absolute(cache_folder).string());
+
+  if (pgo.mode == PGOMode::Generate)
+    return {
+      std::format("-fprofile-generate={}", folder.string()),
+      // the instrumented binary may well be multithreaded
+      "-fprofile-update=atomic",
+      prefix,
+    };
+
+  return {
+    std::format("-fprofile-use={}", folder.string()),
+    prefix,
+    "-Wno-missing-profile",
+  };
+}
+
+std::string
+pgo_profile_digest(std::string const& compiler, PGOConf const& pgo)
+{
+  if (detect_toolchain(compiler).family == CompilerFamily::Clang) {
+    auto const merged = pgo.profile_folder / merged_profile_name;
+    return std::filesystem::exists(merged) ? digest_file(merged) : "";
+  }
+
+  Digest digest;
+
+  for (auto const& gcda :
+       profile_files_with_extension(pgo.profile_folder, ".gcda")) {
+    digest.update(gcda.filename().string()).update(std::string_view("\0", 1));
+    digest.update(digest_file(gcda)).update(std::string_view("\0", 1));
+  }
+
+  return digest.finish();
+}
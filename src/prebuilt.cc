@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <jayson.hh>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "analysis.hh"
+#include "common.hh"
+#include "confs.hh"
+#include "digest.hh"
+#include "lock.hh"
+#include "packages.hh"
+#include "paths.hh"
+#include "prebuilt.hh"
+#include "thread_pool.hh"
+#include "toolchain.hh"
+
+constexpr auto artifacts_name = "artifacts.json";
+
+// flags that make objects unsafe to link with ones built without them.
+// anything else, e.g. optimization or warnings, can be mixed freely
+static bool
+affects_abi(std::string_view const flag)
+{
+  constexpr auto prefixes = std::array<std::string_view, 6>{
+    "-m",         "-fsanitize", "-D_GLIBCXX_",
+    "-D_LIBCPP_", "-stdlib=",   "-fabi-version",
+  };
+  constexpr auto exact = std::array<std::string_view, 6>{
+    "-fexceptions", "-fno-exceptions", "-frtti",
+    "-fno-rtti",    "-fshort-enums",   "-fpack-struct",
+  };
+
+  auto const has_prefix = [&](auto const prefix) {
+    return flag.starts_with(prefix);
+  };
+
+  return std::ranges::any_of(prefixes, has_prefix) or
+         std::ranges::contains(exact, flag);
+}
+
+static std::vector<std::string>
+abi_flags_of(std::vector<std::string> const& flags)
+{
+  std::vector<std::string> out;
+  std::ranges::copy_if(flags, std::back_inserter(out), affects_abi);
+  return out;
+}
+
+ArtifactKey
+artifact_key(ConfigurationFile const& config,
+             ToolFile const& tools,
+             bool const release,
+             bool const pic)
+{
+  auto abi_flags = abi_flags_of(config.cxx.flags);
+  auto const c_abi_flags = abi_flags_of(config.c.flags);
+  abi_flags.insert(abi_flags.end(), c_abi_flags.begin(), c_abi_flags.end());
+
+  // the order they're given in doesn't matter to the abi
+  std::ranges::sort(abi_flags);
+
+  Digest digest;
+  for (auto const& flag : abi_flags)
+    digest.update(flag).update(std::string_view("\0", 1));
+
+  return ArtifactKey{
+    config.tools.tool_profile_name,
+    toolchain_identity(tools.cxx),
+    release,
+    pic,
+    digest.finish(),
+  };
+}
+
+std::string
+digest_artifact_key(ArtifactKey const& key)
+{
+  return digest_string(jayson::serialize(key).serialize());
+}
+
+void
+write_built_artifacts(ConfigurationFile const& config,
+                      ToolFile const& tools,
+                      bool const release,
+                      std::filesystem::path const& target_folder)
+{
+  BuiltArtifacts out;
+
+  // with pic_only, the plain archive holds PIC objects too,
+  // which links just as well where those aren't needed
+  for (bool const pic : { false, true })
+    out.artifacts.push_back(
+      BuiltArtifact{ static_library_name_for_project(config, pic),
+                     artifact_key(config, tools, release, pic) });
+
+  std::ofstream(target_folder / artifacts_name)
+    << jayson::serialize(out).serialize();
+}
+
+std::vector<BuiltArtifact>
+read_built_artifacts(std::filesystem::path const& target_folder)
+{
+  auto const path = target_folder / artifacts_name;
+  if (not std::filesystem::exists(path))
+    return {};
+
+  BuiltArtifacts out;
+  jayson::deserialize(jayson::val::parse(read_file(path)), out);
+  return out.artifacts;
+}
+
+// the installed sources are read only links into the store,
+// which is fine since building never writes to them
+static void
+copy_package_sources(std::filesystem::path const& from,
+                     std::filesystem::path const& to)
+{
+  using enum std::filesystem::copy_options;
+
+  std::error_code ec;
+  std::filesystem::copy(
+    from, to, recursive | create_hard_links | skip_existing, ec);
+
+  // e.g. .hcache is on another filesystem than the store
+  if (ec)
+    std::filesystem::copy(from, to, recursive | skip_existing);
+}
+
+// passed on through the environment, see get_config_file
+static std::string
+abi_flags_variable(ConfigurationFile const& config,
+                   std::string_view const variable,
+                   std::vector<std::string> const& flags)
+{
+  std::string out = std::format("{}=", variable);
+
+  for (auto const& flag : abi_flags_of(flags)) {
+    if (flag.contains(' '))
+      throw std::runtime_error(std::format(
+        "flag <{}> of <{}> has a space in it, so packages can't be built "
+        "from source with it",
+        flag,
+        config.project.name));
+
+    out.append(flag).push_back(' ');
+  }
+
+  return out;
+}
+
+// built with the dependent's abi flags on top of the package's own,
+// or its objects couldn't be linked with the dependent's
+static std::filesystem::path
+build_package_from_source(ConfigurationFile const& config,
+                          LockedPackage const& package,
+                          std::filesystem::path const& version_directory,
+                          std::string_view const build_profile,
+                          std::string_view const key,
+                          bool const release,
+                          bool const pic)
+{
+  auto const version = version_triplet_to_string(package.version);
+  auto const source = version_directory / "source";
+
+  if (not std::filesystem::exists(source / "hewg.scl"))
+    throw std::runtime_error(std::format(
+      "package <{}> {} has no archive built like this project, and was "
+      "installed without the sources to build one",
+      package.name,
+      version));
+
+  // a different digest is a different package, even at the same version,
+  // and every artifact key gets a build of its own
+  auto const scratch = hewg_cache_path / "packages" /
+                       std::format("{}-{}-{}",
+                                   package.name,
+                                   version,
+                                   package.digest.substr(0, 16)) /
+                       key.substr(0, 16);
+
+  auto const archive = scratch / "target" / build_profile /
+                       static_library_name(package.name, pic);
+  auto const stamp = scratch / std::format(".built-{}", build_profile);
+
+  if (std::filesystem::exists(stamp) and std::filesystem::exists(archive))
+    return archive;
+
+  threadsafe_print(std::format(
+    "building package <{}> {} from source...\n", package.name, version));
+
+  std::filesystem::create_directories(scratch);
+  copy_package_sources(source, scratch);
+
+  // the package is built by this same hewg, in its own directory
+  auto const hewg = std::filesystem::read_symlink("/proc/self/exe");
+
+  std::vector<std::string> args{
+    "-C",
+    scratch.string(),
+    abi_flags_variable(config, cxx_abi_flags_variable, config.cxx.flags),
+    abi_flags_variable(config, c_abi_flags_variable, config.c.flags),
+    hewg.string(),
+    "--skip",
+    "build",
+    std::string(build_profile),
+  };
+  if (release)
+    args.push_back("--release");
+
+  auto const [exit_code, output] = run_command("env", args);
+
+  if (exit_code != 0 or not std::filesystem::exists(archive)) {
+    threadsafe_print(output);
+    throw std::runtime_error(std::format(
+      "building package <{}> {} from source failed", package.name, version));
+  }
+
+  std::ofstream(stamp) << package.digest;
+  return archive;
+}
+
+std::vector<std::filesystem::path>
+get_package_archives(ConfigurationFile const& config,
+                     ToolFile const& tools,
+                     std::string_view const build_profile,
+                     bool const release,
+                     bool const pic)
+{
+  auto const key =
+    digest_artifact_key(artifact_key(config, tools, release, pic));
+
+  auto const packages = get_locked_packages(config);
+  std::vector<std::filesystem::path> out;
+
+  // a static library's undefined symbols are only looked
+  // up in the archives that come after it
+  for (auto const& package : packages | std::views::reverse) {
+    auto const version_directory = hewg_packages_directory / package.name /
+                                   version_triplet_to_string(package.version);
+
+    if (read_package_info(version_directory).meta.type !=
+        ProjectType::StaticLibrary)
+      continue;
+
+    auto const prebuilt = version_directory / "prebuilt" / key /
+                          static_library_name(package.name, pic);
+
+    if (std::filesystem::exists(prebuilt)) {
+      threadsafe_print_verbose(
+        std::format("using prebuilt <{}>\n", prebuilt.string()));
+      out.push_back(prebuilt);
+      continue;
+    }
+
+    out.push_back(build_package_from_source(config,
+                                            package,
+                                            version_directory,
+                                            build_profile,
+                                            key,
+                                            release,
+                                            pic));
+  }
+
+  return out;
+}
@@ -0,0 +1,567 @@
+#include <algorithm>
+#include <deque>
+#include <format>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "confs.hh"
+#include "resolve.hh"
+
+bool
+requirement_allows(Dependency const& requirement, version_triplet const version)
+{
+  if (requirement.exact)
+    return version == requirement.version;
+
+  auto const [rmaj, rmin, _rpat] = requirement.version;
+  auto const [maj, min, _pat] = version;
+
+  // same rules as semantically_valid(), the major
+  // version must match and the minor can only go up
+  return maj == rmaj and min >= rmin;
+}
+
+static std::string
+describe_requirement(Dependency const& requirement)
+{
+  auto const version = version_triplet_to_string(requirement.version);
+
+  if (requirement.exact)
+    return std::format("<{}> exactly {}", requirement.name, version);
+
+  return std::format("<{}> compatible with {}", requirement.name, version);
+}
+
+namespace {
+
+// packages are numbered in the order they're first required,
+// which keeps which one gets decided next deterministic
+using PackageId = std::size_t;
+
+struct Selection
+{
+  PackageId package;
+  version_triplet version;
+};
+
+struct Requirement
+{
+  Dependency dependency;
+
+  // index of the decision that required it,
+  // nullopt for the project's own requirements
+  std::optional<std::size_t> from;
+};
+
+struct Decision
+{
+  Selection selection;
+  std::span<Dependency const> dependencies;
+};
+
+// selections that can't all be made at once
+struct Incompatibility
+{
+  std::vector<Selection> terms;
+  std::string cause;
+
+  // the incompatibilities this one was derived from
+  std::vector<std::size_t> derived_from;
+};
+
+// why every version of a package is ruled out
+struct Conflict
+{
+  std::set<std::size_t> decisions;
+  std::set<std::size_t> incompatibilities;
+  std::vector<std::string> reasons;
+};
+
+struct PackageState
+{
+  std::string name;
+  std::span<version_triplet const> versions;
+
+  // oldest first
+  std::vector<Requirement> requirements;
+
+  // index into the decisions
+  std::optional<std::size_t> decided;
+
+  // indices of the incompatibilities it's a term of
+  std::vector<std::size_t> incompatibilities;
+};
+
+class Resolver
+{
+  PackageSource& m_source;
+
+  std::vector<PackageState> m_packages;
+  std::unordered_map<std::string, PackageId> m_ids;
+
+  std::vector<Decision> m_decisions;
+  std::vector<Incompatibility> m_incompatibilities;
+
+  // packages whose candidates may have changed since they
+  // were last looked at, and the ones that had a choice left.
+  // so only what changed gets looked at again
+  std::deque<PackageId> m_dirty;
+  std::vector<bool> m_is_dirty;
+  std::set<PackageId> m_open;
+
+  // a decision whose requirements rule
+  // out an earlier one, and on what package
+  std::optional<std::pair<PackageId, Conflict>> m_clash;
+
+  PackageId id_of(std::string const& name)
+  {
+    auto const [found, inserted] = m_ids.try_emplace(name, m_packages.size());
+
+    if (inserted) {
+      m_packages.push_back(PackageState{
+        name, m_source.versions(name), {}, std::nullopt, {} });
+      m_is_dirty.push_back(false);
+    }
+
+    return found->second;
+  }
+
+  void mark_dirty(PackageId const package)
+  {
+    if (m_is_dirty[package])
+      return;
+
+    m_is_dirty[package] = true;
+    m_dirty.push_back(package);
+  }
+
+  std::string describe(Selection const& selection) const
+  {
+    return std::format("<{}> {}",
+                       m_packages[selection.package].name,
+                       version_triplet_to_string(selection.version));
+  }
+
+  std::string describe_origin(Requirement const& requirement) const
+  {
+    if (not requirement.from)
+      return "the project";
+    return describe(m_decisions[*requirement.from].selection);
+  }
+
+  void add_requirement(Requirement requirement)
+  {
+    auto const package = id_of(requirement.dependency.name);
+
+    mark_dirty(package);
+    m_packages[package].requirements.push_back(std::move(requirement));
+  }
+
+  // everything sharing an incompatibility with package
+  void mark_related_dirty(PackageId const package)
+  {
+    for (auto const index : m_packages[package].incompatibilities)
+      for (auto const& term : m_incompatibilities[index].terms)
+        if (term.package != package)
+          mark_dirty(term.package);
+  }
+
+  bool holds(Selection const& term) const
+  {
+    auto const decided = m_packages[term.package].decided;
+    return decided and m_decisions[*decided].selection.version == term.version;
+  }
+
+  // the incompatibility that rules out package at
+  // version, given everything decided so far
+  std::optional<std::size_t> ruled_out_by(PackageId const package,
+                                          version_triplet const version) const
+  {
+    for (auto const index : m_packages[package].incompatibilities) {
+      bool const ruled_out =
+        std::ranges::all_of(m_incompatibilities[index].terms, [&](auto& term) {
+          if (term.package == package)
+            return term.version == version;
+          return holds(term);
+        });
+
+      if (ruled_out)
+        return index;
+    }
+
+    return std::nullopt;
+  }
+
+  // versions nothing rules out, newest first.
+  // stops looking after limit of them are found, 0 for no limit.
+  // with a conflict, notes down why the others are out
+  std::vector<version_triplet> candidates(PackageId const package,
+                                          std::size_t const limit,
+                                          Conflict* const conflict) const
+  {
+    auto const& state = m_packages[package];
+
+    if (state.versions.empty() and conflict != nullptr)
+      conflict->reasons.push_back(
+        std::format("no version of <{}> is available", state.name));
+
+    std::vector<version_triplet> out;
+    std::set<std::size_t> noted_requirements;
+
+    for (auto it = state.versions.rbegin(); it != state.versions.rend(); it++) {
+      // the project's requirements come first,
+      // those are always the cheapest culprit
+      auto const refused =
+        std::ranges::find_if(state.requirements, [&](auto const& requirement) {
+          return not requirement_allows(requirement.dependency, *it);
+        });
+
+      if (refused != state.requirements.end()) {
+        if (conflict == nullptr)
+          continue;
+
+        auto const index = refused - state.requirements.begin();
+        if (not noted_requirements.insert(index).second)
+          continue;
+
+        if (refused->from)
+          conflict->decisions.insert(*refused->from);
+
+        conflict->reasons.push_back(
+          std::format("{}, required by {}",
+                      describe_requirement(refused->dependency),
+                      describe_origin(*refused)));
+        continue;
+      }
+
+      auto const incompatibility = ruled_out_by(package, *it);
+
+      if (not incompatibility) {
+        out.push_back(*it);
+        if (out.size() == limit)
+          break;
+        continue;
+      }
+
+      if (conflict == nullptr)
+        continue;
+
+      for (auto const& term : m_incompatibilities[*incompatibility].terms)
+        if (term.package != package)
+          conflict->decisions.insert(*m_packages[term.package].decided);
+
+      if (conflict->incompatibilities.insert(*incompatibility).second)
+        conflict->reasons.push_back(std::format(
+          "{} is ruled out, see below", describe(Selection{ package, *it })));
+    }
+
+    return out;
+  }
+
+  void decide(PackageId const package, version_triplet const version)
+  {
+    auto const index = m_decisions.size();
+    Selection const selection{ package, version };
+
+    m_decisions.push_back(Decision{
+      selection,
+      m_source.dependencies(m_packages[package].name, version),
+    });
+    m_packages[package].decided = index;
+    m_open.erase(package);
+    mark_related_dirty(package);
+
+    for (auto const& dependency : m_decisions[index].dependencies) {
+      add_requirement(Requirement{ dependency, index });
+
+      // may rule out a package that's already decided
+      auto const decided = m_packages[id_of(dependency.name)].decided;
+      if (m_clash or not decided or
+          requirement_allows(dependency,
+                             m_decisions[*decided].selection.version))
+        continue;
+
+      Conflict clash;
+      clash.decisions = { *decided, index };
+      clash.reasons.push_back(std::format("{}, required by {}",
+                                          describe_requirement(dependency),
+                                          describe(selection)));
+      clash.reasons.push_back(std::format(
+        "{} was already picked", describe(m_decisions[*decided].selection)));
+
+      m_clash = std::pair(id_of(dependency.name), std::move(clash));
+    }
+  }
+
+  // undoes every decision from index on
+  void backjump(std::size_t const index)
+  {
+    while (m_decisions.size() > index) {
+      auto const& undone = m_decisions.back();
+
+      // they were the last requirements added
+      for (auto const& dependency : undone.dependencies)
+        m_packages[m_ids.at(dependency.name)].requirements.pop_back();
+
+      auto const package = undone.selection.package;
+      m_packages[package].decided = std::nullopt;
+      mark_dirty(package);
+      mark_related_dirty(package);
+
+      m_decisions.pop_back();
+    }
+  }
+
+  // every cause an incompatibility was derived from,
+  // in the order they were learned
+  std::vector<std::string> causes_of(std::set<std::size_t> pending) const
+  {
+    std::set<std::size_t> seen;
+
+    while (not pending.empty()) {
+      auto const index = *pending.begin();
+      pending.erase(pending.begin());
+
+      if (not seen.insert(index).second)
+        continue;
+
+      for (auto const derived : m_incompatibilities[index].derived_from)
+        pending.insert(derived);
+    }
+
+    std::vector<std::string> out;
+    for (auto const index : seen)
+      out.push_back(m_incompatibilities[index].cause);
+
+    return out;
+  }
+
+  [[noreturn]] void fail(PackageId const package,
+                         Conflict const& conflict) const
+  {
+    std::string what =
+      std::format("unable to resolve dependencies, no version of <{}> works:\n",
+                  m_packages[package].name);
+
+    for (auto const& reason : conflict.reasons)
+      what += std::format("  {}\n", reason);
+
+    for (auto const& cause : causes_of(conflict.incompatibilities))
+      what += cause;
+
+    throw std::runtime_error(what);
+  }
+
+  void learn(PackageId const package, Conflict const& conflict)
+  {
+    Incompatibility learned;
+    learned.derived_from.assign(conflict.incompatibilities.begin(),
+                                conflict.incompatibilities.end());
+
+    std::string together;
+    for (auto const decision : conflict.decisions) {
+      learned.terms.push_back(m_decisions[decision].selection);
+
+      if (not together.empty())
+        together += " and ";
+      together += describe(m_decisions[decision].selection);
+    }
+
+    learned.cause =
+      std::format("{} can't be used{}, no version of <{}> works:\n",
+                  together,
+                  learned.terms.size() > 1 ? " together" : "",
+                  m_packages[package].name);
+
+    for (auto const& reason : conflict.reasons)
+      learned.cause += std::format("  {}\n", reason);
+
+    auto const index = m_incompatibilities.size();
+    for (auto const& term : learned.terms) {
+      m_packages[term.package].incompatibilities.push_back(index);
+      mark_dirty(term.package);
+    }
+
+    m_incompatibilities.push_back(std::move(learned));
+  }
+
+  // false once every required package is decided
+  bool step()
+  {
+    if (m_clash) {
+      auto const [package, conflict] = *std::exchange(m_clash, std::nullopt);
+
+      learn(package, conflict);
+      backjump(*conflict.decisions.rbegin());
+      return true;
+    }
+
+    while (not m_dirty.empty()) {
+      auto const package = m_dirty.front();
+      m_dirty.pop_front();
+      m_is_dirty[package] = false;
+
+      auto const& state = m_packages[package];
+
+      if (state.decided or state.requirements.empty()) {
+        m_open.erase(package);
+        continue;
+      }
+
+      // only the difference between none,
+      // one and many candidates matters
+      auto const found = candidates(package, 2, nullptr);
+
+      if (found.empty()) {
+        Conflict conflict;
+        candidates(package, 0, &conflict);
+
+        // nothing decided caused it,
+        // so no amount of backtracking helps
+        if (conflict.decisions.empty())
+          fail(package, conflict);
+
+        // still needs deciding once it has a choice again
+        mark_dirty(package);
+
+        learn(package, conflict);
+        backjump(*conflict.decisions.rbegin());
+        return true;
+      }
+
+      // no choice to be made, might as well do it now
+      if (found.size() == 1) {
+        decide(package, found.front());
+        return true;
+      }
+
+      m_open.insert(package);
+    }
+
+    if (m_open.empty())
+      return false;
+
+    auto const package = *m_open.begin();
+    decide(package, candidates(package, 1, nullptr).front());
+    return true;
+  }
+
+public:
+  explicit Resolver(PackageSource& source)
+    : m_source(source)
+  {
+  }
+
+  // the version picked for each package, and its dependencies
+  std::vector<std::pair<Selection, std::span<Dependency const>>> solve(
+    std::span<Dependency const> requirements)
+  {
+    for (auto const& requirement : requirements)
+      add_requirement(Requirement{ requirement, std::nullopt });
+
+    while (step())
+      ;
+
+    std::vector<std::pair<Selection, std::span<Dependency const>>> out;
+    for (auto const& decision : m_decisions)
+      out.emplace_back(decision.selection, decision.dependencies);
+
+    return out;
+  }
+
+  std::string const& name_of(PackageId const package) const
+  {
+    return m_packages[package].name;
+  }
+};
+
+}
+
+namespace {
+
+// orders packages so that dependencies come first
+class DependenciesFirst
+{
+  enum class Mark
+  {
+    Visiting,
+    Done,
+  };
+
+  std::map<std::string, ResolvedPackage> const& m_packages;
+  std::map<std::string, Mark> m_marks;
+  std::vector<std::string> m_path;
+
+public:
+  std::vector<ResolvedPackage> out;
+
+  explicit DependenciesFirst(
+    std::map<std::string, ResolvedPackage> const& packages)
+    : m_packages(packages)
+  {
+  }
+
+  void visit(std::string const& name)
+  {
+    auto const mark = m_marks.find(name);
+
+    if (mark != m_marks.end() and mark->second == Mark::Done)
+      return;
+
+    m_path.push_back(name);
+
+    if (mark != m_marks.end()) {
+      std::string cycle;
+      for (auto it = std::ranges::find(m_path, name); it != m_path.end(); it++)
+        cycle +=
+          std::format("<{}>{}", *it, it + 1 == m_path.end() ? "" : " -> ");
+
+      throw std::runtime_error(
+        std::format("packages depend on each other in a cycle, {}", cycle));
+    }
+
+    m_marks.insert_or_assign(name, Mark::Visiting);
+
+    for (auto const& dependency : m_packages.at(name).dependencies)
+      visit(dependency);
+
+    m_marks.insert_or_assign(name, Mark::Done);
+    m_path.pop_back();
+    out.push_back(m_packages.at(name));
+  }
+};
+
+}
+
+std::vector<ResolvedPackage>
+resolve_dependencies(PackageSource& source,
+                     std::span<Dependency const> requirements)
+{
+  Resolver resolver(source);
+
+  std::map<std::string, ResolvedPackage> resolved;
+
+  for (auto const& [selection, dependencies] : resolver.solve(requirements)) {
+    auto const& name = resolver.name_of(selection.package);
+    ResolvedPackage package{ name, selection.version, {} };
+
+    for (auto const& dependency : dependencies)
+      if (std::ranges::find(package.dependencies, dependency.name) ==
+          package.dependencies.end())
+        package.dependencies.push_back(dependency.name);
+
+    resolved.insert_or_assign(name, std::move(package));
+  }
+
+  DependenciesFirst sorted(resolved);
+  for (auto const& [name, _] : resolved)
+    sorted.visit(name);
+
+  return std::move(sorted.out);
+}
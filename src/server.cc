@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "build.hh"
+#include "cmdline.hh"
+#include "common.hh"
+#include "confs.hh"
+#include "paths.hh"
+#include "server.hh"
+#include "thread_pool.hh"
+
+/*
+  the server keeps the thread pool, parsed configs & tool files,
+  and parsed depfiles alive between builds
+
+  the protocol is plain text over a unix socket.
+  a client sends one request, then shuts down its write end:
+
+    build\n<profile>\n<release 0/1>\n<verbose 0/1>\n
+    stop\n
+
+  the server streams back whatever the build prints,
+  then a null byte followed by the exit code
+*/
+
+// sun_path is only ~108 bytes, so bind through the
+// relative path. we're always run from the project root
+static sockaddr_un
+server_address()
+{
+  auto const path = hewg_server_socket_path.lexically_relative(
+    std::filesystem::current_path());
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+
+  if (path.native().size() >= sizeof(addr.sun_path))
+    throw std::runtime_error(
+      std::format("server socket path <{}> is too long", path.string()));
+
+  std::strcpy(addr.sun_path, path.c_str());
+  return addr;
+}
+
+static int
+connect_to_server()
+{
+  int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  auto const addr = server_address();
+  if (connect(fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) ==
+      -1) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static bool
+write_all(int const fd, std::string_view data)
+{
+  while (not data.empty()) {
+    auto const written = write(fd, data.data(), data.size());
+    if (written <= 0)
+      return false;
+    data.remove_prefix(written);
+  }
+
+  return true;
+}
+
+static std::string
+read_all(int const fd)
+{
+  std::string out;
+  char buf[4096];
+
+  for (;;) {
+    auto const len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+    out.append(buf, len);
+  }
+
+  return out;
+}
+
+// sends a request, streams the reply to stdout
+// and returns the exit code at the end of it
+static std::optional<int>
+send_request(std::string_view request)
+{
+  int const fd = connect_to_server();
+  if (fd == -1)
+    return std::nullopt;
+
+  if (not write_all(fd, request)) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  shutdown(fd, SHUT_WR);
+
+  std::string tail;
+  bool in_tail = false;
+  char buf[4096];
+
+  for (;;) {
+    auto const len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+
+    std::string_view chunk(buf, len);
+
+    if (not in_tail) {
+      auto const end = chunk.find('\0');
+      std::cout.write(chunk.data(), std::min(end, chunk.size()));
+      std::cout.flush();
+
+      if (end == std::string_view::npos)
+        continue;
+
+      in_tail = true;
+      chunk.remove_prefix(end + 1);
+    }
+
+    tail.append(chunk);
+  }
+
+  close(fd);
+
+  // the server died mid-build
+  if (not in_tail)
+    return std::nullopt;
+
+  return std::stoi(tail);
+}
+
+std::optional<int>
+forward_build_to_server(BuildOptions const& options,
+                        std::string_view build_profile)
+{
+  if (not std::filesystem::exists(hewg_server_socket_path))
+    return std::nullopt;
+
+  return send_request(std::format("build\n{}\n{:d}\n{:d}\n",
+                                  build_profile,
+                                  options.release,
+                                  verbose_output));
+}
+
+bool
+stop_server()
+{
+  if (not std::filesystem::exists(hewg_server_socket_path))
+    return false;
+
+  return send_request("stop\n").has_value();
+}
+
+// the config & tool file parsed for a profile, kept until
+// either file is modified
+struct LoadedProfile
+{
+  ConfigurationFile config;
+  ToolFile tools;
+
+  std::filesystem::file_time_type config_time;
+  std::filesystem::path tool_path;
+  std::filesystem::file_time_type tool_time;
+};
+
+static LoadedProfile const&
+load_profile(std::map<std::string, LoadedProfile>& profiles,
+             ToplevelOptions const& tl_options,
+             std::filesystem::path const& config_path,
+             std::string const& build_profile)
+{
+  auto const config_time = std::filesystem::last_write_time(config_path);
+
+  if (auto const found = profiles.find(build_profile);
+      found != profiles.end()) {
+    auto const& loaded = found->second;
+
+    if (loaded.config_time == config_time and
+        std::filesystem::exists(loaded.tool_path) and
+        loaded.tool_time == std::filesystem::last_write_time(loaded.tool_path))
+      return loaded;
+
+    threadsafe_print_verbose(
+      std::format("reloading configuration for <{}>\n", build_profile));
+  }
+
+  LoadedProfile loaded;
+  loaded.config = get_config_file(tl_options, config_path, build_profile);
+  loaded.tools = get_tool_file(loaded.config, build_profile);
+  loaded.config_time = config_time;
+  loaded.tool_path = get_tool_file_path(loaded.config);
+  loaded.tool_time = std::filesystem::last_write_time(loaded.tool_path);
+
+  return profiles.insert_or_assign(build_profile, std::move(loaded))
+    .first->second;
+}
+
+static std::vector<std::string>
+split_lines(std::string_view const request)
+{
+  std::vector<std::string> lines;
+
+  for (auto const line : std::views::split(request, '\n'))
+    lines.emplace_back(line.begin(), line.end());
+
+  if (not lines.empty() and lines.back().empty())
+    lines.pop_back();
+
+  return lines;
+}
+
+static int
+run_build_request(ThreadPool& threads,
+                  std::map<std::string, LoadedProfile>& profiles,
+                  ToplevelOptions const& tl_options,
+                  std::filesystem::path const& config_path,
+                  std::span<std::string const> args)
+{
+  if (args.size() != 3)
+    throw std::runtime_error("malformed build request sent to server");
+
+  auto const& build_profile = args[0];
+
+  BuildOptions options;
+  options.release = args[1] == "1";
+  verbose_output = args[2] == "1";
+
+  auto const& loaded =
+    load_profile(profiles, tl_options, config_path, build_profile);
+
+  build(threads, loaded.config, loaded.tools, options, build_profile);
+
+  return 0;
+}
+
+void
+serve(ThreadPool& threads,
+      ToplevelOptions const& tl_options,
+      std::filesystem::path const& config_path)
+{
+  create_directory_checked(hewg_cache_path);
+
+  // a leftover socket from a server that died
+  // refuses connections, a live one doesn't
+  if (int const existing = connect_to_server(); existing != -1) {
+    close(existing);
+    throw std::runtime_error("a hewg server is already running here");
+  }
+
+  std::filesystem::remove(hewg_server_socket_path);
+
+  int const listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener == -1)
+    throw std::runtime_error("unable to create server socket");
+
+  auto const addr = server_address();
+  if (bind(listener, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) ==
+        -1 or
+      listen(listener, 8) == -1) {
+    close(listener);
+    throw std::runtime_error(std::format("unable to listen on <{}>",
+                                         hewg_server_socket_path.string()));
+  }
+
+  // a client going away mid-build
+  // shouldn't take the server with it
+  std::signal(SIGPIPE, SIG_IGN);
+
+  bool const server_verbose = verbose_output;
+  int const server_stdout = dup(STDOUT_FILENO);
+
+  threadsafe_print(std::format("serving builds on <{}>\n",
+                               hewg_server_socket_path.string()));
+
+  std::map<std::string, LoadedProfile> profiles;
+
+  for (bool running = true; running;) {
+    int const client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1)
+      continue;
+
+    auto const lines = split_lines(read_all(client));
+
+    // everything printed while handling the request goes to the client
+    std::cout.flush();
+    dup2(client, STDOUT_FILENO);
+
+    int exit_code = 0;
+
+    try {
+      if (lines.empty())
+        throw std::runtime_error("empty request sent to server");
+
+      if (lines[0] == "stop") {
+        threadsafe_print("server stopping\n");
+        running = false;
+      } else if (lines[0] == "build") {
+        exit_code = run_build_request(threads,
+                                      profiles,
+                                      tl_options,
+                                      config_path,
+                                      std::span(lines).subspan(1));
+      } else
+        throw std::runtime_error(
+          std::format("unknown server request <{}>", lines[0]));
+    } catch (std::exception const& e) {
+      threadsafe_print("ERROR: ", e.what(), '\n');
+      exit_code = 1;
+    }
+
+    std::cout.flush();
+    std::cout.clear();
+    write_all(client, std::format("{}{}", '\0', exit_code));
+
+    dup2(server_stdout, STDOUT_FILENO);
+    verbose_output = server_verbose;
+    close(client);
+  }
+
+  close(listener);
+  close(server_stdout);
+  std::filesystem::remove(hewg_server_socket_path);
+}
@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <jayson.hh>
+#include <linux/fs.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "common.hh"
+#include "digest.hh"
+#include "paths.hh"
+#include "store.hh"
+
+// the files of a version directory that aren't stored
+constexpr auto manifest_name = "files.json";
+constexpr auto info_name = "info.scl";
+
+static int
+lock_store(int const operation)
+{
+  std::filesystem::create_directories(hewg_store_directory);
+
+  int const fd = open(hewg_store_lock_path.get().c_str(),
+                      O_RDWR | O_CREAT | O_CLOEXEC,
+                      0644);
+
+  if (fd == -1 or flock(fd, operation) == -1) {
+    if (fd != -1)
+      close(fd);
+    throw std::runtime_error(std::format(
+      "unable to lock the package store <{}>", hewg_store_lock_path.string()));
+  }
+
+  return fd;
+}
+
+static std::filesystem::path
+blob_path(std::string const& digest, bool const executable)
+{
+  // spread out, so no one directory gets huge
+  return hewg_store_directory / digest.substr(0, 2) /
+         (executable ? digest + ".x" : digest);
+}
+
+static bool
+is_executable(std::filesystem::path const& path)
+{
+  auto const perms = std::filesystem::status(path).permissions();
+  return (perms & std::filesystem::perms::owner_exec) !=
+         std::filesystem::perms::none;
+}
+
+static std::filesystem::perms
+blob_permissions(bool const executable)
+{
+  return executable ? std::filesystem::perms(0555)
+                    : std::filesystem::perms(0444);
+}
+
+// somewhere next to path to write it before renaming it into place
+static std::filesystem::path
+temporary_next_to(std::filesystem::path const& path)
+{
+  static std::atomic<unsigned> counter = 0;
+
+  return path.parent_path() / std::format(".{}.tmp-{}-{}",
+                                          path.filename().string(),
+                                          getpid(),
+                                          counter++);
+}
+
+// shares the blocks of from without sharing its inode,
+// on filesystems that can
+static bool
+try_reflink(std::filesystem::path const& from, std::filesystem::path const& to)
+{
+  int const in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in == -1)
+    return false;
+
+  int const out =
+    open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out == -1) {
+    close(in);
+    return false;
+  }
+
+  bool const cloned = ioctl(out, FICLONE, in) == 0;
+  close(in);
+  close(out);
+
+  if (not cloned)
+    std::filesystem::remove(to);
+
+  return cloned;
+}
+
+// copies inside the kernel, so the contents never pass through
+// userspace. copy_file_range can still share blocks on some
+// filesystems, sendfile works between any two files
+static bool
+try_kernel_copy(std::filesystem::path const& from,
+                std::filesystem::path const& to)
+{
+  int const in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in == -1)
+    return false;
+
+  struct stat st;
+  int const out =
+    fstat(in, &st) == -1
+      ? -1
+      : open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out == -1) {
+    close(in);
+    return false;
+  }
+
+  // both go through the file offsets, so switching
+  // from one to the other carries on where it stopped
+  bool use_copy_file_range = true;
+  bool copied = true;
+
+  for (off_t left = st.st_size; left > 0;) {
+    ssize_t const n =
+      use_copy_file_range
+        ? copy_file_range(in, nullptr, out, nullptr, left, 0)
+        : sendfile(out, in, nullptr, left);
+
+    if (n > 0) {
+      left -= n;
+    } else if (n == -1 and errno == EINTR) {
+      continue;
+    } else if (n == -1 and use_copy_file_range and
+               (errno == EXDEV or errno == ENOSYS or errno == EINVAL or
+                errno == EOPNOTSUPP)) {
+      use_copy_file_range = false;
+    } else {
+      // the file shrank, or neither works here
+      copied = false;
+      break;
+    }
+  }
+
+  close(in);
+  close(out);
+
+  if (not copied)
+    std::filesystem::remove(to);
+
+  return copied;
+}
+
+// the cheapest way of making to have from's contents,
+// a hardlink only if link is set
+static void
+place_copy(std::filesystem::path const& from,
+           std::filesystem::path const& to,
+           bool const link)
+{
+  std::error_code ec;
+  if (link)
+    std::filesystem::create_hard_link(from, to, ec);
+
+  if (link and not ec)
+    return;
+
+  if (not try_reflink(from, to) and not try_kernel_copy(from, to))
+    std::filesystem::copy_file(
+      from, to, std::filesystem::copy_options::overwrite_existing);
+}
+
+StoreWriter::StoreWriter(std::filesystem::path version_directory)
+  : m_lock(lock_store(LOCK_SH))
+  , m_version_directory(std::move(version_directory))
+{
+}
+
+StoreWriter::~StoreWriter()
+{
+  close(m_lock);
+}
+
+void
+StoreWriter::add_file(std::filesystem::path const& source,
+                      std::filesystem::path const& relative,
+                      bool const source_is_installed)
+{
+  auto const digest = digest_file(source);
+  bool const executable = is_executable(source);
+  auto const blob = blob_path(digest, executable);
+
+  // two writers racing on the same blob both write the same
+  // contents, so whichever rename lands last doesn't matter
+  if (not std::filesystem::exists(blob)) {
+    std::filesystem::create_directories(blob.parent_path());
+    auto const temporary = temporary_next_to(blob);
+
+    // a file that's only ever installed can become the blob itself,
+    // anything else might still be written to
+    place_copy(source, temporary, source_is_installed);
+    std::filesystem::permissions(temporary, blob_permissions(executable));
+    std::filesystem::rename(temporary, blob);
+  }
+
+  link_blob(blob, relative, digest, executable);
+}
+
+void
+StoreWriter::link_blob(std::filesystem::path const& blob,
+                       std::filesystem::path const& relative,
+                       std::string const& digest,
+                       bool const executable)
+{
+  auto const destination = m_version_directory / relative;
+
+  // renaming one link of a file over another link of
+  // the same file does nothing, the temporary would stay
+  bool const linked = std::filesystem::exists(destination) and
+                      std::filesystem::equivalent(destination, blob);
+
+  if (not linked) {
+    std::filesystem::create_directories(destination.parent_path());
+
+    auto const temporary = temporary_next_to(destination);
+    place_copy(blob, temporary, true);
+    std::filesystem::permissions(temporary, blob_permissions(executable));
+    std::filesystem::rename(temporary, destination);
+  }
+
+  std::scoped_lock lock(m_mutex);
+  if (not linked)
+    m_changes.updated++;
+  m_files.push_back(
+    StoredFile{ relative.generic_string(), digest, executable });
+}
+
+bool
+StoreWriter::add_blob(
+  std::filesystem::path const& relative,
+  std::string const& digest,
+  bool const executable,
+  std::function<void(std::filesystem::path const&)> const& write)
+{
+  auto const blob = blob_path(digest, executable);
+  bool const missing = not std::filesystem::exists(blob);
+
+  if (missing) {
+    std::filesystem::create_directories(blob.parent_path());
+    auto const temporary = temporary_next_to(blob);
+
+    try {
+      write(temporary);
+
+      if (digest_file(temporary) != digest)
+        throw std::runtime_error(std::format(
+          "<{}> doesn't match its digest", relative.generic_string()));
+    } catch (...) {
+      std::filesystem::remove(temporary);
+      throw;
+    }
+
+    std::filesystem::permissions(temporary, blob_permissions(executable));
+    std::filesystem::rename(temporary, blob);
+  }
+
+  link_blob(blob, relative, digest, executable);
+  return missing;
+}
+
+void
+StoreWriter::add(std::filesystem::path const& source,
+                 std::filesystem::path const& relative)
+{
+  add_file(source, relative, false);
+}
+
+void
+StoreWriter::add_existing_files()
+{
+  std::vector<std::filesystem::path> files;
+
+  for (auto const& entry :
+       std::filesystem::recursive_directory_iterator(m_version_directory)) {
+    auto const name = entry.path().filename();
+
+    if (entry.is_symlink() or not entry.is_regular_file() or
+        name == manifest_name or name == info_name)
+      continue;
+
+    files.push_back(entry.path());
+  }
+
+  for (auto const& file : files)
+    add_file(file, file.lexically_relative(m_version_directory), true);
+}
+
+static StoreManifest
+read_manifest(std::filesystem::path const& path)
+{
+  StoreManifest out;
+  jayson::deserialize(jayson::val::parse(read_file(path)), out);
+  return out;
+}
+
+StoreChanges
+StoreWriter::finish()
+{
+  std::scoped_lock lock(m_mutex);
+
+  // the same path added twice keeps the last
+  std::ranges::stable_sort(m_files, {}, &StoredFile::path);
+  auto const duplicates = std::ranges::unique(
+    m_files.rbegin(), m_files.rend(), {}, &StoredFile::path);
+  m_files.erase(m_files.begin(), duplicates.begin().base());
+
+  auto const manifest_path = m_version_directory / manifest_name;
+
+  // whatever an earlier install of the version had, that this
+  // one doesn't, e.g. a header that has since been deleted
+  if (std::filesystem::exists(manifest_path)) {
+    std::unordered_set<std::string> kept;
+    for (auto const& file : m_files)
+      kept.insert(file.path);
+
+    for (auto const& file : read_manifest(manifest_path).files) {
+      if (kept.contains(file.path))
+        continue;
+
+      auto path = m_version_directory / file.path;
+      if (std::filesystem::remove(path))
+        m_changes.removed++;
+
+      // along with the directories that leaves empty
+      for (path = path.parent_path();
+           path != m_version_directory and std::filesystem::exists(path) and
+           std::filesystem::is_empty(path);
+           path = path.parent_path())
+        std::filesystem::remove(path);
+    }
+  }
+
+  auto const temporary = temporary_next_to(manifest_path);
+  std::ofstream(temporary)
+    << jayson::serialize(StoreManifest{ m_files }).serialize();
+  std::filesystem::rename(temporary, manifest_path);
+
+  return m_changes;
+}
+
+// every blob some version directory is made of
+static std::unordered_set<std::string>
+referenced_blobs()
+{
+  std::unordered_set<std::string> out;
+
+  if (not std::filesystem::exists(hewg_packages_directory))
+    return out;
+
+  for (auto const& package :
+       std::filesystem::directory_iterator(hewg_packages_directory)) {
+    if (not package.is_directory())
+      continue;
+
+    for (auto const& version :
+         std::filesystem::directory_iterator(package.path())) {
+      auto const manifest_path = version.path() / manifest_name;
+      if (not std::filesystem::exists(manifest_path))
+        continue;
+
+      // better to keep everything than to guess
+      StoreManifest manifest;
+      try {
+        manifest = read_manifest(manifest_path);
+      } catch (std::exception const& e) {
+        throw std::runtime_error(
+          std::format("unable to read <{}>, not collecting anything: {}",
+                      manifest_path.string(),
+                      e.what()));
+      }
+
+      for (auto const& file : manifest.files)
+        out.insert(blob_path(file.digest, file.executable).string());
+    }
+  }
+
+  return out;
+}
+
+GarbageStats
+collect_store_garbage(bool const dry_run)
+{
+  GarbageStats out;
+
+  if (not std::filesystem::exists(hewg_store_directory))
+    return out;
+
+  int const lock = lock_store(LOCK_EX);
+
+  try {
+    auto const referenced = referenced_blobs();
+    std::vector<std::filesystem::path> garbage;
+
+    // with the lock held nothing is being written,
+    // so leftover temporaries are garbage too
+    for (auto const& entry :
+         std::filesystem::recursive_directory_iterator(hewg_store_directory))
+      if (entry.is_regular_file() and entry.path() != hewg_store_lock_path and
+          not referenced.contains(entry.path().string()))
+        garbage.push_back(entry.path());
+
+    for (auto const& blob : garbage) {
+      out.blobs++;
+      out.bytes += std::filesystem::file_size(blob);
+
+      threadsafe_print_verbose(
+        std::format("unreferenced blob <{}>\n", blob.string()));
+
+      if (not dry_run)
+        std::filesystem::remove(blob);
+    }
+  } catch (...) {
+    close(lock);
+    throw;
+  }
+
+  close(lock);
+  return out;
+}
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.hh"
+#include "tar.hh"
+
+constexpr std::size_t block_size = 512;
+
+// where the ustar header fields live
+namespace field {
+constexpr std::size_t name = 0;
+constexpr std::size_t mode = 100;
+constexpr std::size_t uid = 108;
+constexpr std::size_t gid = 116;
+constexpr std::size_t size = 124;
+constexpr std::size_t mtime = 136;
+constexpr std::size_t checksum = 148;
+constexpr std::size_t type = 156;
+constexpr std::size_t magic = 257;
+constexpr std::size_t prefix = 345;
+}
+
+static std::uint64_t
+padding_of(std::uint64_t const size)
+{
+  return (block_size - size % block_size) % block_size;
+}
+
+static void
+put_octal(std::string& header,
+          std::size_t const at,
+          std::size_t const width,
+          std::uint64_t const value)
+{
+  // zero padded, leaving room for the terminating null
+  auto left = value;
+  for (std::size_t i = width - 1; i-- > 0; left /= 8)
+    header[at + i] = char('0' + left % 8);
+}
+
+static std::uint64_t
+checksum_of(std::string_view header)
+{
+  // the checksum field counts as spaces
+  return std::accumulate(header.begin(),
+                         header.begin() + field::checksum,
+                         std::uint64_t(0),
+                         [](auto sum, char c) {
+                           return sum + static_cast<unsigned char>(c);
+                         }) +
+         8 * ' ' +
+         std::accumulate(header.begin() + field::checksum + 8,
+                         header.end(),
+                         std::uint64_t(0),
+                         [](auto sum, char c) {
+                           return sum + static_cast<unsigned char>(c);
+                         });
+}
+
+static std::string
+make_header(std::string const& path,
+            std::uint64_t const size,
+            bool const executable)
+{
+  std::string header(block_size, '\0');
+
+  // long paths get split over the prefix & name fields
+  if (path.size() <= 100)
+    header.replace(field::name, path.size(), path);
+  else {
+    auto const split = path.rfind('/', 155);
+
+    if (split == std::string::npos or path.size() - split - 1 > 100)
+      throw std::runtime_error(
+        std::format("<{}> is too long of a path to archive", path));
+
+    header.replace(field::prefix, split, path.substr(0, split));
+    header.replace(
+      field::name, path.size() - split - 1, path.substr(split + 1));
+  }
+
+  if (size >= 0100000000000)
+    throw std::runtime_error(
+      std::format("<{}> is too large to archive", path));
+
+  put_octal(header, field::mode, 8, executable ? 0755 : 0644);
+  put_octal(header, field::uid, 8, 0);
+  put_octal(header, field::gid, 8, 0);
+  put_octal(header, field::size, 12, size);
+  put_octal(header, field::mtime, 12, 0);
+  header[field::type] = '0';
+  header.replace(field::magic, 8, "ustar\0"
+                                  "00"sv);
+
+  // six digits, a null & a space, as every tar writes it
+  put_octal(header, field::checksum, 7, checksum_of(header));
+  header[field::checksum + 7] = ' ';
+
+  return header;
+}
+
+std::string
+archive_directory(std::filesystem::path const& directory)
+{
+  std::vector<std::filesystem::path> files;
+
+  for (auto const& entry :
+       std::filesystem::recursive_directory_iterator(directory)) {
+    if (entry.is_symlink())
+      threadsafe_print_verbose(std::format(
+        "not archiving symlink <{}>\n", entry.path().string()));
+    else if (entry.is_regular_file())
+      files.push_back(entry.path());
+  }
+
+  // directory order isn't stable
+  std::ranges::sort(files);
+
+  std::string out;
+
+  for (auto const& file : files) {
+    auto const contents = read_file(file);
+    auto const perms = std::filesystem::status(file).permissions();
+    bool const executable = (perms & std::filesystem::perms::owner_exec) !=
+                            std::filesystem::perms::none;
+
+    out += make_header(
+      file.lexically_relative(directory).generic_string(),
+      contents.size(),
+      executable);
+    out += contents;
+    out.append(padding_of(contents.size()), '\0');
+  }
+
+  // two empty blocks end the archive
+  out.append(2 * block_size, '\0');
+
+  return out;
+}
+
+static std::uint64_t
+parse_octal(std::string_view field)
+{
+  std::uint64_t out = 0;
+
+  for (auto const c : field) {
+    if (c == '\0' or c == ' ')
+      break;
+    if (c < '0' or c > '7')
+      throw std::runtime_error("corrupt archive, bad number in a header");
+    out = out * 8 + (c - '0');
+  }
+
+  return out;
+}
+
+static std::string_view
+string_field(std::string_view header, std::size_t at, std::size_t width)
+{
+  auto const field = header.substr(at, width);
+  return field.substr(0, field.find('\0'));
+}
+
+TarExtractor::TarExtractor(std::filesystem::path directory)
+  : m_directory(std::move(directory))
+{
+}
+
+void
+TarExtractor::start_entry()
+{
+  if (std::ranges::all_of(m_header, [](char c) { return c == '\0'; })) {
+    m_finished = true;
+    return;
+  }
+
+  std::string_view const header = m_header;
+
+  if (parse_octal(header.substr(field::checksum, 8)) != checksum_of(header))
+    throw std::runtime_error("corrupt archive, header checksum mismatch");
+
+  std::string path(string_field(header, field::name, 100));
+  if (auto const prefix = string_field(header, field::prefix, 155);
+      not prefix.empty())
+    path = std::format("{}/{}", prefix, path);
+
+  auto const relative = std::filesystem::path(path).lexically_normal();
+
+  if (relative.empty() or relative.is_absolute() or
+      std::ranges::any_of(relative, [](auto const& part) {
+        return part == "..";
+      }))
+    throw std::runtime_error(
+      std::format("archive entry <{}> is outside of the package", path));
+
+  auto const type = header[field::type];
+  auto const destination = m_directory / relative;
+
+  if (type == '5') {
+    std::filesystem::create_directories(destination);
+    return;
+  }
+
+  if (type != '0' and type != '\0')
+    throw std::runtime_error(std::format(
+      "archive entry <{}> isn't a regular file or directory", path));
+
+  auto const size = parse_octal(header.substr(field::size, 12));
+  auto const mode = parse_octal(header.substr(field::mode, 8));
+
+  std::filesystem::create_directories(destination.parent_path());
+
+  m_file = std::ofstream(destination, std::ios::binary | std::ios::trunc);
+  if (m_file.fail())
+    throw std::runtime_error(
+      std::format("unable to open <{}> for writing", destination.string()));
+
+  std::filesystem::permissions(
+    destination, std::filesystem::perms(mode & 0777));
+
+  m_file_left = size;
+  m_skip = padding_of(size);
+
+  if (size == 0)
+    m_file.close();
+}
+
+void
+TarExtractor::feed(std::string_view data)
+{
+  while (not data.empty() and not m_finished) {
+    if (m_file_left > 0) {
+      auto const n = std::min<std::uint64_t>(m_file_left, data.size());
+      m_file.write(data.data(), n);
+      m_file_left -= n;
+      data.remove_prefix(n);
+
+      if (m_file_left == 0) {
+        m_file.close();
+        if (m_file.fail())
+          throw std::runtime_error("unable to write an extracted file");
+      }
+    } else if (m_skip > 0) {
+      auto const n = std::min<std::uint64_t>(m_skip, data.size());
+      m_skip -= n;
+      data.remove_prefix(n);
+    } else {
+      auto const n = std::min(block_size - m_header.size(), data.size());
+      m_header.append(data.substr(0, n));
+      data.remove_prefix(n);
+
+      if (m_header.size() == block_size) {
+        start_entry();
+        m_header.clear();
+      }
+    }
+  }
+}
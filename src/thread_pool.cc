@@ -1,6 +1,10 @@
+#include <csignal>
+#include <format>
 #include <mutex>
 #include <ranges>
+#include <string>
 #include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
 #include "common.hh"
@@ -9,6 +13,12 @@
 // thread_local int thread_id = MAIN_THREAD_ID;
 
 ThreadPool::ThreadPool(int const num_threads)
+  : m_num_threads(num_threads)
+{
+}
+
+void
+ThreadPool::start()
 {
   // wrap the entire thing here in
   // a try catch, such that
@@ -35,6 +45,7 @@ ThreadPool::ThreadPool(int const num_threads)
           m_tasks.pop();
         }
 
+        current_project_root = task->project_root;
         (*task.get())();
       }
     } catch (std::exception const& e) {
@@ -43,7 +54,7 @@ ThreadPool::ThreadPool(int const num_threads)
     }
   };
 
-  for (auto const thread_id : std::ranges::iota_view(0, num_threads)) {
+  for (auto const thread_id : std::ranges::iota_view(0, m_num_threads)) {
     m_threads.emplace_back(std::thread(thread_dispatch, thread_id));
   }
 }
@@ -61,8 +72,14 @@ void
 ThreadPool::drain()
 {
   std::scoped_lock lock(m_mutex);
-  while (not m_tasks.empty())
-    m_tasks.pop();
+
+  // other projects of a workspace keep theirs
+  std::queue<std::unique_ptr<TaskBase>> kept;
+  for (; not m_tasks.empty(); m_tasks.pop())
+    if (m_tasks.front()->project_root != current_project_root)
+      kept.push(std::move(m_tasks.front()));
+
+  m_tasks = std::move(kept);
 }
 
 // void
@@ -93,8 +110,52 @@ ThreadPool::drain()
 //   }
 // }
 
+void
+CommandHandle::cancel()
+{
+  std::scoped_lock lock(m_mutex);
+  m_cancelled = true;
+
+  if (m_pid != 0)
+    kill(m_pid, SIGKILL);
+}
+
+bool
+CommandHandle::cancelled()
+{
+  std::scoped_lock lock(m_mutex);
+  return m_cancelled;
+}
+
+bool
+CommandHandle::attach(pid_t const pid)
+{
+  std::scoped_lock lock(m_mutex);
+  m_pid = pid;
+  return not m_cancelled;
+}
+
+void
+CommandHandle::detach()
+{
+  std::scoped_lock lock(m_mutex);
+  m_pid = 0;
+}
+
+// an exception in a forked child would unwind into the copy of
+// whichever pool thread forked it, so failures go out through the pipe
+[[noreturn]] static void
+fail_in_child(std::string const& why)
+{
+  [[maybe_unused]] auto const ignored =
+    write(STDOUT_FILENO, why.data(), why.size());
+  _exit(127);
+}
+
 std::pair<int, std::string>
-run_command(std::string const command, std::span<std::string const> args)
+run_command(std::string const command,
+            std::span<std::string const> args,
+            CommandHandle* handle)
 {
   // use pipes to redirect stdout
   int fds[2];
@@ -124,6 +185,16 @@ run_command(std::string const command, std::span<std::string const> args)
     threadsafe_print_verbose(what, "\n");
   }
 
+  // written before forking, the child of
+  // a threaded process mustn't allocate
+  std::string const chdir_failed =
+    current_project_root == nullptr
+      ? std::string()
+      : std::format("unable to enter the project directory <{}>\n",
+                    current_project_root->string());
+  std::string const exec_failed =
+    std::format("unable to run command <{}>\n", command);
+
   auto const pid = fork();
 
   if (pid == -1)
@@ -133,6 +204,10 @@ run_command(std::string const command, std::span<std::string const> args)
     char buf[512];
     int written = 0;
 
+    // cancelled between being queued & forking
+    if (handle != nullptr and not handle->attach(pid))
+      kill(pid, SIGKILL);
+
     // have to close this stdout first
     // or else read doesn't hit EOF... for some reason...
     close(fds[1]);
@@ -160,11 +235,19 @@ run_command(std::string const command, std::span<std::string const> args)
 
     close(fds[0]);
 
+    // detach before reaping, so cancel() can
+    // never kill a recycled pid
+    if (handle != nullptr)
+      handle->detach();
+
     threadsafe_print(stdout_buf);
 
     int childstatus = 0;
     waitpid(pid, &childstatus, 0);
 
+    if (handle != nullptr and handle->cancelled())
+      return { -1, stdout_buf };
+
     if (not WIFEXITED(childstatus))
       throw std::runtime_error("child command failed to exit normally");
 
@@ -180,11 +263,12 @@ run_command(std::string const command, std::span<std::string const> args)
   close(fds[0]);
   close(fds[1]);
 
-  // actually run the command
-  auto const e = execvp(command.c_str(), (char* const*)args_owned_ptrs.data());
-
-  if (e == -1)
-    throw std::runtime_error("unable to run command");
+  // commands name the project's files relative to its root
+  if (current_project_root != nullptr and
+      chdir(current_project_root->c_str()) != 0)
+    fail_in_child(chdir_failed);
 
-  exit(0);
+  // actually run the command, only returns if it couldn't
+  execvp(command.c_str(), (char* const*)args_owned_ptrs.data());
+  fail_in_child(exec_failed);
 }
@@ -0,0 +1,196 @@
+#include <charconv>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "confs.hh"
+#include "digest.hh"
+#include "paths.hh"
+#include "thread_pool.hh"
+#include "toolchain.hh"
+
+Toolchain
+detect_toolchain(std::string const& compiler)
+{
+  static std::mutex mutex;
+  static std::map<std::string, Toolchain> detected;
+
+  std::scoped_lock lock(mutex);
+
+  if (auto const found = detected.find(compiler); found != detected.end())
+    return found->second;
+
+  auto const [version_exit, version] = run_command(compiler, "--version");
+  auto const [dump_exit, dumped] = run_command(compiler, "-dumpversion");
+
+  if (version_exit != 0 or dump_exit != 0)
+    throw std::runtime_error(
+      std::format("unable to query the version of compiler <{}>", compiler));
+
+  Toolchain toolchain{};
+
+  // clang identifies itself somewhere in the first line,
+  // gcc built by distros says all sorts of things
+  toolchain.family = version.contains("clang") ? CompilerFamily::Clang
+                                               : CompilerFamily::GCC;
+
+  // -dumpversion is "13" or "13.2.0"
+  std::from_chars(
+    dumped.data(), dumped.data() + dumped.size(), toolchain.major_version);
+
+  threadsafe_print_verbose(
+    std::format("compiler <{}> is {} {}\n",
+                compiler,
+                toolchain.family == CompilerFamily::Clang ? "clang" : "gcc",
+                toolchain.major_version));
+
+  return detected.insert_or_assign(compiler, toolchain).first->second;
+}
+
+std::string
+toolchain_identity(std::string const& compiler)
+{
+  static std::mutex mutex;
+  static std::map<std::string, std::string> identities;
+
+  std::scoped_lock lock(mutex);
+
+  if (auto const found = identities.find(compiler); found != identities.end())
+    return found->second;
+
+  auto const [version_exit, version] = run_command(compiler, "--version");
+  auto const [machine_exit, machine] = run_command(compiler, "-dumpmachine");
+
+  if (version_exit != 0 or machine_exit != 0)
+    throw std::runtime_error(
+      std::format("unable to query the identity of compiler <{}>", compiler));
+
+  auto identity = Digest().update(version).update(machine).finish();
+  return identities.insert_or_assign(compiler, std::move(identity))
+    .first->second;
+}
+
+enum class LTOMode
+{
+  Thin,
+  Fat,
+};
+
+static std::optional<LTOMode>
+get_lto_mode(ConfigurationFile const& config, bool const release)
+{
+  auto const& build_type = get_build_type_conf(config, release);
+
+  if (not build_type.lto.value_or(false))
+    return std::nullopt;
+
+  auto const mode = build_type.lto_mode.value_or("thin");
+
+  if (mode == "thin")
+    return LTOMode::Thin;
+  if (mode == "fat")
+    return LTOMode::Fat;
+
+  throw std::runtime_error(
+    std::format("lto_mode <{}> is invalid; it must be thin or fat", mode));
+}
+
+/*
+  gcc only ever writes lto bytecode into objects,
+  "fat" objects carry regular code beside it.
+  for clang, thin is thinlto and fat is full lto
+
+  static libraries always get fat objects. ar can only index
+  bytecode through a compiler's plugin, and the archives are
+  linked by projects that may not use lto, or another compiler
+*/
+
+std::vector<std::string>
+lto_flags(ConfigurationFile const& config,
+          std::string const& compiler,
+          bool const release)
+{
+  auto const mode = get_lto_mode(config, release);
+
+  if (not mode)
+    return {};
+
+  bool const library = config.meta.type == ProjectType::StaticLibrary;
+  auto const toolchain = detect_toolchain(compiler);
+
+  if (toolchain.family == CompilerFamily::Clang) {
+    std::vector<std::string> out{ *mode == LTOMode::Thin ? "-flto=thin"
+                                                         : "-flto=full" };
+    if (not library)
+      return out;
+
+    if (toolchain.major_version < 18)
+      throw std::runtime_error(std::format(
+        "lto in a static library needs -ffat-lto-objects, which clang {} "
+        "doesn't have; it needs clang 18 or newer",
+        toolchain.major_version));
+
+    out.push_back("-ffat-lto-objects");
+    return out;
+  }
+
+  if (*mode == LTOMode::Fat or library)
+    return { "-flto", "-ffat-lto-objects" };
+
+  return { "-flto" };
+}
+
+std::vector<std::string>
+lto_parallel_flags(ConfigurationFile const& config,
+                   ToolFile const& tools,
+                   bool const release,
+                   unsigned const jobs,
+                   std::filesystem::path const& cache_folder)
+{
+  auto const mode = get_lto_mode(config, release);
+
+  if (not mode)
+    return {};
+
+  auto const toolchain = detect_toolchain(tools.cxx);
+  auto const lto_cache = project_relative(cache_folder / "lto");
+
+  std::vector<std::string> out;
+
+  if (toolchain.family == CompilerFamily::GCC) {
+    // overrides the plain -flto, partitions
+    // get compiled by this many ltrans jobs
+    out.push_back(std::format("-flto={}", jobs));
+
+    if (toolchain.major_version >= 15) {
+      std::filesystem::create_directories(lto_cache);
+      out.push_back(std::format("-flto-incremental={}", lto_cache.string()));
+    }
+
+    return out;
+  }
+
+  // full lto is a single module,
+  // nothing to parallelize or cache
+  if (*mode == LTOMode::Fat)
+    return out;
+
+  out.push_back(std::format("-flto-jobs={}", jobs));
+
+  std::filesystem::create_directories(lto_cache);
+
+  if (tools.ld == "lld")
+    out.push_back(
+      std::format("-Wl,--thinlto-cache-dir={}", lto_cache.string()));
+  else
+    out.push_back(
+      std::format("-Wl,-plugin-opt,cache-dir={}", lto_cache.string()));
+
+  return out;
+}
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <ranges>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "paths.hh"
+#include "trash.hh"
+
+void
+move_to_trash(std::filesystem::path const& what)
+{
+  static std::atomic<unsigned> counter = 0;
+
+  std::filesystem::create_directories(hewg_trash_path);
+
+  // the same folder can be trashed again before the last one is gone
+  std::filesystem::rename(what,
+                          hewg_trash_path /
+                            std::format("{}-{}-{}",
+                                        what.filename().string(),
+                                        getpid(),
+                                        counter++));
+}
+
+// unlinks every file with jobs threads at once, a cache folder is
+// mostly one flat directory of objects. then the emptied directories
+static void
+remove_tree(std::filesystem::path const& root, unsigned const jobs)
+{
+  std::vector<std::filesystem::path> files;
+  std::vector<std::filesystem::path> directories;
+
+  std::error_code ec;
+  for (auto it = std::filesystem::recursive_directory_iterator(root, ec);
+       not ec and it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec))
+    (it->is_directory() and not it->is_symlink() ? directories : files)
+      .push_back(it->path());
+
+  std::atomic<std::size_t> next = 0;
+
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned i = 0; i < std::max(jobs, 1u); i++)
+      workers.emplace_back([&] {
+        for (std::size_t at; (at = next++) < files.size();)
+          unlinkat(AT_FDCWD, files[at].c_str(), 0);
+      });
+  }
+
+  // a directory always comes before what's in it
+  for (auto const& directory : directories | std::views::reverse)
+    unlinkat(AT_FDCWD, directory.c_str(), AT_REMOVEDIR);
+
+  // anything that was still being written to
+  std::filesystem::remove_all(root, ec);
+}
+
+void
+empty_trash_in_background(unsigned const jobs)
+{
+  if (not std::filesystem::exists(hewg_trash_path))
+    return;
+
+  pid_t const pid = fork();
+
+  // the parent carries on, the child is on its own
+  if (pid > 0)
+    return;
+
+  if (pid == 0) {
+    // isn't killed along with the terminal,
+    // and doesn't hold a pipe hewg's output goes into open
+    setsid();
+    int const null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int const fd : { 0, 1, 2 })
+      dup2(null, fd);
+  }
+
+  std::error_code ec;
+  for (auto const& entry :
+       std::filesystem::directory_iterator(hewg_trash_path, ec))
+    remove_tree(entry.path(), jobs);
+
+  std::filesystem::remove(hewg_trash_path, ec);
+
+  // the child never returns into hewg, none of what it
+  // inherited is its own to clean up. without a child,
+  // the trash was just emptied in the foreground
+  if (pid == 0)
+    _exit(0);
+}
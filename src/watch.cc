@@ -0,0 +1,419 @@
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <set>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+#include "analysis.hh"
+#include "build_cache.hh"
+#include "cmdline.hh"
+#include "common.hh"
+#include "compile.hh"
+#include "confs.hh"
+#include "depfile.hh"
+#include "hooks.hh"
+#include "link.hh"
+#include "paths.hh"
+#include "prebuilt.hh"
+#include "thread_pool.hh"
+#include "watch.hh"
+
+/*
+  watch loads everything a build would normally
+  recompute on each invocation once, and from then on
+  only looks at the files inotify reports as changed
+
+  the dependency graph is a map of each file to the
+  sources that include it, read out of the depfiles.
+  a source's depfile is re-read only after it recompiles
+*/
+
+static std::filesystem::path
+normalize(std::filesystem::path const& p)
+{
+  return std::filesystem::absolute(p).lexically_normal();
+}
+
+static std::filesystem::path
+depfile_for_source(std::filesystem::path const& cache_folder,
+                   std::filesystem::path const& source)
+{
+  if (translate_filename_to_filetype(source) == FileType::CSource)
+    return depfile_for_c(cache_folder, source);
+
+  return depfile_for_cxx(cache_folder, source);
+}
+
+static std::vector<std::filesystem::path>
+read_dependencies(std::filesystem::path const& depfile)
+{
+  if (not std::filesystem::exists(depfile))
+    return {};
+
+  std::vector<std::filesystem::path> out;
+  for (auto const& dependency : parse_depfile(depfile).dependencies)
+    out.push_back(normalize(dependency));
+
+  return out;
+}
+
+class DependencyGraph
+{
+  // file -> sources which include it
+  std::map<std::filesystem::path, std::set<std::filesystem::path>>
+    m_dependents;
+
+  // source -> files it includes
+  std::map<std::filesystem::path, std::vector<std::filesystem::path>>
+    m_dependencies;
+
+public:
+  void set_dependencies(std::filesystem::path const& source,
+                        std::vector<std::filesystem::path> dependencies)
+  {
+    for (auto const& old : m_dependencies[source])
+      m_dependents[old].erase(source);
+
+    // a source depends on itself,
+    // even if it was never compiled
+    dependencies.push_back(source);
+
+    for (auto const& dependency : dependencies)
+      m_dependents[dependency].insert(source);
+
+    m_dependencies[source] = std::move(dependencies);
+  }
+
+  std::set<std::filesystem::path> const* dependents_of(
+    std::filesystem::path const& file) const
+  {
+    auto const found = m_dependents.find(file);
+    if (found == m_dependents.end())
+      return nullptr;
+    return &found->second;
+  }
+
+  std::set<std::filesystem::path> directories() const
+  {
+    std::set<std::filesystem::path> out;
+    for (auto const& [file, dependents] : m_dependents)
+      if (not dependents.empty())
+        out.insert(file.parent_path());
+    return out;
+  }
+};
+
+class Inotify
+{
+  int m_fd;
+  std::map<int, std::filesystem::path> m_watches;
+  std::set<std::filesystem::path> m_watched;
+
+public:
+  Inotify(const Inotify&) = delete;
+  Inotify& operator=(const Inotify&) = delete;
+
+  Inotify()
+    : m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+  {
+    if (m_fd == -1)
+      throw std::runtime_error("unable to initialize inotify");
+  }
+
+  ~Inotify() { close(m_fd); }
+
+  int fd() const { return m_fd; }
+
+  void watch(std::filesystem::path const& directory)
+  {
+    auto const dir = normalize(directory);
+
+    if (m_watched.contains(dir) or not std::filesystem::is_directory(dir))
+      return;
+
+    // editors tend to save by writing a new file
+    // and moving it over the old one
+    int const wd = inotify_add_watch(
+      m_fd,
+      dir.c_str(),
+      IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+
+    if (wd == -1) {
+      threadsafe_print(
+        std::format("unable to watch directory <{}>\n", dir.string()));
+      return;
+    }
+
+    m_watches.insert_or_assign(wd, dir);
+    m_watched.insert(dir);
+  }
+
+  void watch_recursive(std::filesystem::path const& directory)
+  {
+    if (not std::filesystem::is_directory(directory))
+      return;
+
+    watch(directory);
+
+    for (auto const& entry :
+         std::filesystem::recursive_directory_iterator(directory))
+      if (entry.is_directory())
+        watch(entry.path());
+  }
+
+  // drains whatever events are queued up,
+  // returning the paths they touched
+  std::vector<std::filesystem::path> read_events()
+  {
+    alignas(inotify_event) char buf[4096];
+    std::vector<std::filesystem::path> out;
+
+    for (;;) {
+      auto const len = read(m_fd, buf, sizeof(buf));
+
+      // EAGAIN, nothing left
+      if (len <= 0)
+        break;
+
+      for (char const* p = buf; p < buf + len;) {
+        auto const event = reinterpret_cast<inotify_event const*>(p);
+        p += sizeof(inotify_event) + event->len;
+
+        auto const found = m_watches.find(event->wd);
+        if (event->len == 0 or found == m_watches.end())
+          continue;
+
+        auto const path = found->second / event->name;
+
+        if ((event->mask & IN_ISDIR) and
+            (event->mask & (IN_CREATE | IN_MOVED_TO)))
+          watch_recursive(path);
+
+        out.push_back(path);
+      }
+    }
+
+    return out;
+  }
+};
+
+struct InFlightCompile
+{
+  std::shared_ptr<CommandHandle> handle;
+  std::future<std::optional<std::string>> result;
+};
+
+void
+watch(ThreadPool& threads,
+      ConfigurationFile const& config,
+      WatchOptions const& options,
+      std::string_view build_profile)
+{
+  if (config.meta.type != ProjectType::Executable and
+      config.meta.type != ProjectType::SharedLibrary)
+    throw std::runtime_error(
+      "watch only supports executable and dynlib projects");
+
+  ToolFile const tools = get_tool_file(config, build_profile);
+
+  BuildOptions build_opts;
+  build_opts.release = options.release;
+
+  bool const pic = config.meta.type == ProjectType::SharedLibrary;
+  auto const cache = get_cache_folder(build_profile, options.release, pic);
+  BuildCache build_cache(cache);
+
+  create_directory_checked(hewg_target_directory_path / build_profile);
+  auto const emit_dir = hewg_target_directory_path / build_profile;
+
+  auto const cxx_sources = get_cxx_source_filepaths(config);
+  auto const c_sources = get_c_source_filepaths(config);
+
+  // same order as a normal build,
+  // so the link records agree with each other
+  std::vector<std::filesystem::path> object_files;
+  for (auto const& source : cxx_sources)
+    object_files.push_back(object_file_for_cxx(cache, source));
+  for (auto const& source : c_sources)
+    object_files.push_back(object_file_for_c(cache, source));
+
+  // packages don't change while watching, so are only looked up once
+  auto const package_archives =
+    config.meta.type == ProjectType::Executable
+      ? get_package_archives(
+          config, tools, build_profile, options.release, false)
+      : std::vector<std::filesystem::path>();
+
+  DependencyGraph graph;
+  for (auto const& source : cxx_sources + c_sources)
+    graph.set_dependencies(
+      normalize(source), read_dependencies(depfile_for_source(cache, source)));
+
+  Inotify inotify;
+  inotify.watch_recursive(hewg_cxx_src_directory_path);
+  inotify.watch_recursive(hewg_c_src_directory_path);
+  inotify.watch_recursive(hewg_private_header_directory_path);
+  inotify.watch_recursive(hewg_public_header_directory_path);
+  inotify.watch(hewg_config_path.parent_path());
+  for (auto const& directory : graph.directories())
+    inotify.watch(directory);
+
+  trigger_prebuild_hooks(config);
+
+  // the only time the whole project gets looked at,
+  // anything out of date from before we started
+  std::set<std::filesystem::path> pending;
+  for (auto const& source : sources_to_rebuild(
+         config, tools, build_cache, cache, options.release, pic))
+    pending.insert(normalize(source));
+
+  std::map<std::filesystem::path, InFlightCompile> in_flight;
+  std::set<std::filesystem::path> failed;
+  bool needs_link = true;
+
+  auto const debounce = std::chrono::milliseconds(options.debounce_ms);
+  auto last_change = std::chrono::steady_clock::now();
+
+  for (;;) {
+    bool const busy =
+      not pending.empty() or not in_flight.empty() or needs_link;
+
+    pollfd pfd{ inotify.fd(), POLLIN, 0 };
+    if (poll(&pfd, 1, busy ? 10 : -1) == -1 and errno != EINTR)
+      throw std::runtime_error("poll() failed while watching for changes");
+
+    for (auto const& changed : inotify.read_events()) {
+      if (changed == normalize(hewg_config_path))
+        threadsafe_print("hewg.scl changed, restart watch to pick it up\n");
+
+      auto const dependents = graph.dependents_of(changed);
+      if (dependents == nullptr)
+        continue;
+
+      for (auto const& source : *dependents) {
+        pending.insert(source);
+
+        // changed again mid-compile, that compile is stale
+        if (auto const running = in_flight.find(source);
+            running != in_flight.end())
+          running->second.handle->cancel();
+      }
+
+      last_change = std::chrono::steady_clock::now();
+    }
+
+    for (auto it = in_flight.begin(); it != in_flight.end();) {
+      auto& [source, compile] = *it;
+
+      if (compile.result.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        it++;
+        continue;
+      }
+
+      std::optional<std::string> failure;
+
+      try {
+        failure = compile.result.get();
+      } catch (std::exception const& e) {
+        threadsafe_print("ERROR: ", e.what(), '\n');
+        failure = source.string();
+      }
+
+      if (not compile.handle->cancelled()) {
+        if (failure)
+          failed.insert(source);
+        else
+          failed.erase(source), needs_link = true;
+
+        // includes may have been added or removed
+        graph.set_dependencies(
+          source, read_dependencies(depfile_for_source(cache, source)));
+        for (auto const& directory : graph.directories())
+          inotify.watch(directory);
+      }
+
+      it = in_flight.erase(it);
+    }
+
+    if (not pending.empty() and
+        std::chrono::steady_clock::now() - last_change >= debounce) {
+      for (auto it = pending.begin(); it != pending.end();) {
+        // wait for the cancelled compile to die first
+        if (in_flight.contains(*it)) {
+          it++;
+          continue;
+        }
+
+        auto handle = std::make_shared<CommandHandle>();
+        auto result = start_single_compile(threads,
+                                           config,
+                                           tools,
+                                           build_cache,
+                                           cache,
+                                           *it,
+                                           options.release,
+                                           pic,
+                                           handle);
+
+        in_flight.emplace(
+          *it, InFlightCompile{ std::move(handle), std::move(result) });
+        it = pending.erase(it);
+      }
+    }
+
+    if (not pending.empty() or not in_flight.empty() or not needs_link)
+      continue;
+
+    needs_link = false;
+
+    if (not failed.empty()) {
+      threadsafe_print(std::format(
+        "{} file(s) failed to compile, waiting for changes\n", failed.size()));
+      continue;
+    }
+
+    try {
+      bool linked =
+        config.meta.type == ProjectType::Executable
+          ? link_executable(config,
+                            tools,
+                            build_opts,
+                            build_cache,
+                            threads.size(),
+                            std::nullopt,
+                            std::nullopt,
+                            object_files,
+                            package_archives,
+                            emit_dir)
+          : shared_link(config,
+                        tools,
+                        build_opts,
+                        build_cache,
+                        threads.size(),
+                        std::nullopt,
+                        object_files,
+                        emit_dir);
+
+      linked |= package_dwarf(
+        config, tools, build_opts, build_cache, object_files, emit_dir);
+
+      build_cache.write();
+
+      if (linked)
+        triggers_postbuild_hooks(config);
+    } catch (std::exception const& e) {
+      threadsafe_print("ERROR: ", e.what(), '\n');
+    }
+
+    threadsafe_print("watching for changes...\n");
+  }
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "build.hh"
+#include "cmdline.hh"
+#include "common.hh"
+#include "confs.hh"
+#include "install.hh"
+#include "paths.hh"
+#include "thread_pool.hh"
+#include "workspace.hh"
+
+struct WorkspaceMember
+{
+  std::filesystem::path root;
+  ConfigurationFile config;
+  ToolFile tools;
+
+  // indices of the members this one builds after
+  std::vector<std::size_t> dependencies = {};
+  bool has_dependents = false;
+
+  std::promise<bool> built = {};
+  std::shared_future<bool> done = built.get_future().share();
+  std::optional<std::string> error = std::nullopt;
+};
+
+// works on another project for as long as it lives
+class ProjectRootScope
+{
+  std::filesystem::path const* m_previous;
+
+public:
+  explicit ProjectRootScope(std::filesystem::path const& root)
+    : m_previous(current_project_root)
+  {
+    current_project_root = &root;
+  }
+
+  ProjectRootScope(ProjectRootScope const&) = delete;
+  ProjectRootScope& operator=(ProjectRootScope const&) = delete;
+
+  ~ProjectRootScope() { current_project_root = m_previous; }
+};
+
+static std::vector<WorkspaceMember>
+load_members(ToplevelOptions const& tl_options,
+             WorkspaceConf const& workspace,
+             std::string_view const build_profile)
+{
+  std::vector<WorkspaceMember> members;
+  members.reserve(workspace.members.size());
+
+  for (auto const& directory : workspace.members) {
+    auto const root =
+      std::filesystem::weakly_canonical(project_root() / directory);
+
+    if (not std::filesystem::exists(root / "hewg.scl"))
+      throw std::runtime_error(
+        std::format("workspace member <{}> has no hewg.scl", directory));
+
+    // the config snapshots are kept in the member's own .hcache
+    ProjectRootScope const scope(root);
+    auto config = get_config_file(tl_options, root / "hewg.scl", build_profile);
+    auto tools = get_tool_file(config, build_profile);
+
+    members.push_back(WorkspaceMember{ .root = root,
+                                       .config = std::move(config),
+                                       .tools = std::move(tools) });
+  }
+
+  return members;
+}
+
+enum class Visit
+{
+  Unvisited,
+  Visiting,
+  Visited,
+};
+
+static void
+check_for_cycles(std::vector<WorkspaceMember> const& members,
+                 std::vector<Visit>& visits,
+                 std::size_t const at)
+{
+  if (visits[at] == Visit::Visited)
+    return;
+
+  if (visits[at] == Visit::Visiting)
+    throw std::runtime_error(
+      std::format("workspace member <{}> depends on itself through "
+                  "other members",
+                  members[at].config.project.name));
+
+  visits[at] = Visit::Visiting;
+  for (auto const dependency : members[at].dependencies)
+    check_for_cycles(members, visits, dependency);
+  visits[at] = Visit::Visited;
+}
+
+// only internal dependencies on other members are edges, the
+// rest are packages which are already installed either way
+static void
+link_members(std::vector<WorkspaceMember>& members)
+{
+  auto const find_member = [&](std::string_view const name) {
+    return std::ranges::find_if(members, [&](auto const& member) {
+      return member.config.project.name == name;
+    });
+  };
+
+  for (auto& member : members) {
+    auto const& name = member.config.project.name;
+
+    if (find_member(name)->root != member.root)
+      throw std::runtime_error(
+        std::format("more than one workspace member is named <{}>", name));
+
+    for (auto const& dependency : member.config.internal_deps) {
+      auto const found = find_member(dependency.name);
+      if (found == members.end())
+        continue;
+
+      member.dependencies.push_back(found - members.begin());
+      found->has_dependents = true;
+    }
+  }
+
+  // a cycle would leave its members waiting on each other forever
+  std::vector<Visit> visits(members.size(), Visit::Unvisited);
+  for (std::size_t at = 0; at < members.size(); at++)
+    check_for_cycles(members, visits, at);
+}
+
+static bool
+is_library(ConfigurationFile const& config)
+{
+  return config.meta.type == ProjectType::StaticLibrary or
+         config.meta.type == ProjectType::Headers;
+}
+
+// waits for the member's dependencies, then builds
+// it with its jobs going to the shared pool
+static void
+build_member(ThreadPool& threads,
+             WorkspaceConf const& workspace,
+             BuildOptions const& options,
+             std::string_view const build_profile,
+             std::vector<WorkspaceMember>& members,
+             WorkspaceMember& member)
+{
+  auto const& name = member.config.project.name;
+
+  for (auto const dependency : member.dependencies)
+    if (not members[dependency].done.get()) {
+      member.error = std::format(
+        "skipped, <{}> failed", members[dependency].config.project.name);
+      member.built.set_value(false);
+      return;
+    }
+
+  ProjectRootScope const scope(member.root);
+
+  try {
+    threadsafe_print(std::format("building workspace member <{}>\n", name));
+    build(threads, member.config, member.tools, options, build_profile);
+
+    if (workspace.install_libraries and member.has_dependents and
+        is_library(member.config))
+      install(threads, member.config, InstallOptions{}, build_profile);
+
+    member.built.set_value(true);
+  } catch (std::exception const& e) {
+    member.error = e.what();
+    member.built.set_value(false);
+  }
+}
+
+void
+build_workspace(ThreadPool& threads,
+                ToplevelOptions const& tl_options,
+                BuildOptions const& options,
+                std::string_view const build_profile)
+{
+  // these all name files of a single project
+  if (options.generate_compile_commands or options.pgo or
+      options.layout_profile or tl_options.config_file_path)
+    throw std::runtime_error(
+      "--workspace can't be combined with --generate-compile-commands, "
+      "--pgo, --layout-profile or --config");
+
+  if (not std::filesystem::exists(hewg_workspace_path))
+    throw std::runtime_error(std::format(
+      "no workspace file at <{}>", hewg_workspace_path.string()));
+
+  auto const workspace = get_workspace_file(hewg_workspace_path);
+  auto members = load_members(tl_options, workspace, build_profile);
+  link_members(members);
+
+  // a thread per member, which mostly waits. the
+  // work itself happens on the pool every member shares
+  {
+    std::vector<std::jthread> builders;
+    builders.reserve(members.size());
+
+    for (auto& member : members)
+      builders.emplace_back([&] {
+        build_member(
+          threads, workspace, options, build_profile, members, member);
+      });
+  }
+
+  auto const failed = std::ranges::count_if(
+    members, [](auto const& member) { return member.error.has_value(); });
+
+  for (auto const& member : members)
+    if (member.error)
+      threadsafe_print(std::format("workspace member <{}>: {}\n",
+                                   member.config.project.name,
+                                   *member.error));
+
+  if (failed > 0)
+    throw std::runtime_error(
+      std::format("{} of {} workspace member(s) failed to build",
+                  failed,
+                  members.size()));
+
+  threadsafe_print(
+    std::format("built {} workspace member(s)\n", members.size()));
+}